@@ -0,0 +1,99 @@
+#!/opt/conda/envs/SWARM2to3/bin/python
+
+import os
+import sys
+import mmap
+import time
+import struct
+import argparse
+import datetime
+
+# Must match tenzing2root/application/dataCatcher/src/dataCatcherStats.h
+STATS_FILE = '/dev/shm/dataCatcherStats'
+STATS_MAGIC = 0x44435354
+STATS_VERSION = 4
+HISTOGRAM_BINS = 32
+STAGES = ('bundle receipt', 'bundle copy', 'scan completion', 'header',
+          'pseudo-continuum', 'packData', 'scan write', 'file write', 'SWARM receipt',
+          'sch direct write')
+COUNTERS = ('bundles received', 'redundant bundles', 'unexpected bundles',
+            'scans written', 'scans abandoned', 'bytes written', 'SWARM blocks',
+            'NaN replacements', 'header prefetch hits', 'header fetches',
+            'SWARM partial scans', 'SWARM duplicates', 'SWARM late chunks')
+HEADER = struct.Struct('=IIiid')
+COUNTER = struct.Struct('={0}Q'.format(len(COUNTERS)))
+STAGE = struct.Struct('=3Q{0}Q'.format(HISTOGRAM_BINS))
+
+parser = argparse.ArgumentParser(description='Show the performance statistics published by a running dataCatcher')
+parser.add_argument('-w', '--watch', metavar='SECONDS', type=float, default=None,
+                    help='print the statistics every SECONDS, with rates since the last print')
+parser.add_argument('--histogram', action='store_true',
+                    help='also show each stage\'s latency histogram')
+parser.add_argument('-f', '--file', metavar='FILE', type=str, default=STATS_FILE,
+                    help='read the statistics from FILE (default {0})'.format(STATS_FILE))
+args = parser.parse_args()
+
+def read_stats(shm):
+    magic, version, pid, spare, start = HEADER.unpack_from(shm, 0)
+    if magic != STATS_MAGIC:
+        sys.exit('{0} does not hold dataCatcher statistics'.format(args.file))
+    if version != STATS_VERSION:
+        sys.exit('{0} is version {1}, this script reads version {2}'.format(args.file, version, STATS_VERSION))
+    offset = HEADER.size
+    counters = dict(zip(COUNTERS, COUNTER.unpack_from(shm, offset)))
+    offset += COUNTER.size
+    stages = {}
+    for stage in STAGES:
+        values = STAGE.unpack_from(shm, offset)
+        stages[stage] = {'count': values[0], 'sum': values[1], 'max': values[2],
+                         'histogram': values[3:]}
+        offset += STAGE.size
+    return pid, start, counters, stages
+
+def bin_label(b):
+    if b == 0:
+        return '<1us'
+    elif b == HISTOGRAM_BINS-1:
+        return '>={0}us'.format(2**(b-1))
+    else:
+        return '{0}-{1}us'.format(2**(b-1), 2**b)
+
+def show(pid, start, counters, stages, last, interval):
+    print('dataCatcher pid {0}, started {1}'.format(pid, datetime.datetime.fromtimestamp(start)))
+    for counter in COUNTERS:
+        line = '  {0:<20s} {1:>16d}'.format(counter, counters[counter])
+        if last is not None:
+            line += '  {0:>14.1f}/s'.format((counters[counter] - last[0][counter]) / interval)
+        print(line)
+    print('  {0:<18s} {1:>10s} {2:>12s} {3:>12s}'.format('stage', 'count', 'mean (ms)', 'max (ms)'))
+    for stage in STAGES:
+        count, total = stages[stage]['count'], stages[stage]['sum']
+        if last is not None:
+            count -= last[1][stage]['count']
+            total -= last[1][stage]['sum']
+        mean = (total / count) * 1.0e-6 if count else 0.0
+        print('  {0:<18s} {1:>10d} {2:>12.3f} {3:>12.3f}'.format(stage, count, mean,
+                                                                 stages[stage]['max'] * 1.0e-6))
+        if args.histogram:
+            histogram = stages[stage]['histogram']
+            for b in range(HISTOGRAM_BINS):
+                if histogram[b]:
+                    print('      {0:>16s} {1:>10d}'.format(bin_label(b), histogram[b]))
+
+try:
+    fd = os.open(args.file, os.O_RDONLY)
+except OSError as error:
+    sys.exit('Cannot open {0} ({1}) - is dataCatcher running?'.format(args.file, error.strerror))
+shm = mmap.mmap(fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+os.close(fd)
+
+last = None
+while True:
+    pid, start, counters, stages = read_stats(shm)
+    show(pid, start, counters, stages, last, args.watch)
+    if args.watch is None:
+        break
+    last = (counters, stages)
+    sys.stdout.flush()
+    time.sleep(args.watch)
+    print('')
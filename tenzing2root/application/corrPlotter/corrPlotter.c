@@ -46,6 +46,11 @@ level.
 #include <sys/stat.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "corrPlotter.h"
 #include "chunkPlot.h"
@@ -5718,22 +5723,62 @@ void checkForDoubleBandwidth(void)
   }
 }
 
+/*
+  Copy nBytes, starting offset bytes into the correlatorDef, from the
+  buffer corrSaver most recently published (see corrPlotter.h).   If
+  corrSaver publishes again during the copy, it is made again.   Returns
+  the generation of the data copied.
+*/
+unsigned int readCorrelatorShm(correlatorShm *shm, size_t offset, size_t nBytes, void *copy)
+{
+  unsigned int generation;
+  int front;
+
+  while (TRUE) {
+    generation = __atomic_load_n(&shm->generation, __ATOMIC_ACQUIRE);
+    if (generation & 1) {
+      /* corrSaver is in the middle of publishing */
+      usleep(1000);
+      continue;
+    }
+    front = __atomic_load_n(&shm->front, __ATOMIC_ACQUIRE);
+    bcopy(((char *)&shm->buffer[front]) + offset, copy, nBytes);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&shm->generation, __ATOMIC_RELAXED) == generation)
+      return(generation);
+  }
+}
+
+/*
+  Wait until corrSaver publishes something newer than generation, or
+  for seconds seconds, whichever comes first.
+*/
+void waitForCorrelatorShm(correlatorShm *shm, unsigned int generation, int seconds)
+{
+  struct timespec timeout;
+
+  timeout.tv_sec = seconds;
+  timeout.tv_nsec = 0;
+  syscall(SYS_futex, &shm->generation, FUTEX_WAIT, generation, &timeout, NULL, 0);
+}
+
 /*
   sleeper runs as a thread - it looks for changes in the shared memory
   structure written by corrSaver. If a change is seen, a local
-  copy of the data is made, and a screen refresh is queued
+  copy of the data is made, and a screen refresh is queued.   It is
+  woken as soon as corrSaver publishes new data.
 */
 void *sleeper(void *arg)
 {
   int returnCode;
-  correlatorDef *cptr;
+  correlatorShm *shm;
   int changed;
+  unsigned int generation, lastGeneration = 0;
   static int lastScanNumber[N_CRATES];
+  struct shmid_ds shmInfo;
     
   dprintf("Open shared memory segment with key = %d\n", PLT_KEY_ID);
-  returnCode = shmget(PLT_KEY_ID,
-		      sizeof(correlatorDef),
-		      0444);
+  returnCode = shmget(PLT_KEY_ID, 0, 0444);
   if (returnCode < 0) {
     /*
     perror("creating main shared memory structure");
@@ -5742,12 +5787,24 @@ void *sleeper(void *arg)
     fprintf(stderr, "corrSaver not running on this machine - only mir-mode can be used.\n");
     corrSaverMachine = FALSE;
     scanMode = FALSE;
+  } else if ((shmctl(returnCode, IPC_STAT, &shmInfo) < 0) ||
+	     (shmInfo.shm_segsz != sizeof(correlatorShm))) {
+    /* Left by a corrSaver built with a different correlatorShm */
+    fprintf(stderr, "The corrSaver shared memory segment is not %lu bytes - restart corrSaver.\n",
+	    (unsigned long)sizeof(correlatorShm));
+    fprintf(stderr, "Only mir-mode can be used.\n");
+    returnCode = -1;
+    corrSaverMachine = FALSE;
+    scanMode = FALSE;
   }
   dprintf("Create successful\n");
-  cptr = shmat(returnCode, (char *)0, SHM_RDONLY);
-  if (cptr < 0)
+  shm = shmat(returnCode, (char *)0, SHM_RDONLY);
+  if (shm == (correlatorShm *)-1) {
     if (debugMessagesOn)
       perror("shmat call");
+    corrSaverMachine = FALSE;
+    scanMode = FALSE;
+  }
   while (!drawnOnce)
     usleep(10000);
   while (TRUE) {
@@ -5758,32 +5815,36 @@ void *sleeper(void *arg)
     if (scanMode && corrSaverMachine) {
       oldMessageStat.st_mtime = 0;
       changed = TRUE;
-      if (!(cptr->updating)) {
+      if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) == PLT_SHM_MAGIC) {
+	dataHeader header;
+	correlatorDef *copy;
+
+	generation = readCorrelatorShm(shm, offsetof(correlatorDef, header), sizeof(dataHeader), &header);
+	if (generation == lastGeneration)
+	  changed = FALSE;
+	lastGeneration = generation;
 	for (crate = 0; crate < N_CRATES; crate++)
-	  if (cptr->header.crateActive[crate]) {
-	    if ((cptr->header.scanNumber[crate] == lastScanNumber[crate]) &&
-		((cptr->header.scanNumber[crate] > 0))) {
+	  if (header.crateActive[crate]) {
+	    if ((header.scanNumber[crate] == lastScanNumber[crate]) &&
+		((header.scanNumber[crate] > 0))) {
 	      changed = FALSE;
 	    }
 	  }
-	if (debugMessagesOn && 0)
-	  printCorrelatorState(cptr);
 	if (changed) {
 	  newPoints = TRUE;
 	  lock_data();
-	  for (crate = 0; crate < N_CRATES; crate++)
-	    if (cptr->header.crateActive[crate])
-	      lastScanNumber[crate] = cptr->header.scanNumber[crate];
 	  if (!integrate) {
 	    /* Copy the entire correlator data structure from shared memory */
-	    bcopy(cptr, &correlator, sizeof(correlatorDef));
+	    copy = &correlator;
+	    lastGeneration = readCorrelatorShm(shm, 0, sizeof(correlatorDef), copy);
 	    nIntegrations = 1;
 	  } else {
 	    int bsln, sb, rx, channel;
 	    char currentSource[100];
 	    FILE *projectInfo;
 
-	    bcopy(cptr, &scratchCorrelatorCopy, sizeof(correlatorDef));
+	    copy = &scratchCorrelatorCopy;
+	    lastGeneration = readCorrelatorShm(shm, 0, sizeof(correlatorDef), copy);
 	    projectInfo = fopen("/sma/rtdata/engineering/monitorLogs/littleLog.txt", "r");
 	    if (projectInfo != NULL) {
 	      fscanf(projectInfo, "%s", &currentSource[0]);
@@ -5828,10 +5889,15 @@ void *sleeper(void *arg)
 	      nIntegrations++;
 	    }
 	  }
+	  for (crate = 0; crate < N_CRATES; crate++)
+	    if (copy->header.crateActive[crate])
+	      lastScanNumber[crate] = copy->header.scanNumber[crate];
 	  unlock_data();
 	}
-      }  else if (debugMessagesOn) {
-	printf("Update blocked by writer\n");
+      }  else {
+	changed = FALSE;
+	if (debugMessagesOn)
+	  printf("corrSaver has not set up the shared memory yet\n");
       }
     } else {
       char fileName[100];
@@ -5860,9 +5926,12 @@ void *sleeper(void *arg)
     }
     if (changed && (!disableUpdates))
       forceRedraw("sleeper");
-    if (scanMode)
-      sleep(5+interscanPause);
-    else
+    if (scanMode && corrSaverMachine) {
+      /* Sleep until corrSaver publishes new data, or 5 seconds at most */
+      if (interscanPause > 0)
+	sleep(interscanPause);
+      waitForCorrelatorShm(shm, lastGeneration, 5);
+    } else
       sleep(5+interscanPause);
   }
 }
@@ -62,4 +62,23 @@ typedef struct correlatorDef {
   sWARMBaselineData sWARMBaseline[N_BASELINES_PER_CRATE];
   sWARMAutocorrelationData sWARMAutocorrelation[N_ANTENNAS];
 } correlatorDef;
+
+/*
+  The shared memory segment (key PLT_KEY_ID) written by corrSaver holds
+  PLT_N_BUFFERS copies of correlatorDef.   corrSaver updates a back
+  buffer, and publishes it by making it the front buffer.   generation
+  is a sequence lock: it is odd while a publish is in progress, and goes
+  up by 2 with each one.   Readers copy buffer[front], and retry if
+  generation changed while they did.   generation is also a futex, woken
+  after each publish, so readers can wait for new data instead of polling.
+*/
+#define PLT_N_BUFFERS (2)
+#define PLT_SHM_MAGIC (0x434f5252) /* "CORR" */
+
+typedef struct correlatorShm {
+  int magic;                 /* PLT_SHM_MAGIC once corrSaver has set the segment up */
+  unsigned int generation;   /* Sequence lock and futex word                        */
+  int front;                 /* The buffer readers should use                       */
+  correlatorDef buffer[PLT_N_BUFFERS];
+} correlatorShm;
 #endif
@@ -5,10 +5,23 @@
 #include <sys/shm.h> 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "corrPlotter.h"
 #include "chunkPlot.h"
 
+/*
+  Updates are published to corrPlotter at most this often (seconds), so
+  that corrPlotter isn't woken for every record.
+*/
+#define PUBLISH_INTERVAL (0.5)
+
 int debugMessagesOn = FALSE;
 int doubleBandwidth;
 
@@ -140,12 +153,146 @@ void print_vis_bundle(pCrateUVBlock *bundle)
   }
 }
 
+/*
+  cptr points to the back buffer in the shared memory segment, which the
+  RPC routines below update, with publishMutex held.   The publisher
+  thread makes it the front buffer at most every PUBLISH_INTERVAL seconds.
+
+  Publishing only swaps the buffers, so the new back buffer is missing
+  whatever changed since the previous publish.   The correlatorDef is
+  split into the sections below, and the back buffer's sections which
+  are older than the front buffer's are marked stale.   An RPC routine
+  calls sectionTouch before changing a section, which brings it up to
+  date first if need be, and the publisher thread brings the rest up to
+  date one section at a time, letting the RPC routines in between.
+*/
+#define SECTION_HEADER   (0)                                  /* updating, header, sWARMScan */
+#define SECTION_CRATE    (SECTION_HEADER+1)                   /* + crate index               */
+#define SECTION_BASELINE (SECTION_CRATE+N_CRATES)             /* + SWARM baseline index      */
+#define SECTION_AUTO     (SECTION_BASELINE+N_BASELINES_PER_CRATE) /* + antenna               */
+#define N_SECTIONS       (SECTION_AUTO+N_ANTENNAS)
+#define SECTION_BIT(section) (1ULL << (section))
+
+correlatorShm *shm = NULL;
 correlatorDef *cptr = NULL;
+int back;
+unsigned long long changedSections = 0; /* Changed in the back buffer since the last publish */
+unsigned long long staleSections = 0;   /* Older in the back buffer than in the front one    */
+int publishPending = FALSE;
+double lastPublish = 0.0;
+pthread_mutex_t publishMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t publishCond = PTHREAD_COND_INITIALIZER;
+pthread_t publisherTId;
+
+double timeNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9);
+}
+
+/*
+  Copy one section of the front buffer into the back buffer, which is
+  then up to date in that section.   Must be called with publishMutex
+  held.
+*/
+void sectionCopy(int section)
+{
+  correlatorDef *front;
+
+  front = &shm->buffer[shm->front];
+  if (section == SECTION_HEADER) {
+    cptr->updating = front->updating;
+    cptr->header = front->header;
+    cptr->sWARMScan = front->sWARMScan;
+  } else if (section < SECTION_BASELINE)
+    memcpy(&cptr->crate[section-SECTION_CRATE], &front->crate[section-SECTION_CRATE],
+	   sizeof(crateDef));
+  else if (section < SECTION_AUTO)
+    memcpy(&cptr->sWARMBaseline[section-SECTION_BASELINE],
+	   &front->sWARMBaseline[section-SECTION_BASELINE], sizeof(sWARMBaselineData));
+  else
+    memcpy(&cptr->sWARMAutocorrelation[section-SECTION_AUTO],
+	   &front->sWARMAutocorrelation[section-SECTION_AUTO], sizeof(sWARMAutocorrelationData));
+  staleSections &= ~SECTION_BIT(section);
+}
+
+/*
+  Called by the RPC routines, with publishMutex held, before they change
+  anything in section.
+*/
+void sectionTouch(int section)
+{
+  if ((section < 0) || (section >= N_SECTIONS))
+    return;
+  if (staleSections & SECTION_BIT(section))
+    sectionCopy(section);
+  changedSections |= SECTION_BIT(section);
+}
+
+/*
+  Make the back buffer the front one, and wake any corrPlotters waiting
+  for data.   The generation is odd while the buffers are swapped, and
+  has changed before the old front buffer, which readers may still be
+  copying, is brought up to date.   Must be called with publishMutex
+  held, and no stale sections.
+*/
+void publish(void)
+{
+  int front;
+
+  __atomic_add_fetch(&shm->generation, 1, __ATOMIC_SEQ_CST);
+  front = back;
+  back = shm->front;
+  __atomic_store_n(&shm->front, front, __ATOMIC_SEQ_CST);
+  cptr = &shm->buffer[back];
+  __atomic_add_fetch(&shm->generation, 1, __ATOMIC_SEQ_CST);
+  syscall(SYS_futex, &shm->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  staleSections = changedSections;
+  changedSections = 0;
+  publishPending = FALSE;
+  lastPublish = timeNow();
+}
+
+void *publisher(void *arg)
+{
+  double wait;
+
+  pthread_mutex_lock(&publishMutex);
+  while (TRUE) {
+    while (!publishPending)
+      pthread_cond_wait(&publishCond, &publishMutex);
+    wait = lastPublish + PUBLISH_INTERVAL - timeNow();
+    if (wait > 0.0) {
+      pthread_mutex_unlock(&publishMutex);
+      usleep((useconds_t)(wait*1.0e6));
+      pthread_mutex_lock(&publishMutex);
+    }
+    publish();
+    while (staleSections != 0) {
+      sectionCopy(__builtin_ctzll(staleSections));
+      pthread_mutex_unlock(&publishMutex);
+      pthread_mutex_lock(&publishMutex);
+    }
+  }
+  return(NULL);
+}
+
+/* Called by the RPC routines when they have finished updating cptr */
+void dataUpdated(void)
+{
+  publishPending = TRUE;
+  pthread_cond_signal(&publishCond);
+  pthread_mutex_unlock(&publishMutex);
+}
 
 void makeSharedMemory(void)
 {
   int returnCode;
+  unsigned int generation;
   FILE *shmmax;
+  struct shmid_ds shmInfo;
   
   if (debugMessagesOn)
     printf("And it's the first call\n");
@@ -153,15 +300,29 @@ void makeSharedMemory(void)
   if (shmmax == NULL) {
     perror("fopen on /proc/sys/kernel/shmmax");
   } else {
-    fprintf(shmmax, "%d", sizeof(correlatorDef)+1);
+    fprintf(shmmax, "%d", sizeof(correlatorShm)+1);
     fclose(shmmax);
   }
   if (debugMessagesOn || 1)
-    printf("The size of the correlator structure is %d bytes\n",
-	   sizeof(correlatorDef));
+    printf("The size of the correlator structure is %d bytes (%d buffers)\n",
+	   sizeof(correlatorDef), PLT_N_BUFFERS);
   printf("PLT_KEY_ID = %d\n", PLT_KEY_ID);
+  /*
+    A segment left by a corrSaver with a different correlatorShm can't
+    be attached at this size (shmget fails with EINVAL), so remove it.
+    corrPlotters still attached to it keep it until they detach.
+  */
+  returnCode = shmget(PLT_KEY_ID, 0, 0);
+  if ((returnCode >= 0) && (shmctl(returnCode, IPC_STAT, &shmInfo) == 0) &&
+      (shmInfo.shm_segsz != sizeof(correlatorShm))) {
+    printf("Removing the old %lu byte shared memory segment\n", (unsigned long)shmInfo.shm_segsz);
+    if (shmctl(returnCode, IPC_RMID, NULL) < 0) {
+      perror("removing old shared memory structure");
+      exit(-1);
+    }
+  }
   returnCode = shmget(PLT_KEY_ID,
-		      sizeof(correlatorDef),
+		      sizeof(correlatorShm),
 		      IPC_CREAT | 0666);
   if (returnCode < 0) {
     perror("creating main shared memory structure");
@@ -169,16 +330,33 @@ void makeSharedMemory(void)
   }
   if (debugMessagesOn)
     printf("Create successful\n");
-  if (debugMessagesOn)
-    printf("cptr before shmat call = 0x%x\n", cptr);
-  cptr = shmat(returnCode, (char *)0, 0);
-  if ((int)cptr < 0)
+  shm = shmat(returnCode, (char *)0, 0);
+  if (shm == (correlatorShm *)-1) {
     perror("shmat call");
+    exit(-1);
+  }
   if (debugMessagesOn)
-    printf("cptr after shmat call = 0x%x\n", cptr);
+    printf("shm after shmat call = 0x%x\n", shm);
+  /*
+    Clear the buffers inside the sequence lock, and keep the generation
+    going up from where the last corrSaver left it, so that corrPlotters
+    which have already read the old data see the change.
+  */
+  generation = __atomic_load_n(&shm->generation, __ATOMIC_SEQ_CST);
+  generation += 1 + (generation & 1);
+  __atomic_store_n(&shm->generation, generation, __ATOMIC_SEQ_CST);
+  bzero(shm->buffer, sizeof(shm->buffer));
+  shm->front = 0;
+  __atomic_store_n(&shm->generation, generation+1, __ATOMIC_SEQ_CST);
+  back = 1;
+  cptr = &shm->buffer[back];
+  __atomic_store_n(&shm->magic, PLT_SHM_MAGIC, __ATOMIC_SEQ_CST);
+  if (pthread_create(&publisherTId, NULL, publisher, NULL) != 0) {
+    perror("pthread_create (publisher)");
+    exit(-1);
+  }
   if (debugMessagesOn)
     printf("End of firstCall activities\n");
-  bzero(cptr, sizeof(*cptr));
 }
 
 statusStructure *result2;
@@ -202,6 +380,8 @@ CLIENT *cl;
       perror("send_visibilities malloc");
     firstCall = FALSE;
   }
+  pthread_mutex_lock(&publishMutex);
+  sectionTouch(SECTION_HEADER);
   cptr->updating = TRUE;
   if (debugMessagesOn && 0)
     print_vis_bundle(data);
@@ -254,6 +434,8 @@ CLIENT *cl;
     printf("Message from crate %d, processing block %d\n",
 	   data->crateNumber, data->blockNumber);
   crate = data->crateNumber;
+  if ((crate >= 1) && (crate <= N_CRATES))
+    sectionTouch(SECTION_CRATE + crate-1);
   result2->rt_code = 0;
   /*
     Update general header variables
@@ -382,6 +564,7 @@ CLIENT *cl;
   if (debugMessagesOn || 1)
     print_sm_structure(cptr);
   cptr->updating = 0;
+  dataUpdated();
   return((statusStructure *)result2);
 }
 
@@ -407,6 +590,8 @@ CLIENT *cl;
   int i, j, ant1, ant2, chunk;
 
   printf("In plot_swarm_data_1\n");
+  pthread_mutex_lock(&publishMutex);
+  sectionTouch(SECTION_HEADER);
   cptr->updating = TRUE;
   printf("nChannels = %d\n", data->nChannels);
   if (firstCall) {
@@ -426,6 +611,7 @@ CLIENT *cl;
   if (ant1 == ant2) {
     /* Auto correlation spectrum sent */
     printf("Saving autocorrelation spectrum from antenna %d\n", ant1);
+    sectionTouch(SECTION_AUTO + ant1);
     for (chunk = 0; chunk < N_SWARM_CHUNKS; chunk++)
       for (i = 0; i < P_N_SWARM_CHANNELS; i++)
 	cptr->sWARMAutocorrelation[ant1].amp[chunk][i] = data->lSB[i];
@@ -434,6 +620,7 @@ CLIENT *cl;
     /* Cross correlation spectrum sent */
     j = baselineMapping[ant1-1][ant2-1];
     printf("Saving cross correlation spectrum for baseline %d-%d (index %d)\n", ant1, ant2, j);
+    sectionTouch(SECTION_BASELINE + j);
     cptr->sWARMBaseline[j].ant[0] = ant1;
     cptr->sWARMBaseline[j].ant[1] = ant2;
     chunk = data->chunk;
@@ -461,6 +648,7 @@ CLIENT *cl;
   }
   cptr->sWARMScan++;
   cptr->updating = FALSE;
+  dataUpdated();
   printf("Exiting plot_swarm_data_1\n");
   return((statusStructure *)sWARMResult);
 }
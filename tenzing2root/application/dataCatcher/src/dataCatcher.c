@@ -20,13 +20,16 @@
 
 /*   P R E P R O C E S S O R   C O M A N D S   */
 
+#define _GNU_SOURCE /* For fallocate and O_DIRECT */
 #include <math.h>
 #include <bits/nan.h>
 #include <rpc/rpc.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <time.h>
@@ -35,6 +38,13 @@
 #include <string.h>
 #include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <aio.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "/global/include/astrophys.h"
 #include "/global/include/scanFlags.h"
@@ -48,6 +58,12 @@
 #include "setLO.h"
 #include "dataDirectoryCodes.h"
 #include "blocks.h"
+#include "schCodec.h"
+#include "uvwGeometry.h"
+#include "packData.h"
+#include "dataCatcherStats.h"
+#include "dataCatcherCapture.h"
+#include "swarmStream.h"
 
 #define N_SWARM_CHUNK_POINTS (16384)
 #define MAX_SWARM_CHUNK (2)
@@ -55,6 +71,7 @@
 #define SWARM_IF_MIDPOINT (9.0)
 #define SWARM_CRATE (13)
 #define SWARM_BLOCK (7)
+#define MAX_SWARM_SETS (2*28) /* Chunks times the baselines between antennas 1-8 */
 
 #define dprintf if (debugMessagesOn) printf /* Print IFF debugging          */
 #define MAX_RX              (2)
@@ -65,6 +82,26 @@
 #define MAX_INTERIM_CHUNK   (2)
 #define MAX_SB              (2) /* Two sidebands */
 #define MAX_PENDING_SCANS   (3)
+#define SCAN_POOL_SIZE      (MAX_PENDING_SCANS+2) /* Pending scans, plus the one being */
+                                                  /* written, plus a spare.            */
+/*
+  Scan slot states.   A slot moves through these states in order:
+  FREE -> RECEIVING -> NEEDS_HEADER -> COMPLETE -> WRITING -> FREE
+  A slot which is dropped before it is complete becomes ABANDONED, and
+  is freed as soon as the HEADER thread is no longer using it.
+  The state is kept in the low byte of the slot's state word, and the
+  rest of the word holds a generation count, bumped each time the slot
+  is reused, so that a stale compare-and-swap can never succeed.
+*/
+#define SCAN_FREE           (0) /* Slot is available                                  */
+#define SCAN_RECEIVING      (1) /* Bundles are still arriving                         */
+#define SCAN_NEEDS_HEADER   (2) /* All bundles are in, waiting for statusServer info  */
+#define SCAN_COMPLETE       (3) /* Ready for the WRITER thread                        */
+#define SCAN_WRITING        (4) /* Being written by the WRITER thread                 */
+#define SCAN_ABANDONED      (5) /* Dropped, HEADER thread may still be using it       */
+#define SCAN_STATE(word)    ((word) & 0xff)
+#define SCAN_GENERATION(word) ((word) >> 8)
+#define SCAN_WORD(generation, state) (((generation) << 8) | (state))
 #define MAX_PAD            (26)
 #define MAX_SPACELIKE_COORD (3)
 #define MAX_POLARIZATION    (4)
@@ -72,6 +109,76 @@
 #define UNINITIALIZED      (-1) /* Flags an uninitialized array element */
 #define MIDPOINT_SLOP 1.0       /* Bundles differing by less than this amount are
 			           considered to be part of the same scan. */
+#define SLAB_ALIGN (sizeof(double)) /* Alignment of the pieces of a bundle slab */
+#define SLAB_ROUND(n) ((((n) + SLAB_ALIGN - 1) / SLAB_ALIGN) * SLAB_ALIGN)
+/*
+  MIR data files which are written once per scan by the MIR_IO thread.
+  Each one has its own buffer in a scanOutput structure.
+*/
+#define MIR_PLOT            (0)        /* plot_me_5_rx0 .. plot_me_5_rx(MAX_RX-1) */
+#define MIR_BL              (MAX_RX)   /* bl_read                                 */
+#define MIR_WE              (MAX_RX+1) /* we_read                                 */
+#define MIR_TSYS            (MAX_RX+2) /* tsys_read                               */
+#define MIR_CODES           (MAX_RX+3) /* codes_read                              */
+#define MIR_ENG             (MAX_RX+4) /* eng_read                                */
+#define MIR_IN              (MAX_RX+5) /* in_read                                 */
+#define MIR_SP              (MAX_RX+6) /* sp_read                                 */
+#define MIR_SCH             (MAX_RX+7) /* sch_read, or sch_compressed              */
+#define MIR_SCH_INDEX       (MAX_RX+8) /* sch_index, only with sch_compressed     */
+#define N_MIR_FILES         (MAX_RX+9)
+#define OUTPUT_RING_SIZE    (2) /* One scan being computed, one being written */
+/*
+  MIR file output backends, selected by the "mirOutput" line in CONFIG_FILE.
+  MIR_OUTPUT_STDIO writes each file's records for a scan with one fwrite.
+  MIR_OUTPUT_PREALLOCATED reserves disk space ahead of the data with
+  fallocate, writes each file's records with one write call, and
+  fdatasyncs the files at the end of each scan.
+*/
+#define MIR_OUTPUT_STDIO        (0)
+#define MIR_OUTPUT_PREALLOCATED (1)
+#define MIR_OUTPUT_DIRECT       (2) /* Only used for sch_read, see mirFileWrite */
+#define DIRECT_IO_ALIGN         (4096) /* O_DIRECT buffer, offset and size alignment */
+#define PREALLOCATE_SCANS       (16)      /* Preallocate room for this many more scans */
+#define PREALLOCATE_MINIMUM     (1048576) /* Smallest preallocation, in bytes          */
+#define CONFIG_FILE "/global/configFiles/dataCatcher.conf"
+/*
+  Header snapshots, used by the HEADER thread to fetch a scan's header
+  information before the scan's first bundle arrives.
+*/
+#define HEADER_SNAPSHOTS        (4)   /* Cached header fetches                        */
+#define HEADER_PREFETCH_LEAD    (2.0) /* Default seconds before the expected boundary */
+#define REPLAY_IDLE             (5.0) /* Seconds with nothing written before a replay ends */
+/*
+  A SWARM scan is passed on, with whatever chunks are missing flagged,
+  this many seconds after its first cross correlation arrived.
+*/
+#define SWARM_SCAN_DEADLINE     (15.0) /* Default seconds, 0 to wait forever */
+#define SWARM_IN_FLIGHT         (4)    /* SWARM scans which may be collected at once */
+#define SWARM_DURATION_SLOP     (0.001) /* Seconds two chunks' durations may differ by */
+/*
+  SWARM data up to this many seconds older than the last SWARM scan passed
+  on are late, and are thrown away.   Data from further back mean that UT
+  has started again - a new UT day, or SWARM has been restarted.
+*/
+#define SWARM_LATE_WINDOW       (600.0)
+/*
+  SWARM spectra may be averaged down by a power of two before they are
+  stored, if the project asks for it in SWARM_AVERAGING_FILE.
+*/
+#define SWARM_AVERAGING_FILE    "/global/projects/swarmSpectralAveraging"
+#define SWARM_AVERAGE_BOXCAR    (0)    /* Plain mean of each factor channels           */
+#define SWARM_AVERAGE_WEIGHTED  (1)    /* Triangular weights over 2*factor channels    */
+#define SWARM_MAX_DECIMATION    (1024)
+/*
+  Threads which help the WRITER thread sum the channels of each chunk
+  for the pseudo-continuum.
+*/
+#define PC_WORKERS              (3)    /* Default, 0 for the WRITER thread alone */
+#define MAX_PC_WORKERS          (16)
+/* The bit for baseline a1-a2 (1 <= a1 < a2 <= 8), chunk c, in an sWARMScan's masks */
+#define SWARM_CHUNK_BIT(a1, a2, c) (1ULL << (2*(((a1)-1)*(16-(a1))/2 + (a2)-(a1)-1) + (c)))
+/* sph.flags bit for a SWARM spectrum which never arrived, and was stored as zeros */
+#define SFLAG_SWARM_MISSING        (0x40000000)
 
 #define LONGRAD                (-2.713594689147) /* pad1 */
 #define LATRAD                 (0.345997653446)  /* pad1 */
@@ -92,11 +199,16 @@
 /* processBundle error codes */
 #define UNEXPECTED_BUNDLE      (-2)
 #define REDUNDANT_BUNDLE       (-3)
+#define NO_FREE_SCAN_SLOT      (-4)
 
 #define SERVER_PRIORITY (20)
 #define HEADER_PRIORITY (19)
 #define WRITER_PRIORITY (18)
+#define MIR_IO_PRIORITY (18)
 #define COPIER_PRIORITY (17)
+#define SWARM_STREAM_PRIORITY (SERVER_PRIORITY)
+#define SWARM_HANDOFF_PRIORITY (SERVER_PRIORITY)
+#define PC_WORKER_PRIORITY (WRITER_PRIORITY)
 
 #define POL_STATE_UNKNOWN (0)
 #define POL_STATE_RR      (1)
@@ -124,7 +236,55 @@ typedef struct dSMInfo {
   char polarStates[12];
 } dSMInfo;
 
+/*
+  Each slot in the scan pool has an arena, which holds all the bundle data
+  for the scan occupying the slot.   Nothing is freed from an arena
+  individually - the whole arena is reset when the writer is done with the
+  scan.   If a scan needs more space than the arena has, the excess comes
+  from overflow blocks, and the arena is enlarged at the next reset, so after
+  the first few scans of a given size no malloc calls are made at all.
+*/
+typedef struct arenaOverflow {
+  struct arenaOverflow *next;
+} arenaOverflow;
+
+typedef struct scanArena {
+  char          *base;     /* Preallocated storage                            */
+  size_t        size;      /* Number of bytes at base                         */
+  size_t        used;      /* Bytes handed out from base since the last reset */
+  size_t        demand;    /* Total bytes requested since the last reset      */
+  arenaOverflow *overflow; /* Blocks malloc'd because base was too small      */
+} scanArena;
+
+/*
+  An sWARMScan collects the SWARM data for one scan, one baseline and
+  chunk at a time.   The spectra are stored as separate real and
+  imaginary arrays, exactly as the bundle code wants them, so once the
+  scan is complete its chunks are used in place as the SWARM crate's
+  bundle (see sWARM2Bundle), rather than being copied again.
+*/
+typedef struct sWARMChunk {
+  float lSBReal[N_SWARM_CHUNK_POINTS];
+  float lSBImag[N_SWARM_CHUNK_POINTS];
+  float uSBReal[N_SWARM_CHUNK_POINTS];
+  float uSBImag[N_SWARM_CHUNK_POINTS];
+} sWARMChunk;
+
+typedef struct sWARMSScan {
+  double uT;
+  double duration;
+  double deadline;                     /* statsNow() time to give up waiting     */
+  sWARMChunk *data[9][9][2];
+  unsigned long long expected;         /* SWARM_CHUNK_BIT of each non-NULL chunk */
+  unsigned long long received;         /* SWARM_CHUNK_BIT of each filled chunk   */
+  unsigned long long missing;          /* SWARM_CHUNK_BIT of each zero-filled one */
+  int outstanding;                     /* Expected chunks not yet received       */
+  struct sWARMSScan *next;             /* Free list or handoff queue link        */
+} sWARMScan;
+
 typedef struct pendingScan {
+  unsigned int  state;                 /* Generation and state (SCAN_* above)    */
+  scanArena     arena;                 /* Storage for the cached bundles         */
   int           expected[MAX_CRATE+1]; /* List of crates expected to report      */
   int           received[MAX_CRATE+1]; /* List of crates that have been received */
   double        firstTime;             /* Time stamp of first bundle             */
@@ -137,6 +297,7 @@ typedef struct pendingScan {
   double        chunkFreq[MAX_RX][MAX_SB][(2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK)+1];
   double        chunkVelo[MAX_RX][MAX_SB][(2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK)+1];
   double        sWARMFreq[MAX_SB][MAX_SWARM_CHUNK], sWARMVelo[MAX_SB][MAX_SWARM_CHUNK];
+  unsigned int  freqGeneration;        /* Changes when the frequency tables do   */
   double        u[MAX_ANT+1][MAX_ANT+1];
   double        v[MAX_ANT+1][MAX_ANT+1];
   double        w[MAX_ANT+1][MAX_ANT+1];
@@ -148,10 +309,95 @@ typedef struct pendingScan {
   int           nDaisyChained[MAX_CRATE+1];
   int           nInDaisyChain[MAX_CRATE+1];
   dCrateUVBlock *data[MAX_CRATE+1];    /* Cached copy of UV data bundles         */
-  char *last;
-  char *next;
+  sWARMScan     *sWARM;                /* SWARM spectra data[SWARM_CRATE] uses   */
 } pendingScan;
 
+/*
+  A headerSnapshot holds the result of one fetch of header information
+  from statusServer and DSM, for the scan with midpoint time uT.   The
+  HEADER thread fetches them ahead of time, and copies one into a scan
+  when the scan arrives.   Only the HEADER thread touches them.
+*/
+typedef struct headerSnapshot {
+  int     valid;                /* Holds a fetch not yet used by any scan  */
+  double  uT;                   /* Scan time the fetch was made for        */
+  double  intTime;
+  double  fetchTime;            /* Unix time the fetch finished            */
+  int     spoilScan;            /* Source changed during the fetch         */
+  char    sourceName[35];
+  double  sWARMCenterFrequency;
+  double  bDAIFSep;
+  info    header;               /* Stuff from statusServer                 */
+  dSMInfo dSMStuff;
+} headerSnapshot;
+
+/*
+  A scanOutput holds everything the WRITER thread produces for one scan,
+  as it will appear in the MIR data files.   The WRITER thread fills one
+  while the MIR_IO thread is writing the previous one to disk.   The buffers
+  are kept from scan to scan, so they only grow until they are big enough
+  for the largest scan seen.
+*/
+typedef struct mirBuffer {
+  char   *data;
+  size_t size;  /* Bytes allocated at data */
+  size_t used;  /* Bytes filled this scan  */
+} mirBuffer;
+
+typedef struct scanOutput {
+  int       newFiles;              /* Close the old files and open new ones in path */
+  char      path[80];              /* Directory the files should be in              */
+  int       plotActive[MAX_RX];    /* Which plot_me_5 files should exist            */
+  int       schCompressed;         /* Write sch_compressed and sch_index            */
+  int       scanNumber;
+  mirBuffer buffer[N_MIR_FILES];
+} scanOutput;
+
+/*
+  A staging buffer for MIR_OUTPUT_DIRECT writes.   Each direct file has
+  two, so that one can be filled while the other is being written.
+*/
+typedef struct directStage {
+  char          *data;     /* DIRECT_IO_ALIGN aligned                      */
+  size_t        size;      /* Bytes allocated at data                      */
+  int           inFlight;  /* An aio_write from this buffer is outstanding */
+  int           scanNumber;
+  struct aiocb  cb;
+  sem_t         done;      /* Posted by directWriteDone                    */
+  double        submitTime;
+  double        doneTime;
+} directStage;
+
+/*
+  The MIR_IO thread's handle on one MIR data file.
+*/
+typedef struct mirFile {
+  int   open;
+  int   mode;        /* The MIR_OUTPUT_* backend the file was opened with */
+  FILE  *stream;     /* Used by MIR_OUTPUT_STDIO                          */
+  int   fd;          /* Used by MIR_OUTPUT_PREALLOCATED and _DIRECT       */
+  int   preallocate; /* FALSE if the file system can't do fallocate       */
+  off_t written;     /* Bytes written to the file                         */
+  off_t allocated;   /* Bytes of disk space reserved for the file         */
+  int   nextStage;                  /* MIR_OUTPUT_DIRECT only */
+  int   failed;                     /* A write could not be completed   */
+  char  tail[DIRECT_IO_ALIGN];      /* Data in the last, partial, block */
+  directStage stage[2];
+} mirFile;
+
+/*
+  Completion accounting for the direct sch_read writes.
+*/
+typedef struct directIOStats {
+  int    nWrites;
+  int    nErrors;
+  double bytes;
+  double lastLatency;  /* Seconds from aio_write to completion */
+  double minLatency;
+  double maxLatency;
+  double sumLatency;
+} directIOStats;
+
 typedef struct crateSetIndex {
   short crate;
   short set;
@@ -164,14 +410,60 @@ typedef struct baselineIndex {
   short code;
 } baselineIndex;
 
+/*
+  A pCChunk is one sideband of one chunk on one baseline, whose channels
+  are summed for the pseudo-continuum.   The sums are filled in by
+  pCChunkSums, possibly in another thread, and then added, in order,
+  into the WRITER thread's pseudo-continuum arrays.
+*/
+typedef struct pCChunk {
+  float *real;                         /* Channel data                            */
+  float *imag;
+  int   startChannel, endChannel;      /* Inclusive range of channels to sum      */
+  float channelWeight;
+  short rx, ant1, ant2, sb, pol;       /* Where the sums go                       */
+  float realSum, imagSum, ampSum;      /* Results                                 */
+  int   gotNAN;                        /* TRUE if a real part was a NaN           */
+} pCChunk;
+
+/*
+  The inputs which determine the chunk frequency and velocity tables.
+  calculateChunkFrequencies keeps the last set of tables it made, and
+  only recomputes them when one of these changes.
+*/
+typedef struct frequencySetup {
+  struct frequenciesDef frequencies;
+  double restFrequency[MAX_RX];
+  double vRadial, vCatalog;
+  double bDAIFSep, sWARMCenterFrequency;
+  int    doubleBandwidth, doubleBandwidthRx;
+} frequencySetup;
+
+/*
+  The spectrum header frequency fields for one chunk, as last calculated
+  by the writer.   They are reused until the scan's freqGeneration or
+  the chunk's number of channels changes.
+*/
+typedef struct sphFrequencyCache {
+  unsigned int generation;             /* freqGeneration they were made for, 0 if none */
+  int          nChannels;
+  sphDef       sph;                    /* Only fsky, vel, fres and vres are valid */
+} sphFrequencyCache;
+
 /*   G L O B A L   V A R I A B L E S   */
 
-typedef struct sWARMAutoRec {
-  autoCorrDef autoData;
-  struct sWARMAutoRec *last;
-  struct sWARMAutoRec *next;
-} sWARMAutoRec;
-sWARMAutoRec *sWARMAutoRoot = NULL;
+/*
+  SWARM autocorrelations are kept in a table with one autoCorrDef per
+  antenna, holding both chunks.   There are two tables: sWARMStoreBlock
+  fills sWARMAutoTables[sWARMAutoFill], while writeAutoData writes out the
+  other one, and the two are swapped once per scan written.
+*/
+typedef struct sWARMAutoTable {
+  int         present[MAX_ANT+1];      /* Bit (1 << chunk) set for each chunk received */
+  autoCorrDef autoData[MAX_ANT+1];
+} sWARMAutoTable;
+sWARMAutoTable sWARMAutoTables[2];
+int sWARMAutoFill = 0;                 /* Protected by autoMutex */
 
 double sWARMCenterFrequency;
 short goodChunk[MAX_RX+1][MAX_ANT+1][MAX_ANT+1][(2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK)+1];
@@ -180,8 +472,6 @@ int antennaInArray[11];
 int activeCrates[MAX_CRATE+1];
 int abortOnMinorErrors = FALSE; /* Abort on detection of errors even if recoverable */
 int debugMessagesOn = FALSE;
-int needHeader      = FALSE; /* Used with condition variable to activate header thread */
-int needWrite       = FALSE; /* Used with condition variable to activate writer thread */
 int doDSMWrite      = FALSE;  /* Turn on or off the writing of DSM variables            */
 int needNewDataFile = TRUE;
 int safeRestarts    = TRUE;  /* If TRUE, abort on HUP signal rather than trying to     */
@@ -208,6 +498,32 @@ int nBaselineCodes = 0;
 int nAntennas = 0;
 int iRefTime = -1;
 int store = TRUE;
+int mirOutputMode = MIR_OUTPUT_STDIO; /* Backend used when the MIR files are next opened */
+int schDirectIO = FALSE;              /* If TRUE, sch_read bypasses the page cache        */
+int schCompression = FALSE;           /* If TRUE, write sch_compressed instead of sch_read */
+directIOStats schIOStats = {0, 0, 0.0, 0.0, 1.0e30, 0.0, 0.0};
+int headerPrefetch = FALSE;           /* If TRUE, fetch header info ahead of each scan    */
+double headerPrefetchLead = HEADER_PREFETCH_LEAD; /* Seconds before the expected scan   */
+int swarmStreamPort = SWARM_STREAM_PORT; /* TCP port for batched SWARM data, 0 for none */
+double swarmScanDeadline = SWARM_SCAN_DEADLINE; /* Seconds to wait for a whole SWARM scan */
+int sWARMDecimation = 1;              /* SWARM channels averaged into each stored one, WRITER only */
+int pCWorkers = PC_WORKERS;           /* Pseudo-continuum helper threads wanted   */
+int pCWorkersStarted = 0;             /* ... and actually running                 */
+pCChunk *pCWork;                      /* The chunks being summed, see pCSumChunks */
+int pCNWork;
+int pCNext;                           /* Next pCWork entry to be claimed          */
+int sWARMAveraging = SWARM_AVERAGE_BOXCAR;
+headerSnapshot headerCache[HEADER_SNAPSHOTS]; /* Only used by the HEADER thread */
+char captureFileName[100] = "";       /* Record everything received here, see dataCatcherCapture.h */
+FILE *captureFile = NULL;
+XDR captureXDR;
+double captureStart;                  /* statsNow() when captureFile was opened     */
+int captureFailed = FALSE;            /* Don't keep trying to open a bad captureFile */
+int replaying = FALSE;                /* Being run by dataCatcherReplay              */
+headerSnapshot *replaySnapshots = NULL; /* Header snapshots read from a capture file */
+int nReplaySnapshots = 0;
+dcStats localStats;                   /* Used if the shared memory segment can't be made */
+dcStats *stats = &localStats;         /* Performance statistics, see dataCatcherStats.h  */
 char pathName[80];          /* path for directory where data is stored      */
 char globalSourceName[35];
 int spoilScanFlag = FALSE;
@@ -215,9 +531,13 @@ double globalSkyFrequency[2];
 struct frequenciesDef globalFrequencies;
 
 blhDef blh[MAX_RX][MAX_SB][2*MAX_BASELINE];
-pendingScan *scanRoot = NULL;
-pendingScan *headerScan = NULL; /* Points to scan needing header info */
-pendingScan *writableScan = NULL; /* Points to completed scan */
+pendingScan scanPool[SCAN_POOL_SIZE]; /* The scan ring - all pendingScans live here */
+sWARMScan *sWARMFreeList = NULL;      /* Spare SWARM scan storage, see sWARMMutex     */
+sWARMScan *sWARMRing[SWARM_IN_FLIGHT]; /* SWARM scans being collected, see sWARMStoreBlock */
+sWARMScan *sWARMHandoffHead = NULL;   /* SWARM scans waiting for sWARMHandoff, oldest first */
+sWARMScan *sWARMHandoffTail = NULL;
+double sWARMLastUT = -1.0;            /* uT of the last SWARM scan passed on          */
+scanOutput outputRing[OUTPUT_RING_SIZE]; /* Scans on their way from WRITER to MIR_IO */
 crateSetIndex cSIndx[MAX_RX+1][MAX_ANT+1][MAX_ANT+1][MAX_POLARIZATION][2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK + 1];
 baselineIndex bslnIndx[MAX_SIDEBAND*MAX_BASELINE];
 /*
@@ -234,31 +554,48 @@ int chunkSNameInitialized = FALSE;
 
 /*   T H R E A D   S T U F F */
 
-pthread_t headerTId, writerTId, copierTId;
+pthread_t headerTId, writerTId, copierTId, mirIOTId, sWARMStreamTId, sWARMHandoffTId;
+pthread_t pCWorkerTId[MAX_PC_WORKERS];
 
 /*   M U T E X E S   */
 
-pthread_mutex_t scanMutex = PTHREAD_MUTEX_INITIALIZER; /* Protects the linked list of scans */
-pthread_mutex_t needHeaderMutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t writeScanMutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t autoMutex = PTHREAD_MUTEX_INITIALIZER; /* Protects linked list of autocorrelations */
+pthread_mutex_t autoMutex = PTHREAD_MUTEX_INITIALIZER; /* Protects the autocorrelation table being filled */
+/*
+  serverMutex is held by whichever thread is acting as the SERVER thread -
+  the RPC server while it stores a bundle, or SWARM_HANDOFF while it
+  passes a SWARM scan to processBundle.
+  "Only the SERVER thread" in the comments below means the holder of this.
+*/
+pthread_mutex_t serverMutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+  sWARMMutex protects the SWARM scans being collected - sWARMRing, the
+  free list, the handoff queue and sWARMLastUT - and the sWARM pointer of
+  every scan slot.   The threads receiving SWARM data take only this one,
+  so they never wait for processBundle.   A thread which needs both takes
+  serverMutex first.
+*/
+pthread_mutex_t sWARMMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER; /* Protects captureFile */
 
-/*   C O N D I T I O N   V A R I A B L E S   */
+/*   S E M A P H O R E S   */
 
-pthread_cond_t needHeaderCond = PTHREAD_COND_INITIALIZER;
-pthread_cond_t writeScanCond = PTHREAD_COND_INITIALIZER;
+sem_t needHeaderSem; /* Posted when a new scan needs header information */
+sem_t writeScanSem;  /* Posted when a scan becomes complete             */
+sem_t outputFreeSem;  /* Counts scanOutputs the WRITER thread may fill   */
+sem_t outputReadySem; /* Counts scanOutputs waiting for the MIR_IO thread */
+sem_t sWARMHandoffSem; /* Counts SWARM scans waiting for the SWARM_HANDOFF thread */
+sem_t pCStartSem;     /* Posted once per pseudo-continuum helper for each scan */
+sem_t pCDoneSem;      /* Posted by each helper when there's nothing left to sum */
 
 /*   F U N C T I O N   P R O T O T Y P E S   */
 
 extern int getCrateList(int *members);
 extern int getAntennaList(int *members);
-
-/* Prototypes for functions in novas.c */
-void sidereal_time (double jd_high, double jd_low, double ee,
-                    double *gst);
-void earthtilt (double tjd, 
-                double *mobl, double *tobl, double *eq, double *dpsi,
-                double *deps);
+void *sWARMStream(void *arg);
+void *sWARMHandoff(void *arg);
+void sWARMScanDeadlineCheck(void);
+void captureRecord(int type, void *record);
+int replayHeaderFind(headerSnapshot *snap, double uT);
 
 /*-------------------------------------------*/
 /*                                           */
@@ -374,29 +711,195 @@ void flagChunkBad(int block, int chunk)
 }
 
 /*
-  B U N D L E   C O P Y
+  S T A T S   I N I T
 
-  bundleCopy makes a copy of the portions of a bundle we actually need
+  statsInit creates the shared memory segment in which the performance
+  statistics are published (see dataCatcherStats.h).   If that fails,
+  the statistics are still kept, but only in a private structure.
 */
-void bundleCopy(dCrateUVBlock *source, dCrateUVBlock **dest, int interpret,
-		int *hiRes, int *nDaisyChained, int *nInDaisyChain)
+void statsInit(void)
 {
-  int set, hiResCount, hiResPtr, nSets;
+  int fd;
+  void *segment;
+  struct timespec now;
 
-  *hiRes = *nDaisyChained = *nInDaisyChain = 0;
-  (*dest) = (dCrateUVBlock *)malloc(sizeof(*((*dest))));
-  if ((*dest) == NULL) {
-    perror("processScan - first bundle copy malloc");
+  fd = shm_open(DC_STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+  if (fd < 0)
+    perror("statsInit - shm_open");
+  else {
+    if (ftruncate(fd, sizeof(dcStats)) < 0)
+      perror("statsInit - ftruncate");
+    else {
+      segment = mmap(NULL, sizeof(dcStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (segment == MAP_FAILED)
+	perror("statsInit - mmap");
+      else
+	stats = (dcStats *)segment;
+    }
+    close(fd);
+  }
+  if (stats == &localStats)
+    fprintf(stderr, "statsInit: statistics will not be visible outside dataCatcher\n");
+  __atomic_store_n(&(stats->magic), 0, __ATOMIC_SEQ_CST);
+  memset(stats, 0, sizeof(dcStats));
+  clock_gettime(CLOCK_REALTIME, &now);
+  stats->version = DC_STATS_VERSION;
+  stats->pid = getpid();
+  stats->startTime = ((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9;
+  __atomic_store_n(&(stats->magic), DC_STATS_MAGIC, __ATOMIC_SEQ_CST);
+} /* End of statsInit */
+
+/*
+  S T A T S   N O W
+
+  Returns the current time, in seconds, for timing the stages
+  recorded by statsRecord.
+*/
+double statsNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return(((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9);
+} /* End of statsNow */
+
+/*
+  S T A T S   R E C O R D
+
+  statsRecord adds one timing of a processing stage to the statistics.
+*/
+void statsRecord(int stage, double seconds)
+{
+  int bin;
+  unsigned long long nanoseconds, microseconds, oldMax;
+  dcStageStats *entry;
+
+  if (seconds < 0.0)
+    seconds = 0.0;
+  nanoseconds = (unsigned long long)(seconds*1.0e9);
+  microseconds = nanoseconds/1000;
+  if (microseconds == 0)
+    bin = 0;
+  else {
+    bin = 64 - __builtin_clzll(microseconds);
+    if (bin >= DC_HISTOGRAM_BINS)
+      bin = DC_HISTOGRAM_BINS-1;
+  }
+  entry = &(stats->stage[stage]);
+  __atomic_fetch_add(&(entry->count), 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(entry->sumNanoseconds), nanoseconds, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&(entry->histogram[bin]), 1, __ATOMIC_RELAXED);
+  oldMax = __atomic_load_n(&(entry->maxNanoseconds), __ATOMIC_RELAXED);
+  while ((nanoseconds > oldMax) &&
+	 !__atomic_compare_exchange_n(&(entry->maxNanoseconds), &oldMax, nanoseconds,
+				      FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+} /* End of statsRecord */
+
+/*
+  S T A T S   C O U N T
+
+  statsCount adds n to one of the event counters.
+*/
+void statsCount(int counter, unsigned long long n)
+{
+  __atomic_fetch_add(&(stats->counter[counter]), n, __ATOMIC_RELAXED);
+} /* End of statsCount */
+
+/*
+  A R E N A   A L L O C
+
+  arenaAlloc returns nBytes of storage from a scan arena.
+*/
+void *arenaAlloc(scanArena *arena, size_t nBytes)
+{
+  arenaOverflow *overflow;
+
+  nBytes = SLAB_ROUND(nBytes);
+  arena->demand += nBytes;
+  if ((arena->used + nBytes) <= arena->size) {
+    void *piece;
+
+    piece = (void *)(arena->base + arena->used);
+    arena->used += nBytes;
+    return(piece);
+  }
+  overflow = (arenaOverflow *)malloc(SLAB_ROUND(sizeof(arenaOverflow)) + nBytes);
+  if (overflow == NULL) {
+    perror("arenaAlloc - overflow malloc");
     exit(ERROR);
   }
-  (*dest)->crateNumber = source->crateNumber;
-  (*dest)->blockNumber = source->blockNumber;
-  (*dest)->scanType    = source->scanType;
-  (*dest)->scanNumber  = source->scanNumber;
-  (*dest)->UTCtime     = source->UTCtime;
-  (*dest)->intTime     = source->intTime;
-  (*dest)->set.set_len = source->set.set_len;
-  strcpy((*dest)->sourceName, source->sourceName);
+  overflow->next = arena->overflow;
+  arena->overflow = overflow;
+  return((void *)(((char *)overflow) + SLAB_ROUND(sizeof(arenaOverflow))));
+} /* End of arenaAlloc */
+
+/*
+  A R E N A   R E S E T
+
+  arenaReset releases everything allocated from a scan arena.   If the
+  last scan spilled into overflow blocks, the arena is enlarged so that
+  a scan of that size will fit in it next time.
+*/
+void arenaReset(scanArena *arena)
+{
+  arenaOverflow *overflow;
+
+  while (arena->overflow != NULL) {
+    overflow = arena->overflow;
+    arena->overflow = overflow->next;
+    free(overflow);
+  }
+  if (arena->demand > arena->size) {
+    dprintf("arenaReset: growing arena from %d to %d bytes\n",
+	    (int)arena->size, (int)arena->demand);
+    if (arena->base != NULL)
+      free(arena->base);
+    arena->size = arena->demand;
+    arena->base = (char *)malloc(arena->size);
+    if (arena->base == NULL) {
+      perror("arenaReset - arena malloc");
+      exit(ERROR);
+    }
+  }
+  arena->used = arena->demand = 0;
+} /* End of arenaReset */
+
+/*
+  S L A B   C A R V E
+
+  slabCarve hands out the next piece of a slab obtained by bundleCopy.
+  Every piece is rounded up to SLAB_ALIGN bytes so that the structures
+  which follow it stay properly aligned.
+*/
+void *slabCarve(char *slab, size_t *offset, size_t nBytes)
+{
+  void *piece;
+
+  piece = (void *)(slab + *offset);
+  *offset += SLAB_ROUND(nBytes);
+  return(piece);
+} /* End of slabCarve */
+
+/*
+  B U N D L E   C O P Y
+
+  bundleCopy makes a copy of the portions of a bundle we actually need.
+  The copy is built in a single contiguous slab, taken from the scan's
+  arena: the dCrateUVBlock itself comes first, followed by the visibility
+  sets, then the real and imaginary dVarArrays, and finally the spectra.
+  The slab is released when the scan's arena is reset.
+  If copySpectra is FALSE, the spectra are not copied - the copy points
+  at the source's spectra, which must last as long as the scan does.
+*/
+void bundleCopy(scanArena *arena, dCrateUVBlock *source, dCrateUVBlock **dest, int interpret,
+		int copySpectra, int *hiRes, int *nDaisyChained, int *nInDaisyChain)
+{
+  int set, hiResCount, hiResPtr, nSets, len;
+  size_t slabSize, offset;
+  char *slab;
+  dVisibilitySet *sSet, *dSet;
+
+  *hiRes = *nDaisyChained = *nInDaisyChain = 0;
   hiResCount = 1;
   /*
     Since the source name in the bundle of data from the crate actually does not have the
@@ -429,88 +932,100 @@ void bundleCopy(dCrateUVBlock *source, dCrateUVBlock **dest, int interpret,
 	    source->crateNumber);
     printf("Flagging chunk s%02d bad\n", sChunk(source->blockNumber, 2));
     flagChunkBad(source->blockNumber, 2);
-    (*dest)->set.set_len = 2 * source->set.set_len;
-    (*dest)->set.set_val =
-      (dVisibilitySet *)malloc((source->set.set_len * 2) * sizeof(dVisibilitySet));
-  } else
-    (*dest)->set.set_val =
-      (dVisibilitySet *)malloc(source->set.set_len * sizeof(dVisibilitySet));
-  if ((*dest)->set.set_val == NULL) {
-    perror("processScan - second bundle copy malloc");
-    exit(ERROR);
   }
 
-  hiResPtr = 0;
+  /*
+    First pass - figure out how big the slab must be.
+  */
   nSets = source->set.set_len;
+  slabSize = SLAB_ROUND(sizeof(dCrateUVBlock)) +
+    SLAB_ROUND(hiResCount * nSets * sizeof(dVisibilitySet));
+  for (set = 0; set < nSets; set++) {
+    sSet = &(source->set.set_val[set]);
+    slabSize += hiResCount * SLAB_ROUND(sSet->real.real_len * sizeof(dVarArray));
+    slabSize += hiResCount * SLAB_ROUND(sSet->imag.imag_len * sizeof(dVarArray));
+    if (!copySpectra)
+      continue;
+    for (len = 0; len < sSet->real.real_len; len++)
+      slabSize += hiResCount * SLAB_ROUND(sSet->real.real_val[len].channel.channel_len * sizeof(float));
+    for (len = 0; len < sSet->imag.imag_len; len++)
+      slabSize += hiResCount * SLAB_ROUND(sSet->imag.imag_val[len].channel.channel_len * sizeof(float));
+  }
+  slab = (char *)arenaAlloc(arena, slabSize);
+
+  /*
+    Second pass - carve the slab up and copy the data in.
+  */
+  offset = 0;
+  (*dest) = (dCrateUVBlock *)slabCarve(slab, &offset, sizeof(dCrateUVBlock));
+  (*dest)->crateNumber = source->crateNumber;
+  (*dest)->blockNumber = source->blockNumber;
+  (*dest)->scanType    = source->scanType;
+  (*dest)->scanNumber  = source->scanNumber;
+  (*dest)->UTCtime     = source->UTCtime;
+  (*dest)->intTime     = source->intTime;
+  (*dest)->set.set_len = hiResCount * nSets;
+  strcpy((*dest)->sourceName, source->sourceName);
+  (*dest)->set.set_val =
+    (dVisibilitySet *)slabCarve(slab, &offset, hiResCount * nSets * sizeof(dVisibilitySet));
+
+  hiResPtr = 0;
   do {
     for (set = 0; set < nSets; set++) {
-      int ii, len;
+      int ii;
       
-      (*dest)->set.set_val[hiResPtr*nSets + set].chunkNumber = 
-	source->set.set_val[set].chunkNumber + hiResPtr;
+      sSet = &(source->set.set_val[set]);
+      dSet = &((*dest)->set.set_val[hiResPtr*nSets + set]);
+      dSet->chunkNumber = sSet->chunkNumber + hiResPtr;
       for (ii = 0; ii < 3; ii++) {
-	(*dest)->set.set_val[hiResPtr*nSets + set].antennaNumber[ii] =
-	  source->set.set_val[set].antennaNumber[ii];
-	(*dest)->set.set_val[hiResPtr*nSets + set].antPolState[ii] =
-	  source->set.set_val[set].antPolState[ii];
+	dSet->antennaNumber[ii] = sSet->antennaNumber[ii];
+	dSet->antPolState[ii] = sSet->antPolState[ii];
 	if (*hiRes && interpret && (ii == 1))
 	  dprintf("hiResPtr %d, set %d\t(*dest)->set.set_val[%d].chunkNumber = %d\n",
-		  hiResPtr, set, hiResPtr*nSets,
-		  (*dest)->set.set_val[hiResPtr*nSets + set].chunkNumber);
+		  hiResPtr, set, hiResPtr*nSets, dSet->chunkNumber);
 	if (*hiRes && interpret && (ii != 0))
 	  dprintf("hiResPtr %d, set %d\t(*dest)->set.set_val[%d].antennaNumber[%d] = %d\n",
-		  hiResPtr, set, hiResPtr*nSets, ii,
-		  (*dest)->set.set_val[hiResPtr*nSets + set].antennaNumber[ii]);
+		  hiResPtr, set, hiResPtr*nSets, ii, dSet->antennaNumber[ii]);
       }
-      (*dest)->set.set_val[hiResPtr*nSets + set].rxBoardHalf = source->set.set_val[set].rxBoardHalf;
+      dSet->rxBoardHalf = sSet->rxBoardHalf;
       /*   R E A L    P A R T   */
-      (*dest)->set.set_val[hiResPtr*nSets + set].real.real_len = source->set.set_val[set].real.real_len;
-      (*dest)->set.set_val[hiResPtr*nSets + set].real.real_val =
-	(dVarArray *)malloc(source->set.set_val[set].real.real_len * sizeof(dVarArray));
-      if ((*dest)->set.set_val[hiResPtr*nSets + set].real.real_val == NULL) {
-	perror("processScan - third bundle copy malloc");
-	exit(ERROR);
-      }
+      dSet->real.real_len = sSet->real.real_len;
+      dSet->real.real_val =
+	(dVarArray *)slabCarve(slab, &offset, sSet->real.real_len * sizeof(dVarArray));
       /* real_len = number of sidebands (usually 2) */
-      for (len = 0; len < source->set.set_val[set].real.real_len; len++) {
-	(*dest)->set.set_val[hiResPtr*nSets + set].real.real_val[len].channel.channel_len =
-	  source->set.set_val[set].real.real_val[len].channel.channel_len;
+      for (len = 0; len < sSet->real.real_len; len++) {
+	dSet->real.real_val[len].channel.channel_len = sSet->real.real_val[len].channel.channel_len;
 	if (*hiRes && interpret)
-	  dprintf("Chunk size: %d\n", source->set.set_val[set].real.real_val[len].channel.channel_len);
-	(*dest)->set.set_val[hiResPtr*nSets + set].real.real_val[len].channel.channel_val =
-	  (float *)malloc(source->set.set_val[set].real.real_val[len].channel.channel_len * sizeof(float));
-	if ((*dest)->set.set_val[hiResPtr*nSets + set].real.real_val[len].channel.channel_val == NULL) {
-	  perror("processScan - fourth bundle copy malloc");
-	  exit(ERROR);
+	  dprintf("Chunk size: %d\n", sSet->real.real_val[len].channel.channel_len);
+	if (!copySpectra) {
+	  dSet->real.real_val[len].channel.channel_val = sSet->real.real_val[len].channel.channel_val;
+	  continue;
 	}
+	dSet->real.real_val[len].channel.channel_val =
+	  (float *)slabCarve(slab, &offset, sSet->real.real_val[len].channel.channel_len * sizeof(float));
 	/* channel_len = number of points in spectrum */
-	bcopy((char *)source->set.set_val[set].real.real_val[len].channel.channel_val,
-	      (char *)(*dest)->set.set_val[hiResPtr*nSets + set].real.real_val[len].channel.channel_val,
-	      source->set.set_val[set].real.real_val[len].channel.channel_len * sizeof(float));
+	bcopy((char *)sSet->real.real_val[len].channel.channel_val,
+	      (char *)dSet->real.real_val[len].channel.channel_val,
+	      sSet->real.real_val[len].channel.channel_len * sizeof(float));
       }
       
       /*   I M A G I N A R Y    P A R T   */
-      (*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_len = source->set.set_val[set].imag.imag_len;
-      (*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val =
-	(dVarArray *)malloc(source->set.set_val[set].imag.imag_len * sizeof(dVarArray));
-      if ((*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val == NULL) {
-	perror("processScan - fifth bundle copy malloc");
-	exit(ERROR);
-      }
+      dSet->imag.imag_len = sSet->imag.imag_len;
+      dSet->imag.imag_val =
+	(dVarArray *)slabCarve(slab, &offset, sSet->imag.imag_len * sizeof(dVarArray));
       /* imag_len = number of sidebands (usually 2) */
-      for (len = 0; len < source->set.set_val[set].imag.imag_len; len++) {
-	(*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val[len].channel.channel_len =
-	  source->set.set_val[set].imag.imag_val[len].channel.channel_len;
-	(*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val[len].channel.channel_val =
-	  (float *)malloc(source->set.set_val[set].imag.imag_val[len].channel.channel_len * sizeof(float));
-	if ((*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val[len].channel.channel_val == NULL) {
-	  perror("processScan - sixth bundle copy malloc");
-	  exit(ERROR);
+      for (len = 0; len < sSet->imag.imag_len; len++) {
+	dSet->imag.imag_val[len].channel.channel_len = sSet->imag.imag_val[len].channel.channel_len;
+	if (!copySpectra) {
+	  dSet->imag.imag_val[len].channel.channel_val = sSet->imag.imag_val[len].channel.channel_val;
+	  continue;
 	}
+	dSet->imag.imag_val[len].channel.channel_val =
+	  (float *)slabCarve(slab, &offset, sSet->imag.imag_val[len].channel.channel_len * sizeof(float));
 	/* channel_len = number of points in spectrum */
-	bcopy((char *)source->set.set_val[set].imag.imag_val[len].channel.channel_val,
-	      (char *)(*dest)->set.set_val[hiResPtr*nSets + set].imag.imag_val[len].channel.channel_val,
-	    source->set.set_val[set].imag.imag_val[len].channel.channel_len * sizeof(float));
+	bcopy((char *)sSet->imag.imag_val[len].channel.channel_val,
+	      (char *)dSet->imag.imag_val[len].channel.channel_val,
+	      sSet->imag.imag_val[len].channel.channel_len * sizeof(float));
       }
     }
     hiResPtr++;
@@ -519,119 +1034,225 @@ void bundleCopy(dCrateUVBlock *source, dCrateUVBlock **dest, int interpret,
 
 /*
 
-  D E L E T E  S C A N
+  S C A N   S T A T E
+
+  scanState returns the current state word of a scan slot.
+*/
+unsigned int scanState(pendingScan *scan)
+{
+  return(__atomic_load_n(&(scan->state), __ATOMIC_SEQ_CST));
+} /* End of scanState */
+
+/*
+
+  S C A N   T R A N S I T I O N
+
+  scanTransition moves a scan slot to newState, but only if its state
+  word still equals word.   It returns TRUE if the transition was made.
+  This is the only way a slot's state is changed (other than when the
+  SERVER thread claims a free slot), so the SERVER, HEADER and WRITER
+  threads can share the scan ring without any locks.
+*/
+int scanTransition(pendingScan *scan, unsigned int word, int newState)
+{
+  return(__atomic_compare_exchange_n(&(scan->state), &word,
+				     SCAN_WORD(SCAN_GENERATION(word), newState),
+				     FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+} /* End of scanTransition */
+
+/*
+
+  S C A N   I S   L I V E
 
-  deleteScan removes a scan from the scan list, and frees up
-  its resources (malloc'd memory).
+  Returns TRUE if a scan slot holds a scan which has not yet been
+  picked up by the WRITER thread.
 */
-void deleteScan(pendingScan *victim, int pointer)
+int scanIsLive(unsigned int word)
+{
+  return((SCAN_STATE(word) == SCAN_RECEIVING) ||
+	 (SCAN_STATE(word) == SCAN_NEEDS_HEADER) ||
+	 (SCAN_STATE(word) == SCAN_COMPLETE));
+} /* End of scanIsLive */
+
+/*
+
+  R E L E A S E   S C A N
+
+  releaseScan discards all the bundle data cached for a scan, in one
+  reset of the slot's arena, and returns the slot to the scan ring.
+  Any SWARM spectra stay with the slot until the SERVER thread takes
+  them back in sWARMScanClaim.
+  It is called by the WRITER thread, which owns the slot while it is
+  in the WRITING state.
+*/
+void releaseScan(pendingScan *victim)
 {
   int i;
-  struct timespec now;
 
-  clock_gettime(CLOCK_REALTIME, &now);
-  if (pointer) {
-    if (victim->last != NULL)
-      ((pendingScan *)victim->last)->next = victim->next;
-    else
-      scanRoot = (pendingScan *)victim->next;
-    if (victim->next != NULL)
-      ((pendingScan *)victim->next)->last = victim->last;
-  }
+  arenaReset(&(victim->arena));
   for (i = 0; i <= MAX_CRATE; i++)
-    if (victim->data[i] != NULL) {
-      int set;
-
-      for (set = 0; set < victim->data[i]->set.set_len; set++) {
-	int len;
-
-	for (len = 0; len < victim->data[i]->set.set_val[set].real.real_len; len++)
-	  free(victim->data[i]->set.set_val[set].real.real_val[len].channel.channel_val);
-	for (len = 0; len < victim->data[i]->set.set_val[set].imag.imag_len; len++)
-	  free(victim->data[i]->set.set_val[set].imag.imag_val[len].channel.channel_val);
-	free(victim->data[i]->set.set_val[set].real.real_val);
-	free(victim->data[i]->set.set_val[set].imag.imag_val);
-      }
-      free(victim->data[i]->set.set_val);
-      free(victim->data[i]);
+    victim->data[i] = NULL;
+  scanTransition(victim, scanState(victim), SCAN_FREE);
+} /* End of releaseScan */
+
+/*
+
+  A B A N D O N   S C A N
+
+  abandonScan drops a scan which has not yet been completed.   If the
+  HEADER thread is done with the slot, it is freed immediately, otherwise
+  the HEADER thread will free it when it lets go of it.
+  Only the SERVER thread calls this function.
+*/
+void abandonScan(pendingScan *victim, unsigned int word)
+{
+  if (!scanTransition(victim, word, SCAN_ABANDONED))
+    return; /* It was completed in the meantime */
+  statsCount(COUNT_SCANS_ABANDONED, 1);
+  if (__atomic_load_n(&(victim->gotHeaderInfo), __ATOMIC_SEQ_CST))
+    scanTransition(victim, SCAN_WORD(SCAN_GENERATION(word), SCAN_ABANDONED), SCAN_FREE);
+} /* End of abandonScan */
+
+/*
+  S W A R M  S C A N  C L A I M
+
+  sWARMScanClaim returns an sWARMScan, with no chunks received, in which
+  to collect the next SWARM scan.   Once the scan is complete it is handed
+  to processBundle, and its spectra become part of a scan slot.
+  The storage is taken back here, when that slot has been freed, so the
+  chunks are only malloc'd for the first few scans.   The caller must
+  hold sWARMMutex, which every change to a slot's sWARM pointer is made
+  under, so a slot being reused by makeScan can't give its storage back
+  twice.
+*/
+sWARMScan *sWARMScanClaim(void)
+{
+  int slot, ant1, ant2, chunk;
+  sWARMScan *scan;
+
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++)
+    if ((scanPool[slot].sWARM != NULL) &&
+	(SCAN_STATE(scanState(&scanPool[slot])) == SCAN_FREE)) {
+      scanPool[slot].sWARM->next = sWARMFreeList;
+      sWARMFreeList = scanPool[slot].sWARM;
+      scanPool[slot].sWARM = NULL;
+    }
+  if (sWARMFreeList != NULL) {
+    scan = sWARMFreeList;
+    sWARMFreeList = scan->next;
+  } else {
+    scan = (sWARMScan *)malloc(sizeof(sWARMScan));
+    if (scan == NULL) {
+      perror("Malloc failed for SWARM scan\n");
+      exit(ERROR);
     }
-  if (pointer)
-    free(victim);
-} /* End of deleteScan */
+    for (ant1 = 1; ant1 < 8; ant1++)
+      for (ant2 = ant1+1; ant2 <= 8; ant2++)
+	for (chunk = 0; chunk < 2; chunk++) {
+	  if (antennaInArray[ant1] && antennaInArray[ant2]) {
+	    scan->data[ant1][ant2][chunk] = (sWARMChunk *)malloc(sizeof(sWARMChunk));
+	    if (scan->data[ant1][ant2][chunk] == NULL) {
+	      perror("Malloc failed for SWARM chunk\n");
+	      exit(ERROR);
+	    }
+	  } else
+	    scan->data[ant1][ant2][chunk] = NULL;
+	}
+  }
+  scan->expected = scan->received = scan->missing = 0;
+  scan->outstanding = 0;
+  for (ant1 = 1; ant1 < 8; ant1++)
+    for (ant2 = ant1+1; ant2 <= 8; ant2++)
+      for (chunk = 0; chunk < 2; chunk++)
+	if (scan->data[ant1][ant2][chunk]) {
+	  scan->expected |= SWARM_CHUNK_BIT(ant1, ant2, chunk);
+	  scan->outstanding++;
+	}
+  scan->uT = -1.0;
+  scan->duration = 0.0;
+  scan->deadline = 0.0;
+  scan->next = NULL;
+  return(scan);
+} /* End of sWARMScanClaim */
 
 /*
+  S W A R M  S C A N  R E L E A S E
 
-  M A K E   S C A N
+  Puts an sWARMScan which was not handed over to a scan slot back on
+  the free list.   The caller must hold sWARMMutex.
+*/
+void sWARMScanRelease(sWARMScan *scan)
+{
+  scan->next = sWARMFreeList;
+  sWARMFreeList = scan;
+} /* End of sWARMScanRelease */
+
+/*
+  S W A R M  C H U N K  M I S S I N G
+
+  Returns TRUE if the spectra of chunk chunkNumber (counting from 1, as
+  in a dVisibilitySet) on baseline ant1-ant2 of crate's bundle are SWARM
+  data which never arrived, and were zero-filled by sWARMScanQueue.
+*/
+int sWARMChunkMissing(pendingScan *scan, int crate, int ant1, int ant2, int chunkNumber)
+{
+  if ((crate != SWARM_CRATE) || (scan->sWARM == NULL) ||
+      (ant1 < 1) || (ant1 >= ant2) || (ant2 > 8) || (chunkNumber < 1) || (chunkNumber > 2))
+    return(FALSE);
+  return((scan->sWARM->missing & SWARM_CHUNK_BIT(ant1, ant2, chunkNumber-1)) != 0);
+} /* End of sWARMChunkMissing */
 
-  makeScan creates a new scan list entry, initializes it,
-  trims the scan list if there are too many pending scans,
-  and inserts the new scan into the queue.
+/*
+
+  M A K E   S C A N
 
-  The scanMutex must be acquired before this function is called.
+  makeScan trims the scan ring if there are too many pending scans,
+  claims a free slot, initializes it, and signals the HEADER thread
+  that the new scan needs header information.
+  Only the SERVER thread calls this function, so it is the only thread
+  which ever moves a slot out of the FREE state.
 */
 
-void makeScan(pendingScan **newEntry, dCrateUVBlock *bundle)
+int makeScan(pendingScan **newEntry, dCrateUVBlock *bundle)
 {
-  int i, scanCount;
+  int i, slot, scanCount;
+  unsigned int word, oldestWord;
   double oldestScanTime;
   struct timespec birthTime;
-  pendingScan *pointer, *lastScan;
   pendingScan *oldestScan = NULL;
 
   clock_gettime(CLOCK_REALTIME, &birthTime);
-  /* Make new entry */
-  *newEntry = (pendingScan *)malloc(sizeof(**newEntry));
-  if (*newEntry == NULL) {
-    fprintf(stderr, "makeScan: malloc failure for newEntry - will abort\n");
-    perror("makeScan, newEntry");
-    exit(ERROR);
-  }
-  
-  /* Initialize new entry */
-  dprintf("makeScan:\tInitializing the new entry\n");
-  (*newEntry)->firstTime = bundle->UTCtime;
-  (*newEntry)->birthTime = ((double)birthTime.tv_sec) + ((birthTime.tv_nsec))*1.0e-9;
-  (*newEntry)->number = globalScanNumber;
-  (*newEntry)->intTime = bundle->intTime;
-  for (i = 0; i <= MAX_CRATE; i++) {
-    if (activeCrates[i])
-      (*newEntry)->expected[i] = TRUE;
-    else
-      (*newEntry)->expected[i] = FALSE;
-    (*newEntry)->received[i] = FALSE;
-    (*newEntry)->data[i] = NULL;
-  }
-  (*newEntry)->gotHeaderInfo = FALSE;
-  (*newEntry)->next = NULL; /* We'll put it at the end of the list */
 
   /*
     Let's count the number of pending scans, note the oldest,
     and delete it if too many scans are pending.
   */
-  scanCount = 0;
-  pointer = scanRoot;
   /*
     Delete any really old pending scans
   */
-  while (pointer != NULL) {
-    if ((globalScanNumber - pointer->number) > 10) {
-      printf("Dropping ancient scan %d\n", pointer->number);
-      deleteScan(pointer, TRUE);
-      pointer = NULL;
-    } else
-      pointer = (pendingScan *)pointer->next;
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++) {
+    word = scanState(&scanPool[slot]);
+    if (((SCAN_STATE(word) == SCAN_RECEIVING) || (SCAN_STATE(word) == SCAN_NEEDS_HEADER)) &&
+	((globalScanNumber - scanPool[slot].number) > 10)) {
+      printf("Dropping ancient scan %d\n", scanPool[slot].number);
+      abandonScan(&scanPool[slot], word);
+    }
   }
-  pointer = scanRoot;
+  scanCount = 0;
   oldestScanTime = 1.0e30;
-  while (pointer != NULL) {
-    scanCount++;
-    if (pointer->firstTime < oldestScanTime) {
-      oldestScan = pointer;
-      oldestScanTime = pointer->firstTime;
+  oldestWord = 0;
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++) {
+    word = scanState(&scanPool[slot]);
+    if (scanIsLive(word)) {
+      scanCount++;
+      if ((SCAN_STATE(word) != SCAN_COMPLETE) && (scanPool[slot].firstTime < oldestScanTime)) {
+	oldestScan = &scanPool[slot];
+	oldestScanTime = scanPool[slot].firstTime;
+	oldestWord = word;
+      }
     }
-    pointer = (pendingScan *)pointer->next;
   }
-  if (scanCount >= MAX_PENDING_SCANS) {
+  if ((scanCount >= MAX_PENDING_SCANS) && (oldestScan != NULL)) {
     fprintf(stderr, "makeScan: Too many pending scans (%d), will drop oldest\n",
 	    MAX_PENDING_SCANS);
     fprintf(stderr, "\tOldest time: %f\n", oldestScanTime);
@@ -645,76 +1266,100 @@ void makeScan(pendingScan **newEntry, dCrateUVBlock *bundle)
       if (oldestScan->received[i])
 	fprintf(stderr, "%2d ", i);
     fprintf(stderr, "\n");
-    deleteScan(oldestScan, TRUE);
+    abandonScan(oldestScan, oldestWord);
     if (abortOnMinorErrors)
       if (globalScanNumber > 100)
 	exit(-1);
   }
 
-  /* Now insert the new entry into the doubly linked list */
-  pointer = lastScan = scanRoot;
-  while (pointer != NULL) {
-    lastScan = pointer;
-    pointer = (pendingScan *)pointer->next;
-  }
-  if (lastScan == NULL) {
-    dprintf("Inserting new scan with time %f at list root\n",
-	    (*newEntry)->firstTime);
-    scanRoot = *newEntry;
-    (*newEntry)->last = NULL;
-  } else {
-    dprintf("Inserting new scan with time %f at list end.  %d scans now pending\n",
-	    (*newEntry)->firstTime, scanCount+1);
-    lastScan->next = (char *)*newEntry;
-    (*newEntry)->last = (char *)lastScan;
+  /* Claim a free slot */
+  *newEntry = NULL;
+  for (slot = 0; (slot < SCAN_POOL_SIZE) && (*newEntry == NULL); slot++)
+    if (SCAN_STATE(scanState(&scanPool[slot])) == SCAN_FREE)
+      *newEntry = &scanPool[slot];
+  if (*newEntry == NULL) {
+    fprintf(stderr, "makeScan: no free slot in the scan ring - bundle discarded\n");
+    return(NO_FREE_SCAN_SLOT);
   }
-  /*
-    Now signal the HEADER thread that we need a header for this new scan
-  */
-  pthread_mutex_unlock(&scanMutex);
-  pthread_mutex_lock(&needHeaderMutex);
-  needHeader = TRUE;
-  headerScan = *newEntry;
-  pthread_cond_signal(&needHeaderCond);
-  pthread_mutex_unlock(&needHeaderMutex);
-} /* End of makeScan */
-
-/*
 
-   S C A N   C O M P L E T E   C H E C K
+  /* Initialize new entry */
+  dprintf("makeScan:\tInitializing the new entry\n");
+  arenaReset(&((*newEntry)->arena));
+  pthread_mutex_lock(&sWARMMutex);
+  if ((*newEntry)->sWARM != NULL) {
+    sWARMScanRelease((*newEntry)->sWARM);
+    (*newEntry)->sWARM = NULL;
+  }
+  pthread_mutex_unlock(&sWARMMutex);
+  (*newEntry)->firstTime = bundle->UTCtime;
+  (*newEntry)->birthTime = ((double)birthTime.tv_sec) + ((birthTime.tv_nsec))*1.0e-9;
+  (*newEntry)->number = globalScanNumber;
+  (*newEntry)->intTime = bundle->intTime;
+  for (i = 0; i <= MAX_CRATE; i++) {
+    if (activeCrates[i])
+      (*newEntry)->expected[i] = TRUE;
+    else
+      (*newEntry)->expected[i] = FALSE;
+    (*newEntry)->received[i] = FALSE;
+    (*newEntry)->data[i] = NULL;
+  }
+  __atomic_store_n(&((*newEntry)->gotHeaderInfo), FALSE, __ATOMIC_SEQ_CST);
+  word = scanState(*newEntry);
+  __atomic_store_n(&((*newEntry)->state), SCAN_WORD(SCAN_GENERATION(word)+1, SCAN_RECEIVING),
+		   __ATOMIC_SEQ_CST);
+  dprintf("Claimed slot for new scan with time %f.  %d scans now pending\n",
+	  (*newEntry)->firstTime, scanCount+1);
+
+  /*
+    Now signal the HEADER thread that we need a header for this new scan
+  */
+  sem_post(&needHeaderSem);
+  return(OK);
+} /* End of makeScan */
+
+/*
+
+   S C A N   C O M P L E T E   C H E C K
 
    This function checks to see if the scan it has been passed is
    complete, meaning that it contains all the required visibility
-   bundles, and the header information.
+   bundles, and the header information.   It is called by the SERVER
+   thread after each bundle is stored, and by the HEADER thread after
+   the header information has been stored.   The two threads may race
+   here, but only one of them can win the final transition to COMPLETE.
 */
-void scanCompleteCheck(pendingScan *current)
+void scanCompleteCheck(pendingScan *current, unsigned int word)
 {
   int i, missingScan;
 
-  missingScan = FALSE;
-  missingCrate = 0;
-  for (i = 1; (i <= MAX_CRATE) && (!missingScan); i++) {
-    dprintf("\tSCC: %d expected %d received %d missing %d\n", i, current->expected[i], current->received[i], missingScan);
-    if (current->expected[i] && (!current->received[i])) {
-      missingScan = TRUE;
-      missingCrate = i;
+  if (SCAN_STATE(word) == SCAN_RECEIVING) {
+    missingScan = FALSE;
+    missingCrate = 0;
+    for (i = 1; (i <= MAX_CRATE) && (!missingScan); i++) {
+      dprintf("\tSCC: %d expected %d received %d missing %d\n", i, current->expected[i], current->received[i], missingScan);
+      if (current->expected[i] && (!current->received[i])) {
+	missingScan = TRUE;
+	missingCrate = i;
+      }
     }
+    printf("missingScan = %d, crate = %d, gotHeader = %d\n", missingScan, missingCrate, current->gotHeaderInfo);
+    if (missingScan || !scanTransition(current, word, SCAN_NEEDS_HEADER))
+      return;
+    word = SCAN_WORD(SCAN_GENERATION(word), SCAN_NEEDS_HEADER);
   }
-  printf("missingScan = %d, crate = %d, gotHeader = %d\n", missingScan, missingCrate, current->gotHeaderInfo);
 
   /*
     If there are no missing scans, and the header info
     is present, then signal the WRITER
     thread that there is a scan waiting for processing
   */
-  dprintf("In scanCompleteCheck, missing = %d, gotHeader = %d\n", missingScan, current->gotHeaderInfo);
-  if ((!missingScan) && current->gotHeaderInfo) {
-    pthread_mutex_lock(&writeScanMutex);
-    needWrite = TRUE;
-    writableScan = current;
-    pthread_cond_signal(&writeScanCond);
-    pthread_mutex_unlock(&writeScanMutex);
-  }
+  dprintf("In scanCompleteCheck, state = %d, gotHeader = %d\n", SCAN_STATE(word), current->gotHeaderInfo);
+  if ((SCAN_STATE(word) == SCAN_NEEDS_HEADER) &&
+      __atomic_load_n(&(current->gotHeaderInfo), __ATOMIC_SEQ_CST))
+    if (scanTransition(current, word, SCAN_COMPLETE)) {
+      statsRecord(STAGE_SCAN_COMPLETION, statsNow()-current->birthTime);
+      sem_post(&writeScanSem);
+    }
 } /* End of scanCompleteCheck */
 
 /*
@@ -746,110 +1391,111 @@ void printBundleInfo(dCrateUVBlock *bundle)
 
   P R O C E S S   B U N D L E
 
-  processBundle is the main function for the SERVER thread
+  processBundle is the main function for the SERVER thread.
+  If sWARM is not NULL, the bundle's spectra live in that sWARMScan,
+  and are used in place rather than copied.   The scan slot takes the
+  sWARMScan over if (and only if) OK is returned.
 */
-int  processBundle(dCrateUVBlock *bundle)
+int  processBundle(dCrateUVBlock *bundle, sWARMScan *sWARM)
 {
-  int crate;
+  int crate, slot, rCode;
+  unsigned int word;
+  double oldestBirth, startTime, copyStart;
   pendingScan *current;
 
+  startTime = statsNow();
+  statsCount(COUNT_BUNDLES_RECEIVED, 1);
   getCrateList(&activeCrates[0]);
 
   if (debugMessagesOn)
     printBundleInfo(bundle);
 
   crate = bundle->crateNumber;
-  pthread_mutex_lock(&scanMutex);
-  if (scanRoot == NULL) {
-    makeScan(&current, bundle);
-    pthread_mutex_lock(&scanMutex);
-  } else {
-    int foundMatch = FALSE;
 
-    /*
-      Find out if the midpoint time for this scan matches any
-      of the pending scans.
-    */
-    current = scanRoot;
-    while ((current != NULL) && (!foundMatch)) {
-      if ((fabs(current->firstTime - bundle->UTCtime) > MIDPOINT_SLOP) && (crate != SWARM_CRATE)) {
-	current = (pendingScan *)current->next;
-      } else {
-	/* This bundle belongs in a currently pending scan */
-	if (!(current->expected[crate])) {
-	  fprintf(stderr,
-		  "processBundle: Got a bundle from crate %d, but no scan from\n",
-		  bundle->crateNumber);
-	  fprintf(stderr,
-		  "               that crate was expected - will discard this bundle.\n");
-	  fprintf(stderr,
-		  "               First time = %f, bundle time = %f\n",
-		  current->firstTime, bundle->UTCtime);
-	  pthread_mutex_unlock(&scanMutex);
-	  return(UNEXPECTED_BUNDLE);
-	} else if (current->received[crate]) {
-	  fprintf(stderr,
-		  "processBundle: Got a bundle from crate %d, but the current scan\n",
-		  bundle->crateNumber);
-	  fprintf(stderr,
-		  "               already has a bundle from that crate - will discard\n");
-	  fprintf(stderr,
-		  "               this bundle.   First time = %f, bundle time = %f\n",
-		  current->firstTime, bundle->UTCtime);
-	  pthread_mutex_unlock(&scanMutex);
-	  return(REDUNDANT_BUNDLE);
-	}
-	foundMatch = TRUE;
-      }
+  /*
+    Find out if the midpoint time for this scan matches any
+    of the pending scans.   If more than one matches, take the
+    oldest one.   SWARM scans can overlap, so a SWARM bundle only
+    joins a scan which is still receiving and has no SWARM data yet -
+    otherwise it starts a scan of its own, rather than being thrown
+    away as redundant.
+  */
+  current = NULL;
+  word = 0;
+  oldestBirth = 1.0e30;
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++) {
+    unsigned int slotWord;
+
+    slotWord = scanState(&scanPool[slot]);
+    if (!scanIsLive(slotWord) ||
+	(fabs(scanPool[slot].firstTime - bundle->UTCtime) > MIDPOINT_SLOP))
+      continue;
+    if ((crate == SWARM_CRATE) &&
+	((SCAN_STATE(slotWord) != SCAN_RECEIVING) || scanPool[slot].received[SWARM_CRATE]))
+      continue;
+    if (scanPool[slot].birthTime < oldestBirth) {
+      current = &scanPool[slot];
+      word = slotWord;
+      oldestBirth = scanPool[slot].birthTime;
     }
-    if (!foundMatch) {
-      /*
-	We went through the entire list of scans, but didn't find one with a
-	matching midpoint time.   Must make a new scan.
-      */
-      makeScan(&current, bundle);
-      pthread_mutex_lock(&scanMutex);
+  }
+  if (current != NULL) {
+    /* This bundle belongs in a currently pending scan */
+    if (!(current->expected[crate])) {
+      fprintf(stderr,
+	      "processBundle: Got a bundle from crate %d, but no scan from\n",
+	      bundle->crateNumber);
+      fprintf(stderr,
+	      "               that crate was expected - will discard this bundle.\n");
+      fprintf(stderr,
+	      "               First time = %f, bundle time = %f\n",
+	      current->firstTime, bundle->UTCtime);
+      statsCount(COUNT_UNEXPECTED_BUNDLES, 1);
+      return(UNEXPECTED_BUNDLE);
+    } else if (current->received[crate] || (SCAN_STATE(word) != SCAN_RECEIVING)) {
+      fprintf(stderr,
+	      "processBundle: Got a bundle from crate %d, but the current scan\n",
+	      bundle->crateNumber);
+      fprintf(stderr,
+	      "               already has a bundle from that crate - will discard\n");
+      fprintf(stderr,
+	      "               this bundle.   First time = %f, bundle time = %f\n",
+	      current->firstTime, bundle->UTCtime);
+      statsCount(COUNT_REDUNDANT_BUNDLES, 1);
+      return(REDUNDANT_BUNDLE);
     }
+  } else {
+    /*
+      We went through the entire ring of scans, but didn't find one with a
+      matching midpoint time.   Must make a new scan.
+    */
+    rCode = makeScan(&current, bundle);
+    if (rCode != OK)
+      return(rCode);
+    word = scanState(current);
   }
 
   /*
     At this point "current" should point to a valid scan, which needs the
     current bundle's data. So, copy the data into the proper slot.
+    Only the SERVER thread writes to a slot in the RECEIVING state.
   */
-  current->received[crate] = TRUE;
-  bundleCopy(bundle, &(current->data[crate]), TRUE,
+  copyStart = statsNow();
+  bundleCopy(&(current->arena), bundle, &(current->data[crate]), TRUE, (sWARM == NULL),
 	     &(current->hiRes[crate]), &(current->nDaisyChained[crate]),
 	     &(current->nInDaisyChain[crate]));
-  scanCompleteCheck(current);
-  pthread_mutex_unlock(&scanMutex);
+  if (sWARM != NULL) {
+    pthread_mutex_lock(&sWARMMutex);
+    current->sWARM = sWARM;
+    pthread_mutex_unlock(&sWARMMutex);
+  }
+  statsRecord(STAGE_BUNDLE_COPY, statsNow()-copyStart);
+  current->received[crate] = TRUE;
+  scanCompleteCheck(current, word);
+  statsRecord(STAGE_BUNDLE_RECEIPT, statsNow()-startTime);
   return(OK);
 } /* End of processBundle */
 
-/*
-
-  U T 2 L S T
-
-  uT2LST calculates the LST from the julian day number and
-  the number of seconds past 00:00:00
-*/
-void uT2LST(long julianday, double secs, double *lst)
-{
-  
-  double tjd_upper, tjd_lower, dpsi, deps, tobl, equinoxes;
-  double d1, mobl, gst, lst_radian;
-  
-  tjd_lower = secs/24.0/3600.0;
-  tjd_upper = julianday - 0.5; 
-  
-  earthtilt(tjd_upper, &mobl, &tobl, &equinoxes, &dpsi, &deps);
-  sidereal_time(tjd_upper, tjd_lower, equinoxes, &gst);
-  d1 = gst * TWO_PI / 24.0 + LONGRAD;
-  lst_radian = fmod(d1, TWO_PI);
-  if (lst_radian < 0.0)
-    lst_radian += TWO_PI;
-  *lst = lst_radian;                                                      
-} /* End of uT2LST */
-
 /*
 
   C A L C U L A T E  U V W
@@ -857,49 +1503,37 @@ void uT2LST(long julianday, double secs, double *lst)
   calculateUVW calculates the U, V and W coordinates for a particular
   time, which will typically be the average (over crates) midpoint
   time of the scan.   Also calculate the pad coordinates in the
-  local frame, for use by mir.
+  local frame, for use by mir.   The per antenna values come from
+  uvwAntennas, which caches the slowly varying terms between scans,
+  and each baseline is the difference of its two antennas.
 
   Returns the hour angle at the scan midpoint.
 */
 double calculateUVW(pendingScan *scan, double mPTime, long jD)
 {
   int ant1, ant2;
-  double sHA, cHA, sDec, cDec, sLat, cLat;
-  double hourAngle, lST;
-
-  uT2LST(jD, mPTime * 3600.0, &lST);
-  hourAngle = lST - scan->header.DDSdata.ra;
-  while (hourAngle < -M_PI)
-    hourAngle += TWO_PI;
-  while (hourAngle > M_PI)
-    hourAngle -= TWO_PI;
-  sHA = sin(hourAngle);
-  cHA = cos(hourAngle);
-  sDec = sin(scan->header.DDSdata.dec);
-  cDec = cos(scan->header.DDSdata.dec);
-  sLat = sin(LATRAD);
-  cLat = cos(LATRAD);
-  dprintf("LST = %f, RA = %f, HA = %f\n",
-	  lST, scan->header.DDSdata.ra, hourAngle);
-  for (ant1 = 1; ant1 < MAX_ANT+1; ant1++) {
-    scan->padE[ant1] =  scan->header.DDSdata.y[ant1];
-    scan->padN[ant1] = -sLat*scan->header.DDSdata.x[ant1] + cLat*scan->header.DDSdata.z[ant1];
-    scan->padU[ant1] =  cLat*scan->header.DDSdata.x[ant1] + sLat*scan->header.DDSdata.z[ant1];
-    for (ant2 = 1; ant2 < MAX_ANT+1; ant2++)
-      if (ant2 > ant1) {
-	double X, Y, Z;
-
-	X = scan->header.DDSdata.x[ant1] - scan->header.DDSdata.x[ant2];
-	Y = scan->header.DDSdata.y[ant1] - scan->header.DDSdata.y[ant2];
-	Z = scan->header.DDSdata.z[ant1] - scan->header.DDSdata.z[ant2];
-	scan->u[ant1][ant2] =       sHA*X +      cHA*Y;
-	scan->v[ant1][ant2] = -cHA*sDec*X + sHA*sDec*Y + cDec*Z;
-	scan->w[ant1][ant2] =  cHA*cDec*X - sHA*cDec*Y + sDec*Z;
-	scan->u[ant2][ant1] = scan->u[ant1][ant2];
-	scan->v[ant2][ant1] = scan->v[ant1][ant2];
-	scan->w[ant2][ant1] = scan->w[ant1][ant2];
-      }
+  double hourAngle, secs;
+  double antU[MAX_ANT+1], antV[MAX_ANT+1], antW[MAX_ANT+1];
+  static int geometryInitialized = FALSE;
+  static uvwGeometry geometry;
+
+  if (!geometryInitialized) {
+    uvwGeometryInit(&geometry, LONGRAD, LATRAD);
+    geometryInitialized = TRUE;
   }
+  secs = mPTime * 3600.0;
+  uvwAntennas(&geometry, jD, scan->header.DDSdata.ra, scan->header.DDSdata.dec,
+	      1, &secs, MAX_ANT+1, scan->header.DDSdata.x, scan->header.DDSdata.y,
+	      scan->header.DDSdata.z, &hourAngle, antU, antV, antW);
+  dprintf("RA = %f, HA = %f\n", scan->header.DDSdata.ra, hourAngle);
+  uvwPadENU(&geometry, MAX_ANT+1, scan->header.DDSdata.x, scan->header.DDSdata.y,
+	    scan->header.DDSdata.z, scan->padE, scan->padN, scan->padU);
+  for (ant1 = 1; ant1 < MAX_ANT+1; ant1++)
+    for (ant2 = ant1+1; ant2 < MAX_ANT+1; ant2++) {
+      scan->u[ant1][ant2] = scan->u[ant2][ant1] = antU[ant1] - antU[ant2];
+      scan->v[ant1][ant2] = scan->v[ant2][ant1] = antV[ant1] - antV[ant2];
+      scan->w[ant1][ant2] = scan->w[ant2][ant1] = antW[ant1] - antW[ant2];
+    }
   return(hourAngle);
 } /* End of calculateUVW */
 
@@ -908,13 +1542,43 @@ double calculateUVW(pendingScan *scan, double mPTime, long jD)
   C A L C U L A T E  C H U N K  F R E Q U E N C I E S
 
   calculateChunkFrequencies calculates the center frequency and velocity
-  for each chunk.
+  for each chunk.   The LO setup rarely changes from one scan to the
+  next, so the tables from the previous call are kept, and simply copied
+  into the scan if the setup is the same.   Each new set of tables gets
+  a new generation number, which the writer uses to know when the
+  spectrum header frequencies it has cached are stale.
 
 */
 void calculateChunkFrequencies(pendingScan **scan)
 {
   int rx, sb, block, chunk, chunkIndex, effectiveRx;
   double alpha, beta, vRadial, fRest, vCatalog;
+  frequencySetup setup;
+  static frequencySetup lastSetup;
+  static unsigned int generation = 0;
+  static double chunkFreq[MAX_RX][MAX_SB][(2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK)+1];
+  static double chunkVelo[MAX_RX][MAX_SB][(2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK)+1];
+  static double sWARMFreq[MAX_SB][MAX_SWARM_CHUNK], sWARMVelo[MAX_SB][MAX_SWARM_CHUNK];
+
+  /* memset, so that padding in the structure doesn't spoil the comparison */
+  memset(&setup, 0, sizeof(setup));
+  setup.frequencies = (*scan)->header.loData.frequencies;
+  for (rx = 0; rx < MAX_RX; rx++)
+    setup.restFrequency[rx] = (*scan)->header.loData.restFrequency[rx];
+  setup.vRadial = (*scan)->header.loData.vRadial;
+  setup.vCatalog = (*scan)->header.loData.vCatalog;
+  setup.bDAIFSep = bDAIFSep;
+  setup.sWARMCenterFrequency = sWARMCenterFrequency;
+  setup.doubleBandwidth = doubleBandwidth;
+  setup.doubleBandwidthRx = doubleBandwidthRx;
+  if ((generation != 0) && (memcmp(&setup, &lastSetup, sizeof(setup)) == 0)) {
+    memcpy((*scan)->chunkFreq, chunkFreq, sizeof(chunkFreq));
+    memcpy((*scan)->chunkVelo, chunkVelo, sizeof(chunkVelo));
+    memcpy((*scan)->sWARMFreq, sWARMFreq, sizeof(sWARMFreq));
+    memcpy((*scan)->sWARMVelo, sWARMVelo, sizeof(sWARMVelo));
+    (*scan)->freqGeneration = generation;
+    return;
+  }
 
   vRadial = (*scan)->header.loData.vRadial;
   vCatalog = (*scan)->header.loData.vCatalog;
@@ -1059,6 +1723,15 @@ void calculateChunkFrequencies(pendingScan **scan)
       }
     } /* for (sb ... */
   }
+  memcpy(chunkFreq, (*scan)->chunkFreq, sizeof(chunkFreq));
+  memcpy(chunkVelo, (*scan)->chunkVelo, sizeof(chunkVelo));
+  memcpy(sWARMFreq, (*scan)->sWARMFreq, sizeof(sWARMFreq));
+  memcpy(sWARMVelo, (*scan)->sWARMVelo, sizeof(sWARMVelo));
+  lastSetup = setup;
+  if (++generation == 0)
+    generation = 1;
+  (*scan)->freqGeneration = generation;
+  dprintf("New frequency setup, generation %u\n", generation);
 } /* End of calculateChunkFrequencies */
 
 /*
@@ -1099,7 +1772,7 @@ void makePadList(pendingScan **scan)
   getDSMInfo pulls the data from DSM which needs to be associated with
   a particular scan.
 */
-void getDSMInfo(pendingScan **scan)
+void getDSMInfo(dSMInfo *dSMStuff)
 {
   /* int ds; */
   int i;
@@ -1121,200 +1794,396 @@ void getDSMInfo(pendingScan **scan)
   dprintf("New bDAIFSep value: %f\n", bDAIFSep);
   /*
   ds = dsm_read("hal9000", "DSM_AS_POLAR_MODE_S",
-		(char *)&((*scan)->dSMStuff.polarMode), &timestamp);
+		(char *)&(dSMStuff->polarMode), &timestamp);
   if (ds != DSM_SUCCESS) {
     dsm_error_message(ds, "dsm_read (2)");
     perror("getDSMInfo: dsm read of DSM_AS_POLAR_MODE_S");
   }
   */
-  (*scan)->dSMStuff.polarMode = FALSE;
+  dSMStuff->polarMode = FALSE;
   /*
   ds = dsm_read("hal9000", "DSM_AS_POINTING_MODE_S",
-		(char *)&((*scan)->dSMStuff.pointingMode), &timestamp);
+		(char *)&(dSMStuff->pointingMode), &timestamp);
   if (ds != DSM_SUCCESS) {
     dsm_error_message(ds, "dsm_read (3)");
     perror("getDSMInfo: dsm read of DSM_AS_POINTING_MODE_S");
   }
   */
-  (*scan)->dSMStuff.pointingMode = FALSE;
+  dSMStuff->pointingMode = FALSE;
   /*
   ds = dsm_read("hal9000", "DSM_AS_POLAR_V11_C1",
-		(char *)&((*scan)->dSMStuff.polarStates), &timestamp);
+		(char *)&(dSMStuff->polarStates), &timestamp);
   if (ds != DSM_SUCCESS) {
     dsm_error_message(ds, "dsm_read (4)");
     perror("getDSMInfo: dsm read of DSM_AS_POLAR_V11_C1");
   }
   */
   for (i = 0; i < 11; i++)
-    (*scan)->dSMStuff.polarStates[i] = 0;
+    dSMStuff->polarStates[i] = 0;
 } /* End of getDSMInfo */
 
-/*                                                                                                                                                             H E A D E R                                                                                                                                              
-  This function executes as a separate thread, it waits until a                                                                                              condition variable is signalled.   This signal indicates that                                                                                              the first visibility bundle for a new scan has arrived.   Once                                                                                             signalled, this function gets the header information from                                                                                                  hal9000, and stores it in the scan structure.                                                                                                            */
-void *header(void *arg)
+/*
+
+  H E A D E R   D O N E
+
+  headerDone is called by the HEADER thread when it is finished with a
+  scan slot.   If the slot was abandoned while the header information was
+  being fetched, it is freed here.   If all the bundles are already in,
+  the scan is now complete.   Otherwise the SERVER thread will complete
+  it when the last bundle arrives.
+*/
+void headerDone(pendingScan *scan)
+{
+  unsigned int word;
+
+  __atomic_store_n(&(scan->gotHeaderInfo), TRUE, __ATOMIC_SEQ_CST);
+  word = scanState(scan);
+  if (SCAN_STATE(word) == SCAN_ABANDONED)
+    scanTransition(scan, word, SCAN_FREE);
+  else if (SCAN_STATE(word) == SCAN_NEEDS_HEADER)
+    scanCompleteCheck(scan, word);
+} /* End of headerDone */
+
+/*
+
+  N E X T   S C A N   N E E D I N G   H E A D E R
+
+  Returns the oldest scan in the scan ring which still needs its header
+  information, or NULL if there are none.   Abandoned scans which the
+  HEADER thread had not yet started on are freed along the way.
+*/
+pendingScan *nextScanNeedingHeader(void)
+{
+  int slot;
+  unsigned int slotWord;
+  double oldestBirth = 1.0e30;
+  pendingScan *oldest = NULL;
+
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++) {
+    slotWord = scanState(&scanPool[slot]);
+    if (__atomic_load_n(&(scanPool[slot].gotHeaderInfo), __ATOMIC_SEQ_CST))
+      continue;
+    if (SCAN_STATE(slotWord) == SCAN_ABANDONED)
+      headerDone(&scanPool[slot]);
+    else if (((SCAN_STATE(slotWord) == SCAN_RECEIVING) ||
+	      (SCAN_STATE(slotWord) == SCAN_NEEDS_HEADER)) &&
+	     (scanPool[slot].birthTime < oldestBirth)) {
+      oldest = &scanPool[slot];
+      oldestBirth = scanPool[slot].birthTime;
+    }
+  }
+  return(oldest);
+} /* End of nextScanNeedingHeader */
+
+/*
+
+  H E A D E R   F E T C H
+
+  headerFetch gets the header information for the scan with midpoint
+  time uT from statusServer and DSM, and stores it in a headerSnapshot.
+  It is called ahead of time, when header prefetching is on, and for any
+  scan which arrives with no snapshot ready for it.
+*/
+void headerFetch(headerSnapshot *snap, double uT, double intTime)
 {
-  int rCode, i, mirOK;
+  int i, mirOK;
   requestCodes statusRequest;
   info *mirInfo = NULL;
-  int nTimes = 0;
-  double startTimeDouble, stopTimeDouble, thisTime;
-  double timeSum = 0.0;
-  double maxTime = -1.0e30;
-  double minTime = 1.0e30;
-  struct timespec startTime, stopTime;
   static int statusServerConnectionOK = FALSE;
   /* static CLIENT *statusServerCl, *setLOCl = NULL; */
-  void *returnValue = NULL;
 
-  printf("Thread HEADER starting\n");
-  while (TRUE) {
-    pthread_mutex_lock(&needHeaderMutex);
-    while (!needHeader) {
-      dprintf("header thread sleeping, awaiting a signal\n");
-      rCode = pthread_cond_wait(&needHeaderCond, &needHeaderMutex);
-      if (rCode) {
-        fprintf(stderr,
-                "header: Error %d returned by pthread_cond_wait\n",
-                rCode);
-        perror("pthread_cond_wait");
-      }
-    }
-    printf("header thread re-awakened\n");
-    clock_gettime(CLOCK_REALTIME, &startTime);
-    startTimeDouble = ((double)startTime.tv_sec) + ((double)startTime.tv_nsec)*1.0e-9;
-    /*                                                                                                                                                            Get the data from statusServer                                                                                                                          */
-    mirOK = FALSE;
-    i = 0;
-    do {
-      /* int dSMStatus; */
-      /* static int badSetLOCall = FALSE; */
-      /* time_t timeStamp; */
-      char checkSourceName[35];
-      /* struct timeval timeout; */
+  dprintf("headerFetch:\tfetching header for UT %f\n", uT);
+  if (replaying && replayHeaderFind(snap, uT)) {
+    snap->uT = uT;
+    snap->intTime = intTime;
+    snap->fetchTime = statsNow();
+    snap->valid = TRUE;
+    return;
+  }
+  mirOK = FALSE;
+  i = 0;
+  do {
+    /* int dSMStatus; */
+    /* static int badSetLOCall = FALSE; */
+    /* time_t timeStamp; */
+    char checkSourceName[35];
+    /* struct timeval timeout; */
 
-      /*
-      if ((setLOCl == NULL) || badSetLOCall)
-	setLOCl = clnt_create("hal9000", SETLOPROG, SETLOVERS, "tcp");
-      */
-      if (TRUE) {
-	/* genericRequest request; */
-	skyFrequencyInfo *info;
+    /*
+    if ((setLOCl == NULL) || badSetLOCall)
+      setLOCl = clnt_create("hal9000", SETLOPROG, SETLOVERS, "tcp");
+    */
+    if (TRUE) {
+      /* genericRequest request; */
+      skyFrequencyInfo *info;
 
-	/* get the information about sky frequencies needed for SWARM */
-	/* info = getsky_1(&request, setLOCl); */
-	if (FALSE) {
-	  double skyFrequency;
+      /* get the information about sky frequencies needed for SWARM */
+      /* info = getsky_1(&request, setLOCl); */
+      if (FALSE) {
+	double skyFrequency;
 
-	  if (info->sideband[0])
-	    skyFrequency = info->frequency[0] + 5.0e9;
-	    else
-	    skyFrequency = info->frequency[0] - 5.0e9;
-	  sWARMCenterFrequency = skyFrequency;
-	  /* badSetLOCall = FALSE; */
-	} else {
-	  sWARMCenterFrequency = 2.3e11;
-	  /* badSetLOCall = TRUE; */
-	}
+	if (info->sideband[0])
+	  skyFrequency = info->frequency[0] + 5.0e9;
+	  else
+	  skyFrequency = info->frequency[0] - 5.0e9;
+	snap->sWARMCenterFrequency = skyFrequency;
+	/* badSetLOCall = FALSE; */
+      } else {
+	snap->sWARMCenterFrequency = 2.3e11;
+	/* badSetLOCall = TRUE; */
+      }
+    }
+    /* Try to connect to the statusServer - allow up to 8 retries before giving up */
+    mirOK = TRUE;
+    /*
+    if ((!statusServerConnectionOK) || (statusServerCl == NULL)) {
+      dprintf("Attempting to connect to statusServer on hal\n");
+      statusServerCl = clnt_create("hal9000", STATUSSERVERPROG, STATUSSERVERVERS, "tcp");
+    }
+    */
+    if (TRUE) {
+      mirOK = FALSE;
+      statusServerConnectionOK = FALSE;
+      strcpy(snap->sourceName, "LabAntennaSimulator");
+      if (FALSE) {
+	clnt_pcreateerror("hal9000");
+	fprintf(stderr, "header: WARNING: Could not connect to statusServer.\n");
       }
-      /* Try to connect to the statusServer - allow up to 8 retries before giving up */
-      mirOK = TRUE;
+    } else {
+      statusServerConnectionOK = TRUE;
+      /* timeout.tv_sec = 500.0; */
+      /* timeout.tv_usec = 0.0; */
       /*
-      if ((!statusServerConnectionOK) || (statusServerCl == NULL)) {
-        dprintf("Attempting to connect to statusServer on hal\n");
-        statusServerCl = clnt_create("hal9000", STATUSSERVERPROG, STATUSSERVERVERS, "tcp");
+      if (clnt_control(statusServerCl, CLSET_TIMEOUT, (char *)&timeout) == FALSE) {
+	fprintf(stderr, "header: Could not set hal9000 timeout to %d secs.\n", (int)timeout.tv_sec);
       }
       */
-      if (TRUE) {
-        mirOK = FALSE;
-        statusServerConnectionOK = FALSE;
-	strcpy(globalSourceName, "LabAntennaSimulator");
-        if (FALSE) {
-          clnt_pcreateerror("hal9000");
-          fprintf(stderr, "header: WARNING: Could not connect to statusServer.\n");
-        }
-      } else {
-        statusServerConnectionOK = TRUE;
-        /* timeout.tv_sec = 500.0; */
-        /* timeout.tv_usec = 0.0; */
+      /*                                                                                                                                                            I must fetch the source name here, because the next operation will be to send                                                                              a request for header information to statusServer.   statusServer keeps track of the                                                                        scan count, so we may go to a new source immediately after that call, and then                                                                             the source name info might be wrong.                                                                                                             	*/
+      /*
+      dSMStatus = dsm_read("hal9000", "DSM_AS_SOURCE_C34", snap->sourceName, &timeStamp);
+      if (dSMStatus == DSM_SUCCESS)
+	snap->sourceName[25] = (char)0;
+      else
+	dsm_error_message(dSMStatus, "DSM_AS_SOURCE_C34");
+      */
+      strcpy(snap->sourceName, "LabAntennaSimulator");
+      statusRequest.utsec = uT;
+      statusRequest.interval = intTime;
+      dprintf("header:\tmaking call to statusServer (%f, %f)\n",
+	      statusRequest.utsec, statusRequest.interval);
+      /* mirInfo = statusrequest_1(&statusRequest, statusServerCl); */
+      if (FALSE) {
+	struct rpc_err halerr;         /* RPC error structure */
+
+	mirOK = statusServerConnectionOK = FALSE;
+	fprintf(stderr, "header: WARNING: Opened connection to hal9000, but could not get mir data.\n");
+	/* clnt_geterr(statusServerCl, &halerr); */
+	fprintf(stderr, "header: RPC Error:  %s\n", clnt_sperrno(halerr.re_status));
 	/*
-        if (clnt_control(statusServerCl, CLSET_TIMEOUT, (char *)&timeout) == FALSE) {
-          fprintf(stderr, "header: Could not set hal9000 timeout to %d secs.\n", (int)timeout.tv_sec);
-        }
-	*/
-        /*                                                                                                                                                            I must fetch the source name here, because the next operation will be to send                                                                              a request for header information to statusServer.   statusServer keeps track of the                                                                        scan count, so we may go to a new source immediately after that call, and then                                                                             the source name info might be wrong.                                                                                                             	*/
-        /*
-	dSMStatus = dsm_read("hal9000", "DSM_AS_SOURCE_C34", globalSourceName, &timeStamp);
-        if (dSMStatus == DSM_SUCCESS)
-          globalSourceName[25] = (char)0;
-        else
-	  dsm_error_message(dSMStatus, "DSM_AS_SOURCE_C34");
+	if (halerr.re_status == RPC_TIMEDOUT) {
+	  if (clnt_control(statusServerCl, CLGET_TIMEOUT, (char *)&timeout) == FALSE) {
+	    fprintf(stderr, "header: Could not get hal9000 timeout\n");
+	  } else {
+	    fprintf(stderr, "header: timeout was set at %d secs.  %d\n",
+		    (int)timeout.tv_sec, (int)timeout.tv_usec);
+	  }
+	}
+	auth_destroy(statusServerCl->cl_auth);
+	clnt_destroy(statusServerCl);
 	*/
-	strcpy(globalSourceName, "LabAntennaSimulator");
-        statusRequest.utsec = headerScan->firstTime;
-        statusRequest.interval = headerScan->intTime;
-        dprintf("header:\tmaking call to statusServer (%f, %f)\n",
-                statusRequest.utsec, statusRequest.interval);
-        /* mirInfo = statusrequest_1(&statusRequest, statusServerCl); */
-        if (FALSE) {
-          struct rpc_err halerr;         /* RPC error structure */
-
-          mirOK = statusServerConnectionOK = FALSE;
-          fprintf(stderr, "header: WARNING: Opened connection to hal9000, but could not get mir data.\n");
-          /* clnt_geterr(statusServerCl, &halerr); */
-          fprintf(stderr, "header: RPC Error:  %s\n", clnt_sperrno(halerr.re_status));
-	  /*
-          if (halerr.re_status == RPC_TIMEDOUT) {
-            if (clnt_control(statusServerCl, CLGET_TIMEOUT, (char *)&timeout) == FALSE) {
-              fprintf(stderr, "header: Could not get hal9000 timeout\n");
-            } else {
-              fprintf(stderr, "header: timeout was set at %d secs.  %d\n",
-                      (int)timeout.tv_sec, (int)timeout.tv_usec);
-            }
-          }
-          auth_destroy(statusServerCl->cl_auth);
-          clnt_destroy(statusServerCl);
-	  */
-        }
+      }
+      /*
+      dSMStatus = dsm_read("hal9000", "DSM_AS_SOURCE_C34", checkSourceName, &timeStamp);
+      if (dSMStatus == DSM_SUCCESS)
+	checkSourceName[25] = (char)0;
+      else
+	dsm_error_message(dSMStatus, "DSM_AS_SOURCE_C34 (check read)");
+      */
+      strcpy(checkSourceName, "LabAntennaSimulator");
+      if (mirInfo) {
+	int i;
+
+	 for (i = 1; i < 9; i++) {
+	  if ((mirInfo->antavg[i].isvalid[0] == 1) && (mirInfo->antavg[i].isvalid[1] == 1024))
+	    mirInfo->antavg[i].isvalid[0] = 0;
+	 }
+       } else
+	fprintf(stderr, "Skipping 1 && 1024 test, because of NULL pointer\n");
+      if (strcmp(snap->sourceName, checkSourceName)) {
+	snap->spoilScan = TRUE;
+      } else {
+	static char lastSourceName[50];
+
+	if (!strcmp(checkSourceName, lastSourceName))
+	  snap->spoilScan = FALSE;
+	else {
+	  snap->spoilScan = TRUE;
+	}
+	strcpy(lastSourceName, checkSourceName);
+      }
+    }
+  } while ((mirOK == FALSE) && (i++ < 1));
+  /*
+  if (mirOK && (!haveLOData)) {
+    globalSkyFrequency[0] = mirInfo->loData.skyFrequency[0];
+    globalSkyFrequency[1] = mirInfo->loData.skyFrequency[1];
+    bcopy((char *)&(mirInfo->loData.frequencies), (char *)&(globalFrequencies),
+	  sizeof(globalFrequencies));
+    haveLOData = TRUE;
+  }
+  */
+  /* bcopy((char *)mirInfo, (char *)&(snap->header), sizeof(snap->header)); */
+  {
+    int ii;
+
+    for (ii = 0; ii < 11; ii++) {
+      snap->header.DDSdata.x[ii] = 1.0*ii;
+      snap->header.DDSdata.y[ii] = 2.0*ii;
+      snap->header.DDSdata.z[ii] = 3.0*ii;
+    }
+  }
+  getDSMInfo(&(snap->dSMStuff));
+  snap->bDAIFSep = bDAIFSep;
+  snap->uT = uT;
+  snap->intTime = intTime;
+  snap->fetchTime = statsNow();
+  snap->valid = TRUE;
+  captureRecord(DC_CAPTURE_HEADER, snap);
+} /* End of headerFetch */
+
+/*
+
+  H E A D E R   S N A P S H O T   F I N D
+
+  Returns the unused snapshot whose time is nearest to uT, or NULL if
+  there is none within MIDPOINT_SLOP.   A snapshot fetched more than an
+  integration time plus the prefetch lead ago is too stale to use.
+*/
+headerSnapshot *headerSnapshotFind(double uT)
+{
+  int i;
+  double now, nearest = MIDPOINT_SLOP;
+  headerSnapshot *found = NULL;
+
+  now = statsNow();
+  for (i = 0; i < HEADER_SNAPSHOTS; i++)
+    if (headerCache[i].valid &&
+	((now - headerCache[i].fetchTime) <= (headerCache[i].intTime + headerPrefetchLead)) &&
+	(fabs(headerCache[i].uT - uT) <= nearest)) {
+      found = &headerCache[i];
+      nearest = fabs(headerCache[i].uT - uT);
+    }
+  return(found);
+} /* End of headerSnapshotFind */
+
+/*
+
+  H E A D E R   A P P L Y
+
+  headerApply stores a headerSnapshot's information in a scan, and sets
+  the global values which go along with it.   The snapshot is then used up.
+*/
+void headerApply(pendingScan *scan, headerSnapshot *snap)
+{
+  strcpy(globalSourceName, snap->sourceName);
+  spoilScanFlag = snap->spoilScan;
+  sWARMCenterFrequency = snap->sWARMCenterFrequency;
+  bDAIFSep = snap->bDAIFSep;
+  bcopy((char *)&(snap->header), (char *)&(scan->header), sizeof(scan->header));
+  scan->dSMStuff = snap->dSMStuff;
+  snap->valid = FALSE;
+} /* End of headerApply */
+
+/*
+
+  H E A D E R
+
+  This function executes as a separate thread.   It waits on a semaphore
+  which is posted when the first visibility bundle for a new scan has
+  arrived, and then gives the scan its header information.
+  If headerPrefetch is set, the header information for the next scan is
+  fetched headerPrefetchLead seconds before that scan is expected, so
+  that normally the scan can be given a cached snapshot as soon as it
+  shows up, and the statusServer round trip is not on the path between
+  the last bundle and the WRITER thread.   A scan with no fresh snapshot
+  gets its header information fetched on the spot, as before.
+*/
+void *header(void *arg)
+{
+  int rCode, nextSnapshot = 0;
+  int prefetched = TRUE; /* Nothing to prefetch until a scan has been seen */
+  pendingScan *headerScan;
+  headerSnapshot *snap;
+  int nTimes = 0;
+  double startTimeDouble, stopTimeDouble, thisTime;
+  double lastUT = 0.0, lastIntTime = 0.0, lastBirth = 0.0, wakeTime;
+  double timeSum = 0.0;
+  double maxTime = -1.0e30;
+  double minTime = 1.0e30;
+  struct timespec startTime, stopTime, deadline;
+  void *returnValue = NULL;
+
+  printf("Thread HEADER starting\n");
+  while (TRUE) {
+    headerScan = nextScanNeedingHeader();
+    if (headerScan == NULL) {
+      if (headerPrefetch && !prefetched && (lastBirth > 0.0) && (lastIntTime > 0.0)) {
 	/*
-        dSMStatus = dsm_read("hal9000", "DSM_AS_SOURCE_C34", checkSourceName, &timeStamp);
-        if (dSMStatus == DSM_SUCCESS)
-          checkSourceName[25] = (char)0;
-        else
-          dsm_error_message(dSMStatus, "DSM_AS_SOURCE_C34 (check read)");
+	  Sleep until just before the next scan is expected, unless
+	  it turns up early, and then fetch its header information.
+	  A wake time already past just makes the fetch happen now.
 	*/
-	strcpy(checkSourceName, "LabAntennaSimulator");
-        if (mirInfo) {
-          int i;
-
-           for (i = 1; i < 9; i++) {
-            if ((mirInfo->antavg[i].isvalid[0] == 1) && (mirInfo->antavg[i].isvalid[1] == 1024))
-              mirInfo->antavg[i].isvalid[0] = 0;
-           }
-         } else
-	  fprintf(stderr, "Skipping 1 && 1024 test, because of NULL pointer\n");
-        if (strcmp(globalSourceName, checkSourceName)) {
-          spoilScanFlag = TRUE;
-        } else {
-          static char lastSourceName[50];
-
-          if (!strcmp(checkSourceName, lastSourceName))
-            spoilScanFlag = FALSE;
-          else {
-            spoilScanFlag = TRUE;
-          }
-          strcpy(lastSourceName, checkSourceName);
-        }
+	wakeTime = lastBirth + lastIntTime - headerPrefetchLead;
+	if (wakeTime < 0.0)
+	  wakeTime = 0.0;
+	deadline.tv_sec = (time_t)wakeTime;
+	deadline.tv_nsec = (long)((wakeTime - (double)deadline.tv_sec)*1.0e9);
+	if (deadline.tv_nsec < 0)
+	  deadline.tv_nsec = 0;
+	else if (deadline.tv_nsec > 999999999)
+	  deadline.tv_nsec = 999999999;
+	dprintf("header thread sleeping until %f, or a signal\n", wakeTime);
+	rCode = sem_timedwait(&needHeaderSem, &deadline);
+	if (rCode && (errno == ETIMEDOUT)) {
+	  headerFetch(&headerCache[nextSnapshot], lastUT + lastIntTime, lastIntTime);
+	  nextSnapshot = (nextSnapshot + 1) % HEADER_SNAPSHOTS;
+	  prefetched = TRUE;
+	  continue;
+	}
+	if (rCode && (errno != EINTR))
+	  /* Don't spin on a deadline sem_timedwait won't take */
+	  prefetched = TRUE;
+      } else {
+	dprintf("header thread sleeping, awaiting a signal\n");
+	rCode = sem_wait(&needHeaderSem);
       }
-    } while ((mirOK == FALSE) && (i++ < 1));
-    /*
-    if (mirOK && (!haveLOData)) {
-      globalSkyFrequency[0] = mirInfo->loData.skyFrequency[0];
-      globalSkyFrequency[1] = mirInfo->loData.skyFrequency[1];
-      bcopy((char *)&(mirInfo->loData.frequencies), (char *)&(globalFrequencies),
-            sizeof(globalFrequencies));
-      haveLOData = TRUE;
+      if (rCode && (errno != EINTR)) {
+        fprintf(stderr,
+                "header: Error %d returned by sem_wait\n",
+                errno);
+        perror("sem_wait");
+      }
+      continue;
     }
-    */
+    printf("header thread re-awakened\n");
+    clock_gettime(CLOCK_REALTIME, &startTime);
+    startTimeDouble = ((double)startTime.tv_sec) + ((double)startTime.tv_nsec)*1.0e-9;
+    snap = headerSnapshotFind(headerScan->firstTime);
+    if (snap == NULL) {
+      /* No snapshot ready - get the data from statusServer now */
+      snap = &headerCache[nextSnapshot];
+      nextSnapshot = (nextSnapshot + 1) % HEADER_SNAPSHOTS;
+      headerFetch(snap, headerScan->firstTime, headerScan->intTime);
+      statsCount(COUNT_HEADER_FETCHES, 1);
+    } else {
+      dprintf("header:\tusing the snapshot fetched at %f for UT %f\n", snap->fetchTime, snap->uT);
+      statsCount(COUNT_HEADER_PREFETCH_HITS, 1);
+    }
+    headerApply(headerScan, snap);
+    lastUT = headerScan->firstTime;
+    lastIntTime = headerScan->intTime;
+    lastBirth = headerScan->birthTime;
+    prefetched = FALSE;
     {
       int rx, sb, bl, ch;
 
@@ -1325,18 +2194,7 @@ void *header(void *arg)
 	      globalFrequencies.receiver[rx].sideband[sb].block[bl].chunk[ch].centerfreq = 1.0e9;
     }
     printf("Done setting globalFrequencies\n");
-    /* bcopy((char *)mirInfo, (char *)&(headerScan->header), sizeof(headerScan->header)); */
-    {
-      int ii;
-
-      for (ii = 0; ii < 11; ii++) {
-	headerScan->header.DDSdata.x[ii] = 1.0*ii;
-	headerScan->header.DDSdata.y[ii] = 2.0*ii;
-	headerScan->header.DDSdata.z[ii] = 3.0*ii;
-      }
-    }
     printf("header:\tDone with statusServer stuff\n");
-    getDSMInfo(&headerScan);
     if (doDSMWrite && FALSE) {
       /* int dSMStatus; */
 
@@ -1353,15 +2211,11 @@ void *header(void *arg)
     makePadList(&headerScan);
     calculateChunkFrequencies(&headerScan);
     /* Stuff the header information from statusServer into the scan. */
-    pthread_mutex_lock(&scanMutex);
-    headerScan->gotHeaderInfo = TRUE;
-    scanCompleteCheck(headerScan);
-    pthread_mutex_unlock(&scanMutex);
-    needHeader = FALSE;
-    pthread_mutex_unlock(&needHeaderMutex);
+    headerDone(headerScan);
     clock_gettime(CLOCK_REALTIME, &stopTime);
     stopTimeDouble = ((double)stopTime.tv_sec) + ((double)stopTime.tv_nsec)*1.0e-9;
     thisTime = stopTimeDouble-startTimeDouble;
+    statsRecord(STAGE_HEADER, thisTime);
     if (thisTime > maxTime)
       maxTime = thisTime;
     if (thisTime < minTime)
@@ -1393,6 +2247,76 @@ double calcJD(int year, int mon, int day, int hh, int mm, int ss)
 }
 
 
+/*
+
+  M I R  R E S E R V E
+
+  mirReserve returns a pointer to nBytes of space at the end of one
+  of the buffers in a scanOutput, enlarging the buffer if needed.
+  The pointer is only good until the next call for the same buffer.
+*/
+char *mirReserve(scanOutput *out, int file, size_t nBytes)
+{
+  mirBuffer *buf;
+  char *ptr;
+
+  buf = &out->buffer[file];
+  if (buf->used + nBytes > buf->size) {
+    size_t newSize;
+
+    newSize = (buf->size == 0)? 65536: buf->size;
+    while (newSize < buf->used + nBytes)
+      newSize *= 2;
+    buf->data = (char *)realloc(buf->data, newSize);
+    if (buf->data == NULL) {
+      fprintf(stderr, "Trying to realloc %d bytes for MIR file %d\n", (int)newSize, file);
+      perror("mirReserve: realloc");
+      exit(ERROR);
+    }
+    buf->size = newSize;
+  }
+  ptr = &buf->data[buf->used];
+  buf->used += nBytes;
+  return(ptr);
+} /* End of mirReserve */
+
+/*
+
+  M I R  P U T
+
+  mirPut appends a record to one of the buffers in a scanOutput.
+  It takes the place of an fwrite call on the MIR file.
+*/
+void mirPut(scanOutput *out, int file, void *record, size_t nBytes)
+{
+  memcpy(mirReserve(out, file, nBytes), record, nBytes);
+} /* End of mirPut */
+
+/*
+
+  M I R  P R I N T F
+
+  mirPrintf is the fprintf equivalent of mirPut.
+*/
+void mirPrintf(scanOutput *out, int file, const char *format, ...)
+{
+  int nChars;
+  char *ptr;
+  mirBuffer *buf;
+  va_list args;
+
+  buf = &out->buffer[file];
+  va_start(args, format);
+  nChars = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+  /* Reserve one extra byte for vsprintf's trailing null, then give it back */
+  ptr = mirReserve(out, file, nChars+1);
+  va_start(args, format);
+  vsprintf(ptr, format, args);
+  va_end(args);
+  buf->used--;
+} /* End of mirPrintf */
+
 /*
 
   F I X E D  C O D E S
@@ -1409,7 +2333,7 @@ double calcJD(int year, int mon, int day, int hh, int mm, int ss)
   Eric's original comment line:
   Writes the MIR ascii codes which do not depend on values in the data
 */
-void fixedCodes(FILE *fpcodeh)
+void fixedCodes(scanOutput *out)
 {
   
   int i;
@@ -1421,7 +2345,7 @@ void fixedCodes(FILE *fpcodeh)
   codeh.icode     = 0;          /* index for a code word      */
   strcpy(codeh.code, "D");      /* the code word              */
   codeh.ncode     = 1;          /* no longer used             */
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* ut:  ut at start of integration, one for each integration, 
      done in main code, completed. */
@@ -1435,164 +2359,164 @@ void fixedCodes(FILE *fpcodeh)
   strcpy(codeh.v_name, "tq");
   codeh.icode     = 0;
   strcpy(codeh.code, "v01");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* vctype: velocity correction definition. Completed.*/
   strcpy(codeh.v_name, "vctype"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "vlsr");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "cz");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 2;
   strcpy(codeh.code, "vhel");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 3;
   strcpy(codeh.code, "pla");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* sb: sideband, lower or upper. Completed. */
   strcpy(codeh.v_name, "sb"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "l");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "u");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 
   /*pol: polarization, hh,vv,hv,vh, etc Completed. */
   if (fullPolarization) {
     strcpy(codeh.v_name, "pol"); 
     codeh.icode     = POL_STATE_UNKNOWN;
     strcpy(codeh.code, "Unknown");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_RR;
     strcpy(codeh.code, "RR");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_RL;
     strcpy(codeh.code, "RL");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_LR;
     strcpy(codeh.code, "LR");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_LL;
     strcpy(codeh.code, "LL");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_LH;
     strcpy(codeh.code, "LH");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_LV;
     strcpy(codeh.code, "LV");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_RH;
     strcpy(codeh.code, "RH");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_RV;
     strcpy(codeh.code, "RV");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_HR;
     strcpy(codeh.code, "HR");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_HL;
     strcpy(codeh.code, "HL");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_HH;
     strcpy(codeh.code, "HH");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_HV;
     strcpy(codeh.code, "HV");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_VR;
     strcpy(codeh.code, "VR");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_VL;
     strcpy(codeh.code, "VL");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_VH;
     strcpy(codeh.code, "VH");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = POL_STATE_VV;
     strcpy(codeh.code, "VV");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   } else {
     strcpy(codeh.v_name, "pol"); 
     codeh.icode     = 0;
     strcpy(codeh.code, "hh");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = 1;
     strcpy(codeh.code, "vv");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = 2;
     strcpy(codeh.code, "hv");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
     codeh.icode     = 3;
     strcpy(codeh.code, "vh");
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   }
     
   /* aq: amplitude qualifier, 3 possible 1 2 and ' '. Completed */
   strcpy(codeh.v_name, "aq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "1");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 2;
   strcpy(codeh.code, "2");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* bq: baseline qualifier, 2 possible b and ' '. Completed*/
   strcpy(codeh.v_name, "bq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "b");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* cq: coherence qualifier, 2 possible c and ' '. Completed */
   strcpy(codeh.v_name, "cq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "c");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* oq: offset qualifier, 2 possible o and ' '. Completed */
   strcpy(codeh.v_name, "oq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "o");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* rec: receiver, 3 possible 230, 345, 400, 690. Completed*/
   strcpy(codeh.v_name, "rec"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "230"); 
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "345"); 
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 2;
   strcpy(codeh.code, "400"); 
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 3;
   strcpy(codeh.code, "690"); 
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* ifc: if channel, 2 possible from receiver 1 or 2. Completed*/
   strcpy(codeh.v_name, "ifc"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "1");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "2");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* tel1: antenna number 1. icode will be antenna# . Completed */
   strcpy(codeh.v_name, "tel1"); 
@@ -1600,7 +2524,7 @@ void fixedCodes(FILE *fpcodeh)
     codeh.icode = i;
     sprintf(intcode, "%d", i);
     strcpy(codeh.code, intcode);
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   }
   
   /* tel2: antenna number 2. icode will be antenna# . Completed */
@@ -1609,7 +2533,7 @@ void fixedCodes(FILE *fpcodeh)
     codeh.icode = i;
     sprintf(intcode, "%d", i);
     strcpy(codeh.code, intcode);
-    fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   }
   
   /* blcd: baseline code, use pad numbers. Done in main */
@@ -1618,64 +2542,64 @@ void fixedCodes(FILE *fpcodeh)
   strcpy(codeh.v_name, "gq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "g");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* pq: passband qualifier, 2 possible p and ' '. Completed */
   strcpy(codeh.v_name, "pq"); 
   codeh.icode     = 0;
   strcpy(codeh.code, " ");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "p");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* band: band type, 49 possible s1-24 (or 48 in doubleBandwidth mode) and c1. 
      continuum done here, spectra done in main */
   strcpy(codeh.v_name, "band") ;
   codeh.icode = codeh.ncode = 0;
   strcpy(codeh.code, "c1");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);                                                  
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));                                                  
   
   /* pstate: ???? . Can't find anyone at Caltech that remembers
      what this variable is used for. Completed */
   strcpy(codeh.v_name, "pstate"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "0");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* vtype: velocity correction definition. Completed */
   strcpy(codeh.v_name, "vtype"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "vlsr");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "cz");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 2;
   strcpy(codeh.code, "vhel");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 3;
   strcpy(codeh.code, "pla");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* taper: uniform or hanning smoothed u or h. Completed */
   strcpy(codeh.v_name, "taper"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "u");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "h");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* trans: line transition, anything, must be set in main. 
      Not done yet and may be a while. */
   strcpy(codeh.v_name, "trans"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "unspecified");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* source: name of source, must be set in main */
   
@@ -1684,16 +2608,16 @@ void fixedCodes(FILE *fpcodeh)
   strcpy(codeh.v_name, "pos"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "unspecified");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* offtype: The offset may be set as either az-el or ra-dec 2 possible */
   strcpy(codeh.v_name, "offtype"); 
   codeh.icode     = 0;
   strcpy(codeh.code, "ra-dec");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   codeh.icode     = 1;
   strcpy(codeh.code, "az-el");
-  fwrite_unlocked(&codeh, sizeof(codehDef), 1, fpcodeh);
+  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
   
   /* ra: Right Ascension. must be set in main */
   /* dec: Declination. must be set in main */
@@ -1942,7 +2866,7 @@ void coordStr(double radec, char *ch_str, int isdec)
   writeEngData writes everything needed in the eng_read data file
   for a single antenna.
 */
-void writeEngData(int ant, int pad, antDataDef data, FILE *file) {
+void writeEngData(int ant, int pad, antDataDef data, scanOutput *out) {
   antEngDef antData;
 
   antData.antennaNumber            = ant;
@@ -1976,7 +2900,7 @@ void writeEngData(int ant, int pad, antDataDef data, FILE *file) {
   antData.tsys                     = data.tsys;
   antData.tsys_rx2                 = data.tsys_rx2;
   antData.ambient_load_temperature = data.ambient_load_temperature;
-  fwrite_unlocked(&antData, sizeof(antEngDef), 1, file);
+  mirPut(out, MIR_ENG, &antData, sizeof(antEngDef));
 } /* End of writeEngData */
 
 /*
@@ -1990,24 +2914,24 @@ void writeEngData(int ant, int pad, antDataDef data, FILE *file) {
   the only variable-length structure (because of the packed data)
   so it is the only one I need to write out element-by-element.
   There aren't many elements so it is no big deal.
+  The packed data is not copied - schReserve has already placed it
+  in the sch buffer, right after the space for inhid and nbyt.
 */
-int schWrite(schDef *sch, FILE *fpsch)
+int schWrite(schDef *sch, scanOutput *out)
 {
   int size;
   int nbytes;   /* counts number of bytes written */
+  char *record;
   
   nbytes = 0;
   size = sch->nbyt;
+  record = ((char *)sch->packdata) - sizeof(sch->nbyt) - sizeof(sch->inhid);
 
-  sch->inhid     = sch->inhid;
-  sch->nbyt      = sch->nbyt;
-
-  fwrite_unlocked(&(sch->inhid), sizeof(sch->inhid), 1, fpsch);
+  memcpy(record, &(sch->inhid), sizeof(sch->inhid));
   nbytes += sizeof(sch->inhid);
-  fwrite_unlocked(&(sch->nbyt), sizeof(sch->nbyt), 1, fpsch);
+  memcpy(&record[nbytes], &(sch->nbyt), sizeof(sch->nbyt));
   nbytes += sizeof(sch->nbyt);
   dprintf("Writing %d bytes of packed data\n", size);
-  fwrite_unlocked(sch->packdata, size, 1, fpsch);
   nbytes += size;
 
   return nbytes;  
@@ -2015,87 +2939,315 @@ int schWrite(schDef *sch, FILE *fpsch)
 
 /*
 
-  P A C K  D A T A
+  S C H  C O M P R E S S
 
-  packData puts one spectrum (or continuum channel) into the one
-  dimensional array of short integers that holds the scaled
-  data (as complex numbers).
+  schCompress replaces the sch record which schWrite has just finished
+  with its compressed form (see schCodec.h), and adds the record to the
+  sch index, with the given SCH_INDEX_* flags.   offset tracks where the
+  record will land in sch_compressed.
 */
-int packData(int nChan, float intTime, float *real, float *imag, short *slot)
+void schCompress(schDef *sch, scanOutput *out, long long *offset, int flags)
 {
-  short scaleExp;
-  short	visRealS; /* real part of complex visibility scaled to short	   */
-  short	visImagS; /* imaginary part of complex visibility scaled to short */
-  int i, status;
-  float delta, scale;
-  float dataMax = -1.0e38;
-  float dataMin = 1.0e38;
-
-  status = -1;
-  /* Find range of values in this set */
-  for (i = 0; i < nChan; i++) {
-    if (real[i] < dataMin)
-      dataMin = real[i];
-    if (real[i] > dataMax)
-      dataMax = real[i];
-    if (imag[i] < dataMin)
-      dataMin = imag[i];
-    if (imag[i] > dataMax)
-      dataMax = imag[i];
-  }
-  if ((dataMax != 0.0) || (dataMin != 0.0))
-    status = 0;
-  if (fabs(dataMin) > dataMax)
-    dataMax = fabs(dataMin);
-  delta = dataMax/32767.0;
-  scaleExp = log(delta)/log(2.0);
-  if (scaleExp > 0)
-    scaleExp++;
-  scale = pow(2.0, (float)scaleExp);
-
-  slot[0] = scaleExp;
-  for (i = 0; i < nChan; i++) {
-    visRealS = real[i]/scale;
-    visImagS = imag[i]/scale;
-    slot[1 + 2*i] = visRealS;
-    slot[2 + 2*i] = visImagS;
+  static int zSize = 0;
+  static unsigned char *zBuffer = NULL;
+  int header[3], bound;
+  schIndexDef index;
+
+  bound = schEncodeBound(sch->nbyt/sizeof(short));
+  if (bound > zSize) {
+    zBuffer = (unsigned char *)realloc(zBuffer, bound);
+    if (zBuffer == NULL) {
+      fprintf(stderr, "Trying to realloc %d bytes\n", bound);
+      perror("schCompress: realloc of zBuffer");
+      exit(ERROR);
+    }
+    zSize = bound;
   }
-  return(status);
-} /* End of packData */
+  header[0] = sch->inhid;
+  header[1] = sch->nbyt;
+  header[2] = schEncode(sch->packdata, sch->nbyt/sizeof(short), zBuffer);
+  /* The uncompressed record is the only thing in the sch buffer */
+  out->buffer[MIR_SCH].used = 0;
+  mirPut(out, MIR_SCH, header, sizeof(header));
+  mirPut(out, MIR_SCH, zBuffer, header[2]);
+  index.inhid = header[0];
+  index.nbyt = header[1];
+  index.zbyt = header[2];
+  index.flags = flags;
+  index.offset = *offset;
+  mirPut(out, MIR_SCH_INDEX, &index, sizeof(index));
+  *offset += sizeof(header) + header[2];
+  dprintf("schCompress: %d bytes of packed data compressed to %d\n", header[1], header[2]);
+} /* End of schCompress */
 
 /*
-  C A L C  L A M B D A
 
-  Return the wavelength for a particular frequency if the frequency
-  passes sanity checks.
+  S C H  R E S E R V E
+
+  schReserve makes room for a complete sch record at the end of the sch
+  buffer, and points sch->packdata at the part of it which will hold the
+  packed spectra, so that packData writes straight into the output buffer.
+  Nothing else may be put into the sch buffer until schWrite is called.
 */
-double calcLambda(double freq)
+void schReserve(schDef *sch, scanOutput *out)
 {
-  static int sentOneBad = FALSE;
+  char *record;
 
-  if ((freq > 1.0e11) && (freq < 1.0e12) && (!isnan(freq))) {
-    sentOneBad = FALSE;
-    return(SPEED_OF_LIGHT / freq);
-  } else {
-    if (!sentOneBad) {
-      fprintf(stderr, "calcLambda(%f) is not good - will return 1.0\n", freq);
-      sentOneBad = TRUE;
+  record = mirReserve(out, MIR_SCH, sizeof(sch->inhid) + sizeof(sch->nbyt) + sch->nbyt);
+  sch->packdata = (short *)(record + sizeof(sch->inhid) + sizeof(sch->nbyt));
+} /* End of schReserve */
+
+/*
+
+  R E A D  S W A R M  A V E R A G I N G
+
+  Reads the SWARM spectral averaging the current project wants from
+  SWARM_AVERAGING_FILE, which holds a power of two factor, optionally
+  followed by "boxcar" (the default) or "weighted".   No file means no
+  averaging.   Called by the WRITER thread whenever it opens new data
+  files, so a project's setting stays fixed for the whole file.
+*/
+void readSWARMAveraging(void)
+{
+  int nRead, factor;
+  char mode[20];
+  FILE *averagingFile;
+
+  sWARMDecimation = 1;
+  sWARMAveraging = SWARM_AVERAGE_BOXCAR;
+  averagingFile = fopen(SWARM_AVERAGING_FILE, "r");
+  if (averagingFile == NULL)
+    return;
+  nRead = fscanf(averagingFile, "%d %19s", &factor, mode);
+  fclose(averagingFile);
+  if ((nRead < 1) || (factor < 1) || (factor > SWARM_MAX_DECIMATION) ||
+      ((factor & (factor - 1)) != 0)) {
+    fprintf(stderr, "readSWARMAveraging: %s should hold a power of two from 1 to %d - not averaging\n",
+	    SWARM_AVERAGING_FILE, SWARM_MAX_DECIMATION);
+    return;
+  }
+  if (nRead > 1) {
+    if (!strcmp(mode, "weighted"))
+      sWARMAveraging = SWARM_AVERAGE_WEIGHTED;
+    else if (strcmp(mode, "boxcar"))
+      fprintf(stderr, "readSWARMAveraging: Unknown averaging \"%s\" in %s - using boxcar\n",
+	      mode, SWARM_AVERAGING_FILE);
+  }
+  sWARMDecimation = factor;
+  printf("SWARM spectra will be averaged by %d (%s)\n", sWARMDecimation,
+	 (sWARMAveraging == SWARM_AVERAGE_WEIGHTED)? "weighted": "boxcar");
+} /* End of readSWARMAveraging */
+
+/*
+
+  S W A R M  D E C I M A T E
+
+  Averages an nIn channel SWARM spectrum down to nIn/factor channels,
+  in outReal and outImag.   Boxcar averaging takes the mean of each
+  group of factor channels.   Weighted averaging uses a triangle 2*factor
+  channels wide, centred on the same channels, which suppresses the
+  aliasing of features that straddle the group edges.   Either way each
+  output channel has the centre frequency of its group, so only the
+  channel width in the spectrum header changes.   Channels which are
+  exactly zero have no data (see sWARMScanQueue) and get no weight, and
+  an output channel with no data behind it is zero too.
+*/
+void sWARMDecimate(int nIn, int factor, int averaging, float *real, float *imag,
+		   float *outReal, float *outImag)
+{
+  int i, j, t, first, nOut, width;
+  float sumReal, sumImag, sumWeight, weight;
+  static float triangle[2*SWARM_MAX_DECIMATION];
+  static int triangleFactor = 0;
+
+  nOut = nIn/factor;
+  if (averaging == SWARM_AVERAGE_WEIGHTED) {
+    width = 2*factor;
+    if (triangleFactor != factor) {
+      for (t = 0; t < width; t++)
+	triangle[t] = 1.0 - fabs((float)t - ((float)factor - 0.5))/(float)factor;
+      triangleFactor = factor;
     }
-    return(1.0);
+  } else
+    width = factor;
+  for (i = 0; i < nOut; i++) {
+    if (averaging == SWARM_AVERAGE_WEIGHTED)
+      first = i*factor - factor/2;
+    else
+      first = i*factor;
+    sumReal = sumImag = sumWeight = 0.0;
+    for (t = 0; t < width; t++) {
+      j = first + t;
+      if ((j < 0) || (j >= nIn) || ((real[j] == 0.0) && (imag[j] == 0.0)))
+	continue;
+      weight = (averaging == SWARM_AVERAGE_WEIGHTED)? triangle[t]: 1.0;
+      sumReal += weight*real[j];
+      sumImag += weight*imag[j];
+      sumWeight += weight;
+    }
+    if (sumWeight > 0.0) {
+      outReal[i] = sumReal/sumWeight;
+      outImag[i] = sumImag/sumWeight;
+    } else
+      outReal[i] = outImag[i] = 0.0;
   }
-} /* End of calcLambda */
+} /* End of sWARMDecimate */
 
 /*
-  P O L A R  S T A T E  C O D E
 
-  Return the integer code corresponding to a baseline's polarization
- */
-int polarStateCode(int pol, dSMInfo info, int ant1, int ant2)
+  P C  C H U N K  S U M S
+
+  Sums one chunk's channels for the pseudo-continuum: the weighted real
+  and imaginary parts, and the weighted amplitude.   The SSE2 version
+  keeps four partial sums of each, and adds them together at the end, so
+  its results can differ from the scalar loop's in the last bit.
+*/
+void pCChunkSums(pCChunk *work)
 {
-  int returnVal;
+  int channel;
+  float real, imag, realSum, imagSum, ampSum;
+
+  realSum = imagSum = ampSum = 0.0;
+  work->gotNAN = FALSE;
+  channel = work->startChannel;
+#ifdef PACK_DATA_VECTORIZED
+  {
+    float lanes[4];
+    __m128 vReal, vImag, vRealSum, vImagSum, vAmpSum, vNAN;
+
+    vRealSum = vImagSum = vAmpSum = vNAN = _mm_setzero_ps();
+    for (; channel+4 <= work->endChannel+1; channel += 4) {
+      vReal = _mm_loadu_ps(&work->real[channel]);
+      vImag = _mm_loadu_ps(&work->imag[channel]);
+      vNAN = _mm_or_ps(vNAN, _mm_cmpunord_ps(vReal, vReal));
+      vRealSum = _mm_add_ps(vRealSum, vReal);
+      vImagSum = _mm_add_ps(vImagSum, vImag);
+      vAmpSum = _mm_add_ps(vAmpSum,
+			   _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vReal, vReal), _mm_mul_ps(vImag, vImag))));
+    }
+    if (_mm_movemask_ps(vNAN))
+      work->gotNAN = TRUE;
+    _mm_storeu_ps(lanes, vRealSum);
+    realSum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))*work->channelWeight;
+    _mm_storeu_ps(lanes, vImagSum);
+    imagSum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))*work->channelWeight;
+    _mm_storeu_ps(lanes, vAmpSum);
+    ampSum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))*work->channelWeight;
+  }
+#endif
+  for (; channel <= work->endChannel; channel++) {
+    real = work->real[channel];
+    imag = work->imag[channel];
+    if (isnan(real))
+      work->gotNAN = TRUE;
+    realSum += real * work->channelWeight;
+    imagSum += imag * work->channelWeight;
+    ampSum += sqrt(real*real + imag*imag) * work->channelWeight;
+  }
+  work->realSum = realSum;
+  work->imagSum = imagSum;
+  work->ampSum = ampSum;
+} /* End of pCChunkSums */
 
-  if (fullPolarization) {
-    /*
+/*
+
+  P C  D R A I N
+
+  Claims entries in pCWork, one at a time, and sums them, until there
+  are none left.   Run by the WRITER thread and by every helper.
+*/
+void pCDrain(void)
+{
+  int i;
+
+  while ((i = __atomic_fetch_add(&pCNext, 1, __ATOMIC_RELAXED)) < pCNWork)
+    pCChunkSums(&pCWork[i]);
+} /* End of pCDrain */
+
+/*
+
+  P C  W O R K E R
+
+  A pseudo-continuum helper thread.
+*/
+void *pCWorker(void *arg)
+{
+  while (TRUE) {
+    while (sem_wait(&pCStartSem) != OK)
+      if (errno != EINTR) {
+	perror("pCWorker: sem_wait on pCStartSem");
+	exit(ERROR);
+      }
+    pCDrain();
+    sem_post(&pCDoneSem);
+  }
+} /* End of pCWorker */
+
+/*
+
+  P C  S U M  C H U N K S
+
+  Fills in the sums for all n chunks in work, sharing them out between
+  the WRITER thread and the pseudo-continuum helpers.   Only the WRITER
+  thread calls this.   The semaphores make sure the helpers see work,
+  and the WRITER thread sees their sums.
+*/
+void pCSumChunks(pCChunk *work, int n)
+{
+  int i, nHelpers;
+
+  pCWork = work;
+  pCNWork = n;
+  __atomic_store_n(&pCNext, 0, __ATOMIC_RELAXED);
+  nHelpers = pCWorkers;
+  if (nHelpers > pCWorkersStarted)
+    nHelpers = pCWorkersStarted;
+  if (n < 2)
+    nHelpers = 0;
+  for (i = 0; i < nHelpers; i++)
+    sem_post(&pCStartSem);
+  pCDrain();
+  for (i = 0; i < nHelpers; i++)
+    while (sem_wait(&pCDoneSem) != OK)
+      if (errno != EINTR) {
+	perror("pCSumChunks: sem_wait on pCDoneSem");
+	exit(ERROR);
+      }
+} /* End of pCSumChunks */
+
+/*
+  C A L C  L A M B D A
+
+  Return the wavelength for a particular frequency if the frequency
+  passes sanity checks.
+*/
+double calcLambda(double freq)
+{
+  static int sentOneBad = FALSE;
+
+  if ((freq > 1.0e11) && (freq < 1.0e12) && (!isnan(freq))) {
+    sentOneBad = FALSE;
+    return(SPEED_OF_LIGHT / freq);
+  } else {
+    if (!sentOneBad) {
+      fprintf(stderr, "calcLambda(%f) is not good - will return 1.0\n", freq);
+      sentOneBad = TRUE;
+    }
+    return(1.0);
+  }
+} /* End of calcLambda */
+
+/*
+  P O L A R  S T A T E  C O D E
+
+  Return the integer code corresponding to a baseline's polarization
+ */
+int polarStateCode(int pol, dSMInfo info, int ant1, int ant2)
+{
+  int returnVal;
+
+  if (fullPolarization) {
+    /*
       Here we figure out what the polarization state of a particular scan is, based on
       the pol variable, which encodes which pair of receivers (345 or 400) produced
       the data, and what the position of the waveplates is on the two receivers.
@@ -2393,6 +3545,7 @@ void *copier(void *arg) {
       lastScansRemaining = scansRemaining;
     }
     */
+    sWARMScanDeadlineCheck();
     sleep(1);
   }
 }
@@ -2406,47 +3559,568 @@ void *copier(void *arg) {
 */
 
 void writeAutoData(int scan) {
-  static int autoFileOpen = FALSE;
-  static FILE *autoFile;
-  sWARMAutoRec *ptr, *tptr;
+  static int autoFd = -1;
+  int ant, chunk, nRecords;
+  ssize_t nBytes, nWritten;
+  struct iovec records[MAX_ANT+1];
+  sWARMAutoTable *table;
 
-  if (!autoFileOpen) {
+  if (autoFd < 0) {
     char autoFileName[1000];
     
     sprintf(autoFileName, "%s/autoCorrelations", pathName);
-    autoFile = fopen(autoFileName, "w");
-    if (autoFile == NULL) {
+    autoFd = open(autoFileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (autoFd < 0) {
       perror("opening autoFile");
       return;
     }
-    autoFileOpen = TRUE;
   }
+  /* Take the table filled since the last scan, and start filling the other */
   pthread_mutex_lock(&autoMutex);
-  ptr = sWARMAutoRoot;
-  printf("Looking for autocorrelations to store...\n");
-  while (ptr != NULL) {
-    ptr->autoData.scan = scan;
-    printf("Writing autocorrelation scan %d for ant %d\n", ptr->autoData.scan, ptr->autoData.antenna);
-    fwrite_unlocked(&(ptr->autoData), sizeof(autoCorrDef), 1, autoFile);
-    tptr = ptr;
-    ptr = ptr->next;
-    free(tptr);
-  }
-  sWARMAutoRoot = NULL;
+  table = &sWARMAutoTables[sWARMAutoFill];
+  sWARMAutoFill = 1 - sWARMAutoFill;
   pthread_mutex_unlock(&autoMutex);
-  fflush_unlocked(autoFile);
+  dprintf("Looking for autocorrelations to store...\n");
+  nRecords = 0;
+  nBytes = 0;
+  for (ant = 1; ant <= MAX_ANT; ant++)
+    if (table->present[ant]) {
+      for (chunk = 0; chunk < 2; chunk++)
+	if (!(table->present[ant] & (1 << chunk)))
+	  memset(table->autoData[ant].amp[chunk], 0, sizeof(table->autoData[ant].amp[chunk]));
+      table->autoData[ant].scan = scan;
+      table->autoData[ant].antenna = ant;
+      dprintf("Writing autocorrelation scan %d for ant %d\n", scan, ant);
+      records[nRecords].iov_base = &(table->autoData[ant]);
+      records[nRecords].iov_len = sizeof(autoCorrDef);
+      nBytes += sizeof(autoCorrDef);
+      nRecords++;
+      table->present[ant] = 0;
+    }
+  if (nRecords > 0) {
+    nWritten = writev(autoFd, records, nRecords);
+    if (nWritten != nBytes) {
+      fprintf(stderr, "writeAutoData: Only %d of %d bytes of scan %d autocorrelations written\n",
+	      (int)nWritten, (int)nBytes, scan);
+      perror("writeAutoData: writev");
+    }
+  }
 } /* End of writeAutoData */
 
+/*
+
+  N E X T   W R I T A B L E   S C A N
+
+  Returns the oldest complete scan in the scan ring, after moving it
+  to the WRITING state, or NULL if no scan is complete.
+*/
+pendingScan *nextWritableScan(void)
+{
+  int slot;
+  unsigned int word, oldestWord = 0;
+  double oldestTime = 1.0e30;
+  pendingScan *oldest = NULL;
+
+  for (slot = 0; slot < SCAN_POOL_SIZE; slot++) {
+    word = scanState(&scanPool[slot]);
+    if ((SCAN_STATE(word) == SCAN_COMPLETE) && (scanPool[slot].firstTime < oldestTime)) {
+      oldest = &scanPool[slot];
+      oldestTime = scanPool[slot].firstTime;
+      oldestWord = word;
+    }
+  }
+  if ((oldest != NULL) && !scanTransition(oldest, oldestWord, SCAN_WRITING))
+    oldest = NULL;
+  return(oldest);
+} /* End of nextWritableScan */
+
+/*
+
+  M I R  F I L E  O P E N
+
+  Open one of the MIR data files for writing, using the output backend
+  specified by mode.
+*/
+void mirFileOpen(mirFile *file, char *fileName, int mode)
+{
+  file->mode = mode;
+  file->written = file->allocated = 0;
+  file->preallocate = TRUE;
+  if (mode == MIR_OUTPUT_DIRECT) {
+    int stage;
+
+    file->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+    if ((file->fd < 0) && (errno == EINVAL)) {
+      fprintf(stderr, "mirFileOpen: O_DIRECT not supported for \"%s\" - will preallocate instead\n",
+	      fileName);
+      mirFileOpen(file, fileName, MIR_OUTPUT_PREALLOCATED);
+      return;
+    }
+    if (file->fd < 0) {
+      fprintf(stderr, "mirFileOpen: Could not open \"%s\"\n", fileName);
+      perror("mirFileOpen: open with O_DIRECT");
+      exit(ERROR);
+    }
+    file->nextStage = 0;
+    file->failed = FALSE;
+    for (stage = 0; stage < 2; stage++) {
+      file->stage[stage].data = NULL;
+      file->stage[stage].size = 0;
+      file->stage[stage].inFlight = FALSE;
+      if (sem_init(&file->stage[stage].done, 0, 0) == ERROR) {
+	perror("mirFileOpen: sem_init");
+	exit(ERROR);
+      }
+    }
+  } else if (mode == MIR_OUTPUT_PREALLOCATED) {
+    file->fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file->fd < 0) {
+      fprintf(stderr, "mirFileOpen: Could not open \"%s\"\n", fileName);
+      perror("mirFileOpen: open");
+      exit(ERROR);
+    }
+  } else {
+    file->stream = fopen(fileName, "w");
+    if (file->stream == NULL) {
+      fprintf(stderr, "mirFileOpen: Could not open \"%s\"\n", fileName);
+      perror("mirFileOpen: fopen");
+      exit(ERROR);
+    }
+  }
+  file->open = TRUE;
+} /* End of mirFileOpen */
+
+/*
+
+  D I R E C T  W R I T E  D O N E
+
+  aio completion notification for MIR_OUTPUT_DIRECT writes.   This runs
+  in a thread created by the aio library, so it only timestamps the
+  write and lets the MIR_IO thread do the bookkeeping.
+*/
+void directWriteDone(union sigval value)
+{
+  struct timespec now;
+  directStage *stage;
+
+  stage = (directStage *)value.sival_ptr;
+  clock_gettime(CLOCK_REALTIME, &now);
+  stage->doneTime = ((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9;
+  sem_post(&stage->done);
+} /* End of directWriteDone */
+
+/*
+
+  D I R E C T  R E W R I T E
+
+  Write a staging buffer synchronously, with pwrite.   Used when an
+  asynchronous write could not be submitted, or did not complete.
+  Returns OK if every byte was written.
+*/
+int directRewrite(int fd, directStage *stage)
+{
+  ssize_t nWritten;
+  size_t done = 0;
+
+  while (done < stage->cb.aio_nbytes) {
+    nWritten = pwrite(fd, stage->data + done, stage->cb.aio_nbytes - done,
+		      stage->cb.aio_offset + done);
+    if (nWritten < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("directRewrite: pwrite");
+      return(ERROR);
+    }
+    if (nWritten == 0)
+      return(ERROR);
+    done += nWritten;
+  }
+  return(OK);
+} /* End of directRewrite */
+
+/*
+
+  D I R E C T  W A I T
+
+  Wait for the write from one staging buffer to finish, and add its
+  latency to schIOStats and the STAGE_SCH_DIRECT_WRITE statistics.
+  If the write failed, or was short, it is done again with pwrite,
+  since the data after it has already been placed in the file.   If that fails too, the file is marked as
+  failed, and nothing more will be written to it.   Returns OK if
+  the staging buffer's data is on the disk.
+*/
+int directWait(mirFile *file, directStage *stage)
+{
+  ssize_t nWritten;
+  double latency;
+
+  if (!stage->inFlight)
+    return(OK);
+  while (sem_wait(&stage->done) != OK)
+    if (errno != EINTR) {
+      perror("directWait: sem_wait");
+      exit(ERROR);
+    }
+  stage->inFlight = FALSE;
+  nWritten = aio_return(&stage->cb);
+  if (nWritten != (ssize_t)stage->cb.aio_nbytes) {
+    fprintf(stderr, "directWait: Only %d of %d bytes of scan %d written to sch_read - rewriting\n",
+	    (int)nWritten, (int)stage->cb.aio_nbytes, stage->scanNumber);
+    errno = aio_error(&stage->cb);
+    perror("directWait: aio_write");
+    schIOStats.nErrors++;
+    if (directRewrite(file->fd, stage) != OK) {
+      fprintf(stderr, "directWait: Could not rewrite scan %d - no more data will be written to sch_read\n",
+	      stage->scanNumber);
+      file->failed = TRUE;
+      return(ERROR);
+    }
+    return(OK);
+  }
+  latency = stage->doneTime - stage->submitTime;
+  schIOStats.nWrites++;
+  schIOStats.bytes += nWritten;
+  schIOStats.lastLatency = latency;
+  schIOStats.sumLatency += latency;
+  if (latency < schIOStats.minLatency)
+    schIOStats.minLatency = latency;
+  if (latency > schIOStats.maxLatency)
+    schIOStats.maxLatency = latency;
+  statsRecord(STAGE_SCH_DIRECT_WRITE, latency);
+  dprintf("sch_read: scan %d, %d bytes written in %f seconds (%f, %f, %f)\n",
+	 stage->scanNumber, (int)nWritten, latency, schIOStats.sumLatency/((double)schIOStats.nWrites),
+	 schIOStats.maxLatency, schIOStats.minLatency);
+  return(OK);
+} /* End of directWait */
+
+/*
+
+  D I R E C T  W R I T E
+
+  Start an asynchronous O_DIRECT write of nBytes, which will be appended
+  to the file.   O_DIRECT writes must start and end on DIRECT_IO_ALIGN
+  boundaries, so the partial block left at the end of the previous write
+  is carried over: the new data is copied into a staging buffer right
+  after a copy of that tail, the buffer is padded with zeros to a whole
+  number of blocks, and the write starts at the beginning of the tail's
+  block.   The padding is overwritten by the next write, and removed
+  when the file is closed.   Since consecutive writes can share a block,
+  a write is only started once the previous one has finished, but the
+  copy into the staging buffer is done while the previous one is still
+  in flight, and this function returns without waiting for the new one.
+  If the write cannot be submitted, it is done synchronously instead.
+  The tail and the file length are only advanced once the write has
+  been submitted or done, so a failure leaves the file as it was.
+*/
+int directWrite(mirFile *file, char *data, size_t nBytes, int scanNumber)
+{
+  size_t carry, total, padded;
+  struct timespec now;
+  directStage *stage;
+
+  if (file->failed)
+    return(ERROR);
+  stage = &file->stage[file->nextStage];
+  if (directWait(file, stage) != OK)
+    return(ERROR);
+  carry = file->written % DIRECT_IO_ALIGN;
+  total = carry + nBytes;
+  padded = ((total + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN) * DIRECT_IO_ALIGN;
+  if (padded > stage->size) {
+    free(stage->data);
+    if (posix_memalign((void **)&stage->data, DIRECT_IO_ALIGN, padded) != 0) {
+      fprintf(stderr, "Trying to allocate %d bytes for sch_read staging buffer\n", (int)padded);
+      perror("directWrite: posix_memalign");
+      exit(ERROR);
+    }
+    stage->size = padded;
+  }
+  memcpy(stage->data, file->tail, carry);
+  memcpy(&stage->data[carry], data, nBytes);
+  memset(&stage->data[total], 0, padded - total);
+
+  /* The other buffer holds the previous write, which must be finished first */
+  if (directWait(file, &file->stage[1 - file->nextStage]) != OK)
+    return(ERROR);
+  bzero((char *)&stage->cb, sizeof(stage->cb));
+  stage->cb.aio_fildes = file->fd;
+  stage->cb.aio_buf = stage->data;
+  stage->cb.aio_nbytes = padded;
+  stage->cb.aio_offset = file->written - carry;
+  stage->cb.aio_sigevent.sigev_notify = SIGEV_THREAD;
+  stage->cb.aio_sigevent.sigev_notify_function = directWriteDone;
+  stage->cb.aio_sigevent.sigev_value.sival_ptr = stage;
+  stage->scanNumber = scanNumber;
+  clock_gettime(CLOCK_REALTIME, &now);
+  stage->submitTime = ((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9;
+  if (aio_write(&stage->cb) == OK)
+    stage->inFlight = TRUE;
+  else {
+    perror("directWrite: aio_write - writing synchronously");
+    schIOStats.nErrors++;
+    if (directRewrite(file->fd, stage) != OK)
+      return(ERROR);
+  }
+  memcpy(file->tail, &stage->data[padded - DIRECT_IO_ALIGN], DIRECT_IO_ALIGN);
+  file->written += nBytes;
+  file->nextStage = 1 - file->nextStage;
+  return(OK);
+} /* End of directWrite */
+
+/*
+
+  D I R E C T  F L U S H
+
+  Wait for all of a direct file's writes to finish.   Returns OK if
+  everything written to the file so far is on the disk.
+*/
+int directFlush(mirFile *file)
+{
+  int stage, rCode = OK;
+
+  for (stage = 0; stage < 2; stage++)
+    if (directWait(file, &file->stage[stage]) != OK)
+      rCode = ERROR;
+  return(rCode);
+} /* End of directFlush */
+
+/*
+
+  M I R  F I L E  W R I T E
+
+  Append nBytes to a MIR data file.   In MIR_OUTPUT_PREALLOCATED and
+  MIR_OUTPUT_DIRECT modes, if the data would run past the space already
+  reserved, enough space is reserved for the next PREALLOCATE_SCANS scans
+  of the same size.
+  The space is reserved with FALLOC_FL_KEEP_SIZE, so that a reader sees
+  the file end where the data ends.
+*/
+int mirFileWrite(mirFile *file, char *data, size_t nBytes, int scanNumber)
+{
+  ssize_t nWritten;
+
+  if (file->mode == MIR_OUTPUT_STDIO) {
+    if (fwrite_unlocked(data, nBytes, 1, file->stream) != 1)
+      return(ERROR);
+    file->written += nBytes;
+    return(OK);
+  }
+  if (file->preallocate && (file->written + (off_t)nBytes + DIRECT_IO_ALIGN > file->allocated)) {
+    off_t extent;
+
+    extent = PREALLOCATE_SCANS * (off_t)nBytes;
+    if (extent < PREALLOCATE_MINIMUM)
+      extent = PREALLOCATE_MINIMUM;
+    if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, file->written, extent) == 0)
+      file->allocated = file->written + extent;
+    else {
+      perror("mirFileWrite: fallocate - will not preallocate this file");
+      file->preallocate = FALSE;
+    }
+  }
+  if (file->mode == MIR_OUTPUT_DIRECT)
+    return(directWrite(file, data, nBytes, scanNumber));
+  while (nBytes > 0) {
+    nWritten = write(file->fd, data, nBytes);
+    if (nWritten < 0) {
+      if (errno == EINTR)
+	continue;
+      return(ERROR);
+    }
+    data += nWritten;
+    nBytes -= nWritten;
+    file->written += nWritten;
+  }
+  return(OK);
+} /* End of mirFileWrite */
+
+/*
+
+  M I R  F I L E  S Y N C
+
+  Called at the end of each scan.   For stdio files this just empties
+  the stdio buffer, preallocated files are flushed to the disk.
+  Direct files are left alone - their writes complete asynchronously.
+*/
+void mirFileSync(mirFile *file)
+{
+  if (file->mode == MIR_OUTPUT_STDIO)
+    fflush_unlocked(file->stream);
+  else if (file->mode == MIR_OUTPUT_DIRECT)
+    return; /* The data is not cached, and the write is still in flight */
+  else if (fdatasync(file->fd) != OK)
+    perror("mirFileSync: fdatasync");
+} /* End of mirFileSync */
+
+/*
+
+  M I R  F I L E  C L O S E
+
+  Close a MIR data file.   Any preallocated space, or direct write
+  padding, past the end of the data is given back.
+*/
+void mirFileClose(mirFile *file)
+{
+  if (file->mode == MIR_OUTPUT_STDIO)
+    fclose(file->stream);
+  else {
+    if (file->mode == MIR_OUTPUT_DIRECT) {
+      int stage;
+
+      for (stage = 0; stage < 2; stage++) {
+	directWait(file, &file->stage[stage]);
+	sem_destroy(&file->stage[stage].done);
+	free(file->stage[stage].data);
+      }
+    }
+    if ((file->allocated > file->written) || (file->mode == MIR_OUTPUT_DIRECT))
+      if (ftruncate(file->fd, file->written) != OK)
+	perror("mirFileClose: ftruncate");
+    close(file->fd);
+  }
+  file->open = FALSE;
+} /* End of mirFileClose */
+
+/*
+
+  M I R  I O
+
+  This function executes as a separate thread.   It waits for the WRITER
+  thread to hand it a filled scanOutput, (re)opens the data files if the
+  WRITER has started a new data directory, and then writes each file's
+  buffer with a single call to mirFileWrite.   scanOutputs are handed over
+  and written strictly in order, so the inhid, blhid and sphid sequences
+  in the files are exactly those the WRITER thread produced.
+  The output backend is chosen each time a new set of files is opened.
+  If schDirectIO is set, sch_read, which holds nearly all of the bytes,
+  is written with asynchronous O_DIRECT writes so that the spectra do
+  not pass through the page cache.   sch_index entries point into
+  sch_compressed, so each scan's index entries are only written once
+  its data has reached the disk, so that a reader following the index
+  never finds a record which has not been written yet.
+*/
+void *mirIO(void *arg)
+{
+  int rCode, file, next = 0;
+  char fileName[100];
+  double startTime;
+  scanOutput *out;
+  mirFile mirFiles[N_MIR_FILES];
+  static char *mirFileName[N_MIR_FILES] = {"plot_me_5_rx0", "plot_me_5_rx1",
+					   "bl_read", "we_read", "tsys_read", "codes_read",
+					   "eng_read", "in_read", "sp_read", "sch_read",
+					   SCH_INDEX_FILE};
+
+  printf("Thread MIR_IO starting\n");
+  for (file = 0; file < N_MIR_FILES; file++)
+    mirFiles[file].open = FALSE;
+  while (TRUE) {
+    rCode = sem_wait(&outputReadySem);
+    if (rCode != OK) {
+      if (errno != EINTR)
+	perror("mirIO: sem_wait");
+      continue;
+    }
+    out = &outputRing[next];
+    startTime = statsNow();
+    if (out->newFiles) {
+      for (file = 0; file < N_MIR_FILES; file++) {
+	if (mirFiles[file].open)
+	  mirFileClose(&mirFiles[file]);
+	if ((file >= MIR_PLOT) && (file < MIR_PLOT+MAX_RX) && !out->plotActive[file-MIR_PLOT])
+	  continue;
+	if ((file == MIR_SCH_INDEX) && !out->schCompressed)
+	  continue;
+	if ((file == MIR_SCH) && out->schCompressed)
+	  sprintf(fileName, "%s%s", out->path, SCH_COMPRESSED_FILE);
+	else
+	  sprintf(fileName, "%s%s", out->path, mirFileName[file]);
+	if ((file == MIR_SCH) && schDirectIO)
+	  mirFileOpen(&mirFiles[file], fileName, MIR_OUTPUT_DIRECT);
+	else
+	  mirFileOpen(&mirFiles[file], fileName, mirOutputMode);
+      }
+    }
+    for (file = 0; file < N_MIR_FILES; file++) {
+      if (mirFiles[file].open && (out->buffer[file].used > 0)) {
+	if ((file == MIR_SCH_INDEX) && mirFiles[MIR_SCH].open &&
+	    (mirFiles[MIR_SCH].mode == MIR_OUTPUT_DIRECT) &&
+	    (directFlush(&mirFiles[MIR_SCH]) != OK)) {
+	  fprintf(stderr, "mirIO: sch data for scan %d was not written - its index entries are dropped\n",
+		  out->scanNumber);
+	  out->buffer[file].used = 0;
+	  continue;
+	}
+	if (mirFileWrite(&mirFiles[file], out->buffer[file].data, out->buffer[file].used,
+			 out->scanNumber) != OK) {
+	  fprintf(stderr, "mirIO: Error writing %d bytes of %s for scan %d\n",
+		  (int)out->buffer[file].used, mirFileName[file], out->scanNumber);
+	  perror("mirIO: mirFileWrite");
+	} else
+	  statsCount(COUNT_BYTES_WRITTEN, out->buffer[file].used);
+	mirFileSync(&mirFiles[file]);
+      }
+      out->buffer[file].used = 0;
+    }
+    statsRecord(STAGE_FILE_WRITE, statsNow()-startTime);
+    dprintf("mirIO: Wrote scan %d\n", out->scanNumber);
+    next = (next + 1) % OUTPUT_RING_SIZE;
+    sem_post(&outputFreeSem);
+  } /* End of while (TRUE) */
+} /* End of mirIO */
+
+/*
+
+  S P H  F R E Q U E N C I E S
+
+  Fill in the sky frequency, velocity and resolution fields of a
+  spectrum header, for band number band (s-style chunk number chunk)
+  with nChan channels and a center sky frequency of fSky GHz.
+*/
+void sphFrequencies(sphDef *sph, int rx, int sb, int band, int chunk, int nChan, double fSky)
+{
+  sph->fsky = fSky;
+  sph->vel  = 0.0;
+  if ((band != 0) && (chunk >= 49)) {
+    sph->vres = (-SPEED_OF_LIGHT * (SWARM_CHUNK_FULL_BANDWIDTH)/(float)nChan
+		 * 1.0e-12) / sph->fsky;
+    sph->fres = (SWARM_CHUNK_FULL_BANDWIDTH * 1.0E-6)/(float)nChan;
+  } else {
+    sph->vres = (-SPEED_OF_LIGHT * (CHUNK_FULL_BANDWIDTH)/(float)nChan
+		 * 1.0e-12) / sph->fsky;
+    sph->fres = (CHUNK_FULL_BANDWIDTH * 1.0E-6)/(float)nChan;
+  }
+  if (band == 0) {
+    sph->vres *= 4.0;
+    sph->fres *= 4.0;
+  }
+  if (sb == 0) {
+    sph->fres *= -1.0;
+    sph->vres *= -1.0;
+  }
+  /*
+    K L U D G E
+
+    Mark Gurwell has found that the sky frequecies as calculated above are in error
+    by +-1/2 channel.   The following code "fixes" that problem, whose origion is
+    unknown.
+  */
+  sph->fsky = sph->fsky + sidebandSign(rx, chunk)*5.0e-4*sph->fres;
+  sph->vel  = sph->vel  + sidebandSign(rx, chunk)*5.0e-1*sph->vres;
+  /* End of   K L U D G E   */
+} /* End of sphFrequencies */
+
 /*
   
   W R I T E R
   
   This function executes as a separate thread, it waits until a
-  condition variable is signalled.   This signal indicates that
-  a scan is ready to be written to the data file.   If needed,
-  the directory and new data files are created.   The scan is
-  written, and once written the scan structure is removed
-  from the linked list and its storage space is freed.
+  semaphore is posted.   This indicates that a scan is ready to
+  be written to the data file.   If needed, the directory is created.
+  The scan's MIR records are assembled in a scanOutput, and the scan's
+  slot in the scan ring is freed.   The scanOutput is then handed to the
+  MIR_IO thread, so that the disk writes for this scan overlap with the
+  processing of the next one.
 */
 void *writer(void *arg)
 {
@@ -2460,24 +4134,19 @@ void *writer(void *arg)
   int antTsysByteOffset[MAX_ANT+1] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
   int numberOfPolarizations = 0;
   int thisScanWasGood;
-  int plotFileOpen = FALSE;
-  int weFileOpen = FALSE;
-  int tsysFileOpen = FALSE;
   int modeFileWritten = FALSE;
   int antFileWritten = FALSE;
   int pIFileWritten = FALSE;
   int codeVersionFileWritten = TRUE;
-  int baselineFileOpen = FALSE;
-  int codesFileOpen = FALSE;
-  int engFileOpen = FALSE;
-  int inFileOpen = FALSE; /* despite its name, we only do output with it */
-  int spFileOpen = FALSE;
-  int schFileOpen = FALSE;
+  int nextOutput = 0;
+  int compressSch = FALSE;
+  long long schOffset = 0; /* Bytes written to sch_compressed */
   int ind1, ind2, ind3, ind4, i1Stop, i2Stop, i3Stop, i4Stop;
   unsigned int polarInt;
   int numberOfBaselines, numberOfSidebands, numberOfReceivers;
   int pCNPoints[MAX_RX+1][MAX_ANT+1][MAX_ANT+1][MAX_SB][MAX_POLARIZATION];
   int pCFreqNPoints[MAX_RX+1][MAX_SB][MAX_POLARIZATION];
+  int nZeroFilled; /* Spectra in this scan flagged SFLAG_SWARM_MISSING */
   int inhid = 0, sphid = 0, blhid = 0; /* Keto Komment: unique identifiers for each individual  */
                                        /* integration, baseline & spectrum. inhid is set to the */
 		                       /* scan number supplied by the crate controller          */
@@ -2502,12 +4171,18 @@ void *writer(void *arg)
   float pCVelo[MAX_RX+1][MAX_SB][MAX_POLARIZATION];
   float pCPhase[MAX_RX+1][MAX_ANT+1][MAX_ANT+1][MAX_SB][MAX_POLARIZATION];
   float pCCoh[MAX_RX+1][MAX_ANT+1][MAX_ANT+1][MAX_SB][MAX_POLARIZATION];
+  static pCChunk *pCChunks = NULL; /* Chunks to be summed for the pseudo-continuum */
+  static sphFrequencyCache sphFrequencyTable[MAX_RX][MAX_SB][2*MAX_BLOCK*MAX_CHUNK + MAX_INTERIM_CHUNK + 1];
+  static int maxPCChunks = 0;
+  int nPCChunks;
   int nCratesReportingTime;
   double averageTime, vRadial;
   char antOnline[11];
   char utstring[30];      /* storage for UT time in ascii */
   char sourceList[MAX_SOURCES][34]; /* List of source names already used */
   pendingScan scanCopy;
+  pendingScan *writingScan;
+  scanOutput *out;
   codehDef codeh;
   inhDef inh;
   sphDef sph;
@@ -2519,13 +4194,11 @@ void *writer(void *arg)
   */
   int nTimes = 0;
   /* time_t timestamp; */
-  double startTimeDouble, stopTimeDouble, timeSum = 0.0, thisTime;
+  double startTimeDouble, stopTimeDouble, timeSum = 0.0, thisTime, stageStart;
   double maxTime = -1.0e30;
   double minTime = 1.0e30;
   struct timespec startTime, stopTime;
-  FILE *plotFile[MAX_RX], *baselineFile = NULL, *codesFile = NULL , *engFile = NULL,
-    *inFile = NULL, *spFile = NULL, *schFile = NULL, *antFile, *pIFile, *weFile = NULL;
-  FILE *modeFile, *tsysFile = NULL;
+  FILE *antFile, *pIFile, *modeFile;
 
   printf("Thread WRITER starting\n");
   { /* Assemble the LO frequency information */
@@ -2653,17 +4326,18 @@ void *writer(void *arg)
      have set data within the time window, and header data is available).
   */
   while (TRUE) {
-    pthread_mutex_lock(&writeScanMutex);
-    while (!needWrite) {
+    writingScan = nextWritableScan();
+    if (writingScan == NULL) {
       printf("writer thread sleeping, awaiting a signal\n");
-      rCode = pthread_cond_wait(&writeScanCond, &writeScanMutex);
-      if (rCode) {
+      rCode = sem_wait(&writeScanSem);
+      if (rCode && (errno != EINTR)) {
 	fprintf(stderr,
-		"writer: Error %d returned by pthread_cond_wait\n",
-		rCode);
-	perror("pthread_cond_wait");
+		"writer: Error %d returned by sem_wait\n",
+		errno);
+	perror("sem_wait");
       }
       printf("writer thread re-awakened ");
+      continue;
     }
     thisScanWasGood = TRUE;
     clock_gettime(CLOCK_REALTIME, &startTime);
@@ -2679,18 +4353,13 @@ void *writer(void *arg)
     sendOperatorMessages = TRUE;
     printf("and proceeding to write scan %d\n", globalScanNumber);
     /*
-      Make a temporary copy of the scan for processing, so that
-      we won't hold the SERVER thread waiting for the scanMutex.
+      Make a temporary copy of the scan's header information for
+      processing.   The cached bundles are not copied - they stay in
+      the scan's arena, and the slot stays in the WRITING state until
+      the writer is done with them.   Nothing else touches a slot in
+      that state, so no lock is needed.
     */
-    pthread_mutex_lock(&scanMutex);
-    bcopy((char *)writableScan, (char *)(&scanCopy), sizeof(scanCopy));
-    for (i = 0; i <= MAX_CRATE; i++)
-      if (writableScan->received[i])
-	bundleCopy(writableScan->data[i], &(scanCopy.data[i]), FALSE,
-		   &(writableScan->hiRes[i]), &(writableScan->nDaisyChained[i]),
-		   &(writableScan->nInDaisyChain[i]));
-    deleteScan(writableScan, TRUE);
-    pthread_mutex_unlock(&scanMutex);
+    bcopy((char *)writingScan, (char *)(&scanCopy), sizeof(scanCopy));
     /*
       Sum the Hi-Res mode partial chunks!
 
@@ -2751,6 +4420,14 @@ void *writer(void *arg)
 	Now do the actual writing of the data
       */
       dprintf("writer:\tlowest active antenna is %d\n", lowestAntennaNumber);
+      while (sem_wait(&outputFreeSem) != OK)
+	if (errno != EINTR) {
+	  perror("writer: sem_wait on outputFreeSem");
+	  exit(ERROR);
+	}
+      out = &outputRing[nextOutput];
+      out->newFiles = FALSE;
+      out->scanNumber = globalScanNumber;
       if (needNewDataFile) {
 	int dirCode;
 	/* int ii, jj, kk, ds; */
@@ -2850,27 +4527,12 @@ void *writer(void *arg)
 	}
 	inhid = sphid = blhid = 0;
 	/*
-	  (re)Open the data files
+	  Have the MIR_IO thread (re)open the data files
 	*/
-	if (plotFileOpen)
-	  for (rx = 0; rx < MAX_RX; rx++)
-	    fclose(plotFile[rx]);
-	if (baselineFileOpen)
-	  fclose(baselineFile);
-	if (weFileOpen)
-	  fclose(weFile);
-	if (tsysFileOpen)
-	  fclose(tsysFile);
-	if (codesFileOpen)
-	  fclose(codesFile);
-	if (engFileOpen)
-	  fclose(engFile);
-	if (inFileOpen)
-	  fclose(inFile);
-	if (spFileOpen)
-	  fclose(spFile);
-	if (schFileOpen)
-	  fclose(schFile);
+	out->newFiles = TRUE;
+	strcpy(out->path, pathName);
+	out->schCompressed = compressSch = schCompression;
+	schOffset = 0;
 	if (!antFileWritten) {
 	  sprintf(fileName, "%santennas", pathName);
 	  antFile = fopen(fileName, "w");
@@ -2943,17 +4605,7 @@ void *writer(void *arg)
 	  }
 	}
 	for (rx = 0; rx < MAX_RX; rx++)
-	  if (receiverActive[rx]) {
-	    if (!((rx != doubleBandwidthRx) && doubleBandwidth)) {
-	      sprintf(fileName, "%splot_me_5_rx%d", pathName, rx);
-	      plotFile[rx] = fopen(fileName, "w");
-	      if (plotFile[rx] == NULL) {
-		perror("writer: plotFile fopen");
-		exit(ERROR);
-	      } else
-		plotFileOpen = TRUE;
-	    }
-	  }
+	  out->plotActive[rx] = receiverActive[rx] && (!((rx != doubleBandwidthRx) && doubleBandwidth));
 	if (!modeFileWritten) {
 	  sprintf(fileName, "%smodeInfo", pathName);
 	  modeFile = fopen(fileName, "w");
@@ -2973,63 +4625,8 @@ void *writer(void *arg)
 	  }
 	  modeFileWritten = TRUE;
 	}
-	sprintf(fileName, "%sbl_read", pathName);
-	baselineFile = fopen(fileName, "w");
-	if (baselineFile == NULL) {
-	  perror("writer: baselineFile fopen");
-	  exit(ERROR);
-	} else
-	  baselineFileOpen = TRUE;
-	sprintf(fileName, "%swe_read", pathName);
-	weFile = fopen(fileName, "w");
-	if (weFile == NULL) {
-	  perror("writer: weFile fopen");
-	  exit(ERROR);
-	} else
-	  weFileOpen = TRUE;
-	sprintf(fileName, "%stsys_read", pathName);
-	tsysFile = fopen(fileName, "w");
-	if (tsysFile == NULL) {
-	  perror("writer: tsysFile fopen");
-	  exit(ERROR);
-	} else
-	  tsysFileOpen = TRUE;
-	sprintf(fileName, "%scodes_read", pathName);
-	codesFile = fopen(fileName, "w");
-	if (codesFile == NULL) {
-	  perror("writer: codesFile fopen");
-	  exit(ERROR);
-	} else
-	  codesFileOpen = TRUE;
-	fixedCodes(codesFile);
-	sprintf(fileName, "%seng_read", pathName);
-	engFile = fopen(fileName, "w");
-	if (engFile == NULL) {
-	  perror("writer: engFile fopen");
-	  exit(ERROR);
-	} else
-	  engFileOpen = TRUE;
-	sprintf(fileName, "%sin_read", pathName);
-	inFile = fopen(fileName, "w");
-	if (inFile == NULL) {
-	  perror("writer: inFile fopen");
-	  exit(ERROR);
-	} else
-	  inFileOpen = TRUE;
-	sprintf(fileName, "%ssp_read", pathName);
-	spFile = fopen(fileName, "w");
-	if (spFile == NULL) {
-	  perror("writer: spFile fopen");
-	  exit(ERROR);
-	} else
-	  spFileOpen = TRUE;
-	sprintf(fileName, "%ssch_read", pathName);
-	schFile = fopen(fileName, "w");
-	if (schFile == NULL) {
-	  perror("writer: schFile fopen");
-	  exit(ERROR);
-	} else
-	  schFileOpen = TRUE;
+	fixedCodes(out);
+	readSWARMAveraging();
 
 	needNewDataFile = FALSE;
       } /* end of if (needNewDataFile) */
@@ -3077,8 +4674,8 @@ void *writer(void *arg)
 	    printf("...---... Ant %d Tsys: n: %d %f %f %f %f %f %f %f %f\n", ant, tsysh.nMeasurements,
 		   tsysh.data[0], tsysh.data[1], tsysh.data[2], tsysh.data[3], tsysh.data[4], tsysh.data[5],
 		   tsysh.data[6], tsysh.data[7]);
-	    fwrite_unlocked(&tsysh.nMeasurements, 4, 1, tsysFile);
-	    fwrite_unlocked(tsysh.data, tsysh.nMeasurements*16, 1, tsysFile);
+	    mirPut(out, MIR_TSYS, &tsysh.nMeasurements, 4);
+	    mirPut(out, MIR_TSYS, tsysh.data, tsysh.nMeasurements*16);
 	    tsysByteOffset += 4+tsysh.nMeasurements*16;
 	  }
 	}
@@ -3099,6 +4696,8 @@ void *writer(void *arg)
       /*
 	Calculate pseudo-continuum channel amplitude, phase, coherence and average frequency
       */
+      stageStart = statsNow();
+      nPCChunks = 0;
       for (rx = 0; rx < MAX_RX+1; rx++) {
 	nBands[rx] = 1;
 	for (sb = 0; sb < MAX_SB; sb++)
@@ -3122,6 +4721,7 @@ void *writer(void *arg)
       }
 
       inhid = globalScanNumber;
+      nZeroFilled = 0;
       lowestCrateNumber = UNINITIALIZED;
       for (crate = 1; crate <= MAX_CRATE; crate++) {
 	if (scanCopy.received[crate]) {
@@ -3188,6 +4788,9 @@ void *writer(void *arg)
 	      rx = 1 - scanCopy.data[crate]->set.set_val[set].rxBoardHalf;
 	      nChannels[rx][sChunk(block, chunk)] = 
 		scanCopy.data[crate]->set.set_val[set].real.real_val[0].channel.channel_len;
+	      if ((sChunk(block, chunk) >= 49) &&
+		  ((nChannels[rx][sChunk(block, chunk)] % sWARMDecimation) == 0))
+		nChannels[rx][sChunk(block, chunk)] /= sWARMDecimation;
 	      if (fullPolarization) {
 		chunk = scanCopy.data[crate]->set.set_val[set].chunkNumber;
 		block = scanCopy.data[crate]->blockNumber;
@@ -3241,10 +4844,8 @@ void *writer(void *arg)
 	      } else
 		pol = 0;
 	      for (sb = 0; sb < scanCopy.data[crate]->set.set_val[set].real.real_len; sb++) {
-		int channel;
-		float ampSum, realSum, imagSum, edgeWidth;
+		float edgeWidth;
 
-		ampSum = realSum = imagSum = 0.0;
 		if (rx == 1 - scanCopy.data[crate]->set.set_val[set].rxBoardHalf) {
 		  float channelWeight;
 		  
@@ -3259,7 +4860,9 @@ void *writer(void *arg)
 		    effRx = rx;
 		  effRx = 0;
 		  goodChunk[rx][ant1][ant2][sChunk(block, chunk)] = TRUE;
+		  /* A zero-filled SWARM chunk would only dilute the average */
 		  if (goodChunk[rx][ant1][ant2][sChunk(block, chunk)] &&
+		      !sWARMChunkMissing(&scanCopy, crate, ant1, ant2, chunk) &&
 		      ((rx == effRx) || (doubleBandwidth && doubleBandwidthContinuum) ||
 		       ((rx == 1) && (!doubleBandwidth)))) {
 		    pCFreqSum[effRx][sb][pol] += scanCopy.chunkFreq[rx][sb][sChunk(block, chunk)];
@@ -3285,31 +4888,26 @@ void *writer(void *arg)
 		    channelWeight = 1.0 / channelWeight;
 		    dprintf("For chunk s%02d, start, %d, end %d, channelWeight = %f\n",
 			    sChunk(block, chunk),startChannel, endChannel, channelWeight);
-		    for (channel = startChannel; channel <= endChannel; channel++) {
-		      float real, imag, amp;
-		      
-		      real = scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_val[channel];
-		      if (isnan(real)) {
-			/* printf("___ real is NAN at chan %d sb %d crate %d set %d\n", */
-			/*        channel, sb, crate, set); */
-			exit(-1);
-		      } else
-			/* printf("___ real is OK at chan %d sb %d crate %d set %d\n", */
-			/*        channel, sb, crate, set); */
-		      realSum += real * channelWeight;
-		      imag = scanCopy.data[crate]->set.set_val[set].imag.imag_val[sb].channel.channel_val[channel];
-		      imagSum += imag * channelWeight;
-		      amp = sqrt(real*real + imag*imag) * channelWeight;
-		      ampSum += amp;
+		    /* The channels are summed later, by pCSumChunks */
+		    if (nPCChunks >= maxPCChunks) {
+		      maxPCChunks = 2*maxPCChunks + 64;
+		      pCChunks = (pCChunk *)realloc(pCChunks, maxPCChunks*sizeof(pCChunk));
+		      if (pCChunks == NULL) {
+			perror("writer: realloc of pCChunks");
+			exit(ERROR);
+		      }
 		    }
-		    pCRealSum[effRx][ant1][ant2][sb][pol] += realSum;
-		    pCImagSum[effRx][ant1][ant2][sb][pol] += imagSum;
-		    pCAmpSum[effRx][ant1][ant2][sb][pol]  += ampSum;
-		    nPCCohPoints[effRx][ant1][ant2][sb][pol]  += 1.0;
-		    /*
-		      pCNPoints[effRx][ant1][ant2][sb][pol] += endChannel - startChannel + 1;
-		    */
-		    pCNPoints[effRx][ant1][ant2][sb][pol]++; /* Just normalize by the number of chunks summed */
+		    pCChunks[nPCChunks].real = scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_val;
+		    pCChunks[nPCChunks].imag = scanCopy.data[crate]->set.set_val[set].imag.imag_val[sb].channel.channel_val;
+		    pCChunks[nPCChunks].startChannel = startChannel;
+		    pCChunks[nPCChunks].endChannel = endChannel;
+		    pCChunks[nPCChunks].channelWeight = channelWeight;
+		    pCChunks[nPCChunks].rx = effRx;
+		    pCChunks[nPCChunks].ant1 = ant1;
+		    pCChunks[nPCChunks].ant2 = ant2;
+		    pCChunks[nPCChunks].sb = sb;
+		    pCChunks[nPCChunks].pol = pol;
+		    nPCChunks++;
 		  } else
 		    printf("Ignoring chunk s%d on baseline %d-%d for pc\n",
 			    sChunk(block, chunk), ant1, ant2);
@@ -3319,6 +4917,26 @@ void *writer(void *arg)
 	    } /* for set ... */
 	} /* if scanCopy.received[crate] */
       } /* for crate... */
+      /*
+	Sum every chunk's channels, in parallel, then add the sums up in the
+	order the chunks were found, so the result doesn't depend on which
+	thread summed what.
+      */
+      pCSumChunks(pCChunks, nPCChunks);
+      for (i = 0; i < nPCChunks; i++) {
+	pCChunk *work = &pCChunks[i];
+
+	if (work->gotNAN)
+	  exit(-1);
+	pCRealSum[work->rx][work->ant1][work->ant2][work->sb][work->pol] += work->realSum;
+	pCImagSum[work->rx][work->ant1][work->ant2][work->sb][work->pol] += work->imagSum;
+	pCAmpSum[work->rx][work->ant1][work->ant2][work->sb][work->pol]  += work->ampSum;
+	nPCCohPoints[work->rx][work->ant1][work->ant2][work->sb][work->pol]  += 1.0;
+	/*
+	  pCNPoints[effRx][ant1][ant2][sb][pol] += endChannel - startChannel + 1;
+	*/
+	pCNPoints[work->rx][work->ant1][work->ant2][work->sb][work->pol]++; /* Just normalize by the number of chunks summed */
+      }
       averageTime /= (3600.0*(float)nCratesReportingTime);
       averageTime = 0.0;
       for (rx = 0; rx < MAX_RX; rx++) {
@@ -3356,6 +4974,7 @@ void *writer(void *arg)
 	  }
 	}
       }
+      statsRecord(STAGE_PSEUDO_CONTINUUM, statsNow()-stageStart);
       numberOfBaselines = numberOfReceivers = 0;
       for (i = 0; i <= MAX_RX; i++)
 	if (receiverActive[i])
@@ -3377,7 +4996,7 @@ void *writer(void *arg)
 	  weh.humid[i] = -1.0;
       }
       if (store)
-	fwrite_unlocked(&weh, sizeof(weh), 1, weFile);
+	mirPut(out, MIR_WE, &weh, sizeof(weh));
       /*
 	Write stuff to codes file
       */
@@ -3415,7 +5034,7 @@ void *writer(void *arg)
 	codeh.ncode = 0;
 	refTimeStr(mon, day, yr, codeh.code);
 	if (store)
-	  fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 	dprintf("The new reference day is %s\n", codeh.code);
       }
       /* Write the UTS time to the code file */
@@ -3423,7 +5042,7 @@ void *writer(void *arg)
       codeh.icode = globalScanNumber;
       uTTimeStr(mon, day, yr, hr, min, sec, codeh.code);
       if (store)
-	fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
       strcpy(utstring, codeh.code);
 
       /* Write "vrad" string to the code file */
@@ -3436,7 +5055,7 @@ void *writer(void *arg)
 	sprintf(codeh.code, "%21.14e", vRadial);
       codeh.ncode = strlen(codeh.code);
       if (store)
-	fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
       thisVRadId++;
 
       /*
@@ -3461,7 +5080,7 @@ void *writer(void *arg)
 		scanCopy.header.antavg[lowestAntennaNumber].sourceName, 25);
 	printf("...---... Writing source name \"%s\" (\"%s\")\n", codeh.code, globalSourceName);
 	if (store)
-	  fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
       }
       thisSourceId = source+1;
       /* 
@@ -3479,11 +5098,11 @@ void *writer(void *arg)
       strcpy(codeh.v_name, "ra");
       coordStr(rar, codeh.code, 0);
       if (store)
-	fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
       strcpy(codeh.v_name, "dec");
       coordStr(decr, codeh.code, 1);
       if (store)
-	fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 
       strncpy(currentSource, scanCopy.header.antavg[lowestAntennaNumber].sourceName, 23);
       currentSource[23] = (char)0;
@@ -3534,8 +5153,8 @@ void *writer(void *arg)
 	}
 	if (receiverActive[rx]) {
 	  if (store && (!((rx != effRx) && doubleBandwidth))) {
-	    fprintf(plotFile[rx], "%s ", scanCopy.header.antavg[lowestAntennaNumber].sourceName);
-	    fprintf(plotFile[rx], "%f %f %f %f %d ", averageTime, hAMidpoint, decr,
+	    mirPrintf(out, MIR_PLOT+rx, "%s ", scanCopy.header.antavg[lowestAntennaNumber].sourceName);
+	    mirPrintf(out, MIR_PLOT+rx, "%f %f %f %f %d ", averageTime, hAMidpoint, decr,
 		    (pCFreq[effRx][0][ePol]+pCFreq[effRx][1][ePol])/bDAIFSep,
 		    scanCopy.header.antavg[lowestAntennaNumber].obstype);
 	  }
@@ -3573,7 +5192,7 @@ void *writer(void *arg)
 		  printf("...---... Before test %d %d %d %d   %d \n", store, rx, effRx, doubleBandwidth,
 			 store && (!((rx != effRx) && doubleBandwidth)));
 		  if (store && (!((rx != effRx) && doubleBandwidth)))
-		    fprintf(plotFile[rx], "%d %d %d %e %e %e ",
+		    mirPrintf(out, MIR_PLOT+rx, "%d %d %d %e %e %e ",
 			    ant1, ant2, flag,
 			    pCAmp[effRx][ant1][ant2][sb][ePol],
 			    pCPhase[effRx][ant1][ant2][sb][ePol],
@@ -3584,7 +5203,7 @@ void *writer(void *arg)
 	    } /* for (ant1 = 1; ant1 < MAX_ANT+1; ant1++) */
 	  } /* for (sb = 0; sb < numberOfSidebands; sb++) */
 	  if (store && (!((rx != effRx) && doubleBandwidth)))
-	    fprintf(plotFile[rx], " %08x\n", polarInt);
+	    mirPrintf(out, MIR_PLOT+rx, " %08x\n", polarInt);
 	}
       } /* End of loop over rx */
       /*
@@ -3636,7 +5255,7 @@ void *writer(void *arg)
 	  writeEngData(foundAntennaList[ant1],
 		       scanCopy.padList[foundAntennaList[ant1]],
 		       scanCopy.header.antavg[foundAntennaList[ant1]],
-		       engFile);
+		       out);
       
       /*
 	Write the baseline file stuff - this is a mir file.
@@ -3665,7 +5284,7 @@ void *writer(void *arg)
 	  strcpy(codeh.v_name, "blcd"); 
 	  sprintf(codeh.code, "%d-%d", bslnIndx[bl].ant1, bslnIndx[bl].ant2);
 	  if (store)
-	    fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+	    mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 	}
       
       /* Write our any new spectral chunk codes we need to */
@@ -3687,7 +5306,7 @@ void *writer(void *arg)
 	      codeh.icode = codeh.ncode = chunkCodes[0][sch];
 	      sprintf(codeh.code, "s%02d", sch);
 	      if (store)
-		fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+		mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 	      dprintf("Setting chunkCodes[%d][%d] = %d, code = \"%s\"\n", 0, sch, chunkCodes[0][sch], codeh.code);
 	    }
 	  }
@@ -3701,7 +5320,7 @@ void *writer(void *arg)
 		codeh.icode = codeh.ncode = chunkCodes[1][sch];
 		sprintf(codeh.code, "s%02d", sch);
 		if (store)
-		  fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+		  mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 		dprintf("Setting chunkCodes[%d][%d] = %d, code = \"%s\"\n", 0, sch, chunkCodes[1][sch], codeh.code);
 	      }
 	    }
@@ -3713,7 +5332,7 @@ void *writer(void *arg)
 	      codeh.icode = codeh.ncode = chunkCodes[1][sch];
 	      sprintf(codeh.code, "s%02d", sch);
 	      if (store)
-		fwrite_unlocked(&codeh, sizeof(codehDef), 1, codesFile);
+		mirPut(out, MIR_CODES, &codeh, sizeof(codehDef));
 	    }
 	  }
 	}
@@ -3811,13 +5430,8 @@ void *writer(void *arg)
 		    sch.nbyt += sizeof(short)*(2*nChannels[rx][bandIndx[rx][band]] + 1);
 		  }
 	    }
-      sch.packdata = (short *)malloc(sch.nbyt);
-      if (sch.packdata == NULL) {
-	fprintf(stderr, "Trying to malloc %d bytes\n", sch.nbyt);
-	perror("malloc of sch.packdata");
-	sch.packdata[2000000] = 0; /* Should force core dump */
-	exit(-1); /* Die if the core dump doesn't happen */
-      }
+      schReserve(&sch, out);
+      stageStart = statsNow();
       sch.inhid = inhid;
       /*
 	Here I set the values for items which we are not really using in the Mir format,
@@ -3975,7 +5589,7 @@ void *writer(void *arg)
 		blh[rx][sb][bl].bln     = scanCopy.padN[ant1] - scanCopy.padN[ant2]; /*    bsl north vector */
 		blh[rx][sb][bl].blu     = scanCopy.padU[ant1] - scanCopy.padU[ant2]; /*    bsl up vector    */
     		if (store && (!doubleBandwidth || (rx == doubleBandwidthRx)))
-		  fwrite_unlocked(&blh[rx][sb][bl], sizeof(blhDef), 1, baselineFile);
+		  mirPut(out, MIR_BL, &blh[rx][sb][bl], sizeof(blhDef));
 		
 		if (doubleBandwidth) {
 		  if (rx == 0) {
@@ -4027,10 +5641,23 @@ void *writer(void *arg)
 		    }
 		  } else {
 		    if ((crate >= 0) && (set >= 0)) {
+		      float *real, *imag;
+		      static float decimatedReal[N_SWARM_CHUNK_POINTS], decimatedImag[N_SWARM_CHUNK_POINTS];
+
+		      real = &scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_val[0];
+		      imag = &scanCopy.data[crate]->set.set_val[set].imag.imag_val[sb].channel.channel_val[0];
+		      if ((bandIndx[rx][band] >= 49) &&
+			  (nChannels[rx][bandIndx[rx][band]] !=
+			   scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_len)) {
+			sWARMDecimate(scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_len,
+				      sWARMDecimation, sWARMAveraging, real, imag, decimatedReal, decimatedImag);
+			real = decimatedReal;
+			imag = decimatedImag;
+		      }
 		      if ((packData(nChannels[rx][bandIndx[rx][band]],
 				    scanCopy.data[lowestCrateNumber]->intTime,
-				    &scanCopy.data[crate]->set.set_val[set].real.real_val[sb].channel.channel_val[0],
-				    &scanCopy.data[crate]->set.set_val[set].imag.imag_val[sb].channel.channel_val[0],
+				    real,
+				    imag,
 				    &sch.packdata[specOffset[rx][sb][pol][bl][band]]) == -1) &&
 			  (reportAllErrors)) {
 			fprintf(stderr,
@@ -4066,27 +5693,32 @@ void *writer(void *arg)
 		  /*  velocity (vtype)          */
 		  /*  velocity res. km/s        */
 		  /*  hardwired at 0 = vlsr     */
-		  if (band == 0) {
-		    sph.fsky  = pCFreq[effectiveRx][sb][pol]/1.0e9;
-		    sph.vel   = 0.0;
-		  } else {
-		    if (nChannels[rx][bandIndx[rx][band]] == N_SWARM_CHUNK_POINTS) {
-		      sph.fsky  = scanCopy.sWARMFreq[sb][bandIndx[rx][band]-49];
-		      sph.vel   = 0.0;
-		    } else {
-		      sph.fsky  = scanCopy.chunkFreq[rx][sb][bandIndx[rx][band]]/1.0e9;
-		      sph.vel   = 0.0;
-		    }
-		  }
 		  /*  center sky freq. GHz */
-		  if (nChannels[rx][bandIndx[rx][band]] == N_SWARM_CHUNK_POINTS) {
-		    sph.vres = (-SPEED_OF_LIGHT * (SWARM_CHUNK_FULL_BANDWIDTH)/(float)nChannels[rx][bandIndx[rx][band]]
-				* 1.0e-12) / sph.fsky;
-		    sph.fres = (SWARM_CHUNK_FULL_BANDWIDTH * 1.0E-6)/(float)nChannels[rx][bandIndx[rx][band]];
-		  } else {
-		    sph.vres = (-SPEED_OF_LIGHT * (CHUNK_FULL_BANDWIDTH)/(float)nChannels[rx][bandIndx[rx][band]]
-				* 1.0e-12) / sph.fsky;
-		    sph.fres = (CHUNK_FULL_BANDWIDTH * 1.0E-6)/(float)nChannels[rx][bandIndx[rx][band]];
+		  if (band == 0)
+		    sphFrequencies(&sph, rx, sb, band, bandIndx[rx][band], nChannels[rx][bandIndx[rx][band]],
+				   pCFreq[effectiveRx][sb][pol]/1.0e9);
+		  else {
+		    sphFrequencyCache *cached;
+
+		    cached = &sphFrequencyTable[rx][sb][bandIndx[rx][band]];
+		    if ((scanCopy.freqGeneration == 0) ||
+			(cached->generation != scanCopy.freqGeneration) ||
+			(cached->nChannels != nChannels[rx][bandIndx[rx][band]])) {
+		      if (bandIndx[rx][band] >= 49)
+			sphFrequencies(&cached->sph, rx, sb, band, bandIndx[rx][band],
+				       nChannels[rx][bandIndx[rx][band]],
+				       scanCopy.sWARMFreq[sb][bandIndx[rx][band]-49]);
+		      else
+			sphFrequencies(&cached->sph, rx, sb, band, bandIndx[rx][band],
+				       nChannels[rx][bandIndx[rx][band]],
+				       scanCopy.chunkFreq[rx][sb][bandIndx[rx][band]]/1.0e9);
+		      cached->generation = scanCopy.freqGeneration;
+		      cached->nChannels = nChannels[rx][bandIndx[rx][band]];
+		    }
+		    sph.fsky = cached->sph.fsky;
+		    sph.vel  = cached->sph.vel;
+		    sph.fres = cached->sph.fres;
+		    sph.vres = cached->sph.vres;
 		  }
 		  sph.gunnLO  = gunnLO[rx]/1.0e9;
 		  if (band != 0) {
@@ -4098,27 +5730,7 @@ void *writer(void *arg)
 		    sph.corrLO1 = 5.0;
 		    sph.corrLO2 = 0.0;
 		  }
-		  
-		  if (band == 0) {
-		    sph.vres *= 4.0;
-		    sph.fres *= 4.0;
-		  }
-		  if (sb == 0) {
-		    sph.fres *= -1.0;
-		    sph.vres *= -1.0;
-		  }
 		  sph.integ  = scanCopy.data[lowestCrateNumber]->intTime; /*  integration time          */
-		  /*
-		    K L U D G E
-		    
-		    Mark Gurwell has found that the sky frequecies as calculated above are in error
-		    by +-1/2 channel.   The following code "fixes" that problem, whose origion is
-		    unknown.
-		  */
-		  sph.fsky   = sph.fsky + sidebandSign(rx, bandIndx[rx][band])*5.0e-4*sph.fres;
-		  sph.vel    = sph.vel  + sidebandSign(rx, bandIndx[rx][band])*5.0e-1*sph.vres;
-		  sph.fsky   = sph.fsky;
-		  /* End of   K L U D G E   */
 
                   if (fullPolarization) {
                     switch (pol) {
@@ -4182,6 +5794,12 @@ void *writer(void *arg)
 		  if (spoilScanFlag)
 		    sph.flags |= SFLAG_SOURCE_CHANGE;
 		  sph.flags = 0; /* All lab data flagged good */
+		  if ((band != 0) && (set >= 0) &&
+		      sWARMChunkMissing(&scanCopy, crate, ant1, ant2,
+					scanCopy.data[crate]->set.set_val[set].chunkNumber)) {
+		    sph.flags |= SFLAG_SWARM_MISSING;
+		    nZeroFilled++;
+		  }
 		  sph.integ     = 30.0;
 		  sph.vradcat   = scanCopy.header.loData.vCatalog;
 		  sph.nch       = nChannels[rx][bandIndx[rx][band]]; /* # channels in spectrum */
@@ -4194,7 +5812,7 @@ void *writer(void *arg)
 		  }
 		  sph.rfreq     = 230.538;
 		  if (store && ((!((rx == 1) && (band == 0))) || (!doubleBandwidth)) ) {
-		    fwrite_unlocked(&sph, sizeof(sphDef), 1, spFile);
+		    mirPut(out, MIR_SP, &sph, sizeof(sphDef));
 		  }
 		} /* End loop over bands */
 	      } /* End of loop over baselines */
@@ -4202,6 +5820,7 @@ void *writer(void *arg)
 	  } /* End of loop over sidebands */
 	} /* End of "if (receiverActive[rx] || doubleBandwidth)" */
       } /* End of loop over receivers */
+      statsRecord(STAGE_PACK_DATA, statsNow()-stageStart);
       dprintf("After loops, thisScanWasGood = %d\n", thisScanWasGood);
       {
         /* long scansRemaining; */
@@ -4277,13 +5896,16 @@ void *writer(void *arg)
 	dprintf("Setting source size to %f\n", inh.size);
       }                                    /* source size               */
       if (store)
-	fwrite_unlocked(&inh, sizeof(inhDef), 1, inFile);
+	mirPut(out, MIR_IN, &inh, sizeof(inhDef));
 
       dprintf("Number of receivers: %d Number of sidebands: %d  numberOfBaselines: %d   averageTime %f\n",
 	      numberOfReceivers, numberOfSidebands, numberOfBaselines, averageTime);
-      if (store)
-	schWrite(&sch, schFile);
-      free(sch.packdata);
+      if (store) {
+	schWrite(&sch, out);
+	if (compressSch)
+	  schCompress(&sch, out, &schOffset, (nZeroFilled > 0)? SCH_INDEX_ZERO_FILLED: 0);
+      } else
+	out->buffer[MIR_SCH].used = 0; /* Discard the packed data */
       if (doDSMWrite) {
 #ifdef dadadaadada
 	int dSMStatus, ii, jj, kk;
@@ -4379,28 +6001,19 @@ void *writer(void *arg)
 	}
 	*/
       } /* End of if (doDSMWrite) */
-      if (store)
-	for (rx = 0; rx < MAX_RX; rx++)
-	  if (receiverActive[rx] && (!((rx != doubleBandwidthRx) && doubleBandwidth)))
-	    fflush_unlocked(plotFile[rx]);
-      fflush_unlocked(baselineFile);
-      fflush_unlocked(weFile);
-      fflush_unlocked(tsysFile);
-      fflush_unlocked(codesFile);
-      fflush_unlocked(engFile);
-      fflush_unlocked(inFile);
-      fflush_unlocked(spFile);
-      fflush_unlocked(schFile);
+      /* Hand the scan's records to the MIR_IO thread */
+      nextOutput = (nextOutput + 1) % OUTPUT_RING_SIZE;
+      sem_post(&outputReadySem);
+      statsCount(COUNT_SCANS_WRITTEN, 1);
       writeAutoData(globalScanNumber);
     } else /* End of if (lowestAntennaNumber > 0) */
       fprintf(stderr, "writer: No active antennas in scan - will not write anything\n");
     tempScanNumber = globalScanNumber++;
-    deleteScan(&scanCopy, FALSE);
-    needWrite = FALSE;
-    pthread_mutex_unlock(&writeScanMutex);
+    releaseScan(writingScan);
     clock_gettime(CLOCK_REALTIME, &stopTime);
     stopTimeDouble = ((double)stopTime.tv_sec) + ((double)stopTime.tv_nsec)*1.0e-9;
     thisTime = stopTimeDouble-startTimeDouble;
+    statsRecord(STAGE_SCAN_WRITE, thisTime);
     if (thisTime > maxTime)
       maxTime = thisTime;
     if (thisTime < minTime)
@@ -4417,14 +6030,15 @@ void *writer(void *arg)
   R E A D  C O N F I G  F I L E S
 
   readConfigFiles reads the files used to establish the state of the server.
-  At this moment, the only configuration file is the one which specifies
+  At this moment, there are two configuration files.   One specifies
   which chunks should be ignored when calculating the pseudo-continuum
-  channel.
+  channel, and CONFIG_FILE holds general options such as which backend
+  should be used to write the MIR files.
 */
 void readConfigFiles(void)
 {
   int rx, ant1, ant2, chunk, line;
-  FILE *badChunks;
+  FILE *badChunks, *config;
 
   for (rx = 0; rx < MAX_RX+1; rx++)
     for (ant1 = 0; ant1 < MAX_ANT+1; ant1++)
@@ -4474,9 +6088,96 @@ void readConfigFiles(void)
     }
     fclose(badChunks);
   }
-} /* End of readConfigFiles */
 
-/*
+  /*
+    CONFIG_FILE holds "keyword value" lines setting dataCatcher options.
+    Lines starting with # are comments.
+  */
+  config = fopen(CONFIG_FILE, "r");
+  if (config == NULL)
+    fprintf(stderr, "readConfigFiles: no %s file seen - using default options\n", CONFIG_FILE);
+  else {
+    char inLine[200], keyword[100], value[100];
+
+    line = 1;
+    while (fgets(inLine, sizeof(inLine), config) != NULL) {
+      if ((inLine[0] != '#') && (sscanf(inLine, "%99s %99s", keyword, value) == 2)) {
+	if (!strcmp(keyword, "mirOutput")) {
+	  if (!strcmp(value, "stdio"))
+	    mirOutputMode = MIR_OUTPUT_STDIO;
+	  else if (!strcmp(value, "preallocated"))
+	    mirOutputMode = MIR_OUTPUT_PREALLOCATED;
+	  else
+	    fprintf(stderr, "readConfigFiles: Unknown mirOutput \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	} else if (!strcmp(keyword, "schFormat")) {
+	  if (!strcmp(value, "compressed"))
+	    schCompression = TRUE;
+	  else if (!strcmp(value, "plain"))
+	    schCompression = FALSE;
+	  else
+	    fprintf(stderr, "readConfigFiles: Unknown schFormat \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	} else if (!strcmp(keyword, "headerPrefetch")) {
+	  if (!strcmp(value, "on"))
+	    headerPrefetch = TRUE;
+	  else if (!strcmp(value, "off"))
+	    headerPrefetch = FALSE;
+	  else
+	    fprintf(stderr, "readConfigFiles: Unknown headerPrefetch \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	} else if (!strcmp(keyword, "headerPrefetchLead")) {
+	  if ((sscanf(value, "%lf", &headerPrefetchLead) != 1) || (headerPrefetchLead < 0.0)) {
+	    fprintf(stderr, "readConfigFiles: Illegal headerPrefetchLead \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	    headerPrefetchLead = HEADER_PREFETCH_LEAD;
+	  }
+	} else if (!strcmp(keyword, "swarmStreamPort")) {
+	  if ((sscanf(value, "%d", &swarmStreamPort) != 1) || (swarmStreamPort < 0) ||
+	      (swarmStreamPort > 65535)) {
+	    fprintf(stderr, "readConfigFiles: Illegal swarmStreamPort \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	    swarmStreamPort = SWARM_STREAM_PORT;
+	  }
+	} else if (!strcmp(keyword, "pseudoContinuumThreads")) {
+	  if ((sscanf(value, "%d", &pCWorkers) != 1) || (pCWorkers < 0) ||
+	      (pCWorkers > MAX_PC_WORKERS)) {
+	    fprintf(stderr, "readConfigFiles: Illegal pseudoContinuumThreads \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	    pCWorkers = PC_WORKERS;
+	  }
+	} else if (!strcmp(keyword, "swarmScanDeadline")) {
+	  if ((sscanf(value, "%lf", &swarmScanDeadline) != 1) || (swarmScanDeadline < 0.0)) {
+	    fprintf(stderr, "readConfigFiles: Illegal swarmScanDeadline \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	    swarmScanDeadline = SWARM_SCAN_DEADLINE;
+	  }
+	} else if (!strcmp(keyword, "captureFile")) {
+	  strcpy(captureFileName, value);
+	} else if (!strcmp(keyword, "schOutput")) {
+	  if (!strcmp(value, "direct"))
+	    schDirectIO = TRUE;
+	  else if (!strcmp(value, "buffered"))
+	    schDirectIO = FALSE;
+	  else
+	    fprintf(stderr, "readConfigFiles: Unknown schOutput \"%s\" on line %d of %s\n",
+		    value, line, CONFIG_FILE);
+	} else
+	  fprintf(stderr, "readConfigFiles: Unknown keyword \"%s\" on line %d of %s\n",
+		  keyword, line, CONFIG_FILE);
+      }
+      line++;
+    }
+    fclose(config);
+  }
+  dprintf("readConfigFiles:\tmirOutput = %s, schOutput = %s, schFormat = %s, headerPrefetch = %s (%f s), swarmScanDeadline = %f s, pseudoContinuumThreads = %d, captureFile = %s\n",
+	  (mirOutputMode == MIR_OUTPUT_STDIO)? "stdio": "preallocated",
+	  schDirectIO? "direct": "buffered", schCompression? "compressed": "plain",
+	  headerPrefetch? "on": "off", headerPrefetchLead, swarmScanDeadline, pCWorkers,
+	  (captureFileName[0] != (char)0)? captureFileName: "none");
+} /* End of readConfigFiles */
+
+/*
 
   S I G N A L  H A N D L E R
 
@@ -4554,6 +6255,19 @@ void startThreads(void)
     */
 
     readConfigFiles();
+    statsInit();
+    dprintf("packData: using %s\n", packDataVersion());
+
+    if ((sem_init(&needHeaderSem, 0, 0) == ERROR) ||
+	(sem_init(&writeScanSem, 0, 0) == ERROR) ||
+	(sem_init(&outputFreeSem, 0, OUTPUT_RING_SIZE) == ERROR) ||
+	(sem_init(&outputReadySem, 0, 0) == ERROR) ||
+	(sem_init(&sWARMHandoffSem, 0, 0) == ERROR) ||
+	(sem_init(&pCStartSem, 0, 0) == ERROR) ||
+	(sem_init(&pCDoneSem, 0, 0) == ERROR)) {
+      perror("startThreads: sem_init");
+      exit(ERROR);
+    }
     
     /*   C R E A T E   T H R E A D S   */
 
@@ -4582,6 +6296,26 @@ void startThreads(void)
       fprintf(stderr, "thread create failure\n");
     }
     
+    /*   P S E U D O - C O N T I N U U M   H E L P E R   T H R E A D S   */
+    fifo_param.sched_priority = PC_WORKER_PRIORITY;
+    pthread_attr_setschedparam(&attr, &fifo_param);
+    for (pCWorkersStarted = 0; pCWorkersStarted < pCWorkers; pCWorkersStarted++)
+      if (pthread_create(&pCWorkerTId[pCWorkersStarted], &attr, pCWorker,
+			 (void *) 12) == ERROR) {
+	perror("catch_visibilities_1: pthread_create pCWorker");
+	fprintf(stderr, "thread create failure\n");
+	break;
+      }
+
+    /*   M I R  I O   T H R E A D   */
+    fifo_param.sched_priority = MIR_IO_PRIORITY;
+    pthread_attr_setschedparam(&attr, &fifo_param);
+    if (pthread_create(&mirIOTId, &attr, mirIO,
+		       (void *) 12) == ERROR) {
+      perror("catch_visibilities_1: pthread_create mirIO");
+      fprintf(stderr, "thread create failure\n");
+    }
+    
     /*   C O P I E R   T H R E A D   */
     fifo_param.sched_priority = COPIER_PRIORITY;
     pthread_attr_setschedparam(&attr, &fifo_param);
@@ -4591,6 +6325,26 @@ void startThreads(void)
       fprintf(stderr, "thread create failure\n");
     }
 
+    /*   S W A R M  H A N D O F F   T H R E A D   */
+    fifo_param.sched_priority = SWARM_HANDOFF_PRIORITY;
+    pthread_attr_setschedparam(&attr, &fifo_param);
+    if (pthread_create(&sWARMHandoffTId, &attr, sWARMHandoff,
+		       (void *) 12) == ERROR) {
+      perror("catch_visibilities_1: pthread_create sWARMHandoff");
+      fprintf(stderr, "thread create failure\n");
+    }
+
+    /*   S W A R M  S T R E A M   T H R E A D   */
+    if (swarmStreamPort > 0) {
+      fifo_param.sched_priority = SWARM_STREAM_PRIORITY;
+      pthread_attr_setschedparam(&attr, &fifo_param);
+      if (pthread_create(&sWARMStreamTId, &attr, sWARMStream,
+			 (void *) 12) == ERROR) {
+	perror("catch_visibilities_1: pthread_create sWARMStream");
+	fprintf(stderr, "thread create failure\n");
+      }
+    }
+
     /*   E S T A B L I S H   S I G N A L   H A N D L E R  */
     action.sa_flags = 0;
     sigemptyset(&action.sa_mask);
@@ -4638,7 +6392,10 @@ dStatusStructure *catch_visibilities_1(dCrateUVBlock *bundle, CLIENT *cl)
   }
   */
   fflush(stdout);
-  processBundle(bundle);
+  pthread_mutex_lock(&serverMutex);
+  captureRecord(DC_CAPTURE_BUNDLE, bundle);
+  processBundle(bundle, NULL);
+  pthread_mutex_unlock(&serverMutex);
   return(result);
 } /* End of catch_visibilities_1 */
 
@@ -4779,80 +6536,49 @@ dStatusStructure *catch_powers_1_svc(dPowerSet *powerSet, struct svc_req *dummy)
   return result2;
 } /* End of catch_powers_1_svc */
 
-typedef struct sWARMChunk {
-  int filled;
-  float lSBReal[N_SWARM_CHUNK_POINTS];
-  float lSBImag[N_SWARM_CHUNK_POINTS];
-  float uSBReal[N_SWARM_CHUNK_POINTS];
-  float uSBImag[N_SWARM_CHUNK_POINTS];
-} sWARMChunk;
-
-typedef struct sWARMSScan {
-  double uT;
-  double duration;
-  sWARMChunk *data[9][9][2];
-} sWARMScan;
-
-void destroySWARMScan(sWARMScan *scan) {
-  int a1, a2, ch;
-
-  for (a1 = 1; a1 < 8; a1++)
-    for (a2 = a1+1; a2 <= 8; a2++)
-      for (ch = 0; ch < 2; ch++)
-	if (scan->data[a1][a2][ch])
-	  free(scan->data[a1][a2][ch]);
-  free(scan);
-}
-
-dCrateUVBlock *sWARMBundle;
-
 /*
   S W A R M  2  B U N D L E
 
    This routine makes a bundle structure with the format of data from the legacy correlator,
 and sends it to processBundle().   At that point there should be nothing structually unique
 about the SWARM correlator data.
+   The bundle is only a view of the sWARMScan - its spectra point straight into the
+sWARMScan's chunks, which processBundle hands over to the scan slot, so the SWARM
+data are not copied again on their way to the WRITER thread.   Returns processBundle's
+return code.   If that is not OK, the sWARMScan is still the caller's.
 
  */
-void sWARM2Bundle(sWARMScan *scan) {
-  int a1, a2, set, ch, sb, i;
+int sWARM2Bundle(sWARMScan *scan) {
+  int a1, a2, set, ch, rCode;
   int nBaselines = 0;
-  static int firstCall = TRUE;
+  static dCrateUVBlock sWARMBundle;
+  static dVisibilitySet sWARMSets[MAX_SWARM_SETS];
+  static dVarArray sWARMReal[MAX_SWARM_SETS][2], sWARMImag[MAX_SWARM_SETS][2];
   dVisibilitySet *vis;
+  sWARMChunk *data;
 
-  printf("I'm in sWARM2Bundle\n");
-  if (firstCall) {
-    sWARMBundle = (dCrateUVBlock *)malloc(sizeof(*sWARMBundle));
-    if (sWARMBundle == NULL) {
-      perror("malloc of sWARMBundle");
-      exit(ERROR);
-    }
-    firstCall = FALSE;
-  }
+  dprintf("I'm in sWARM2Bundle\n");
   for (a1 = 1; a1 < 8; a1++)
     for (a2 = a1+1; a2 <= 8; a2++)
       if (scan->data[a1][a2][0])
 	nBaselines++;
-  sprintf(sWARMBundle->sourceName, "SWARM Data");
-  sWARMBundle->crateNumber = SWARM_CRATE;
-  sWARMBundle->blockNumber = SWARM_BLOCK;
-  sWARMBundle->scanType    = 1;
-  sWARMBundle->UTCtime     = scan->uT;
-  sWARMBundle->intTime     = scan->duration;
-  if (sWARMBundle->intTime <= 0.0)
-    sWARMBundle->intTime = 29.6827667;
-  sWARMBundle->set.set_len = 2*nBaselines;
-  sWARMBundle->set.set_val = (dVisibilitySet *)malloc(sWARMBundle->set.set_len*sizeof(dVisibilitySet));
-  if (sWARMBundle->set.set_val == NULL) {
-    perror("malloc of SWARM sWARMBundle->set.set_val");
-    exit(ERROR);
-  }
+  sprintf(sWARMBundle.sourceName, "SWARM Data");
+  sWARMBundle.crateNumber = SWARM_CRATE;
+  sWARMBundle.blockNumber = SWARM_BLOCK;
+  sWARMBundle.scanType    = 1;
+  sWARMBundle.UTCtime     = scan->uT;
+  sWARMBundle.intTime     = scan->duration;
+  if (sWARMBundle.intTime <= 0.0)
+    sWARMBundle.intTime = 29.6827667;
+  sWARMBundle.set.set_len = 2*nBaselines;
+  sWARMBundle.set.set_val = &sWARMSets[0];
   set = 0;
   for (a1 = 1; a1 < 8; a1++)
     for (a2 = a1+1; a2 <= 8; a2++)
       if (scan->data[a1][a2][0]) {
 	for (ch = 0; ch < 2; ch++) {
-	  vis = &sWARMBundle->set.set_val[set];
+	  vis = &sWARMSets[set];
+	  data = scan->data[a1][a2][ch];
 	  vis->nPoints = N_SWARM_CHUNK_POINTS;
 	  vis->lags.channel.channel_len = 0;
 	  vis->lags.channel.channel_val = NULL;
@@ -4862,126 +6588,314 @@ void sWARM2Bundle(sWARMScan *scan) {
 	  vis->antennaNumber[1] = a1;
 	  vis->antennaNumber[2] = a2;
 	  vis->real.real_len = 2;
-	  vis->real.real_val = (dVarArray *)malloc(2*sizeof(dVarArray));
-	  if (vis->real.real_val == NULL) {
-	    perror("vis->real.real_val");
-	    exit(-1);
-	  }
+	  vis->real.real_val = &sWARMReal[set][0];
 	  vis->imag.imag_len = 2;
-	  vis->imag.imag_val = (dVarArray *)malloc(2*sizeof(dVarArray));
-	  if (vis->imag.imag_val == NULL) {
-	    perror("vis->imag.imag_val");
-	    exit(-1);
-	  }	  
-	  for (sb = 0; sb < 2; sb++) {
-	    vis->real.real_val[sb].channel.channel_len = N_SWARM_CHUNK_POINTS;
-	    vis->real.real_val[sb].channel.channel_val = (float *)malloc(N_SWARM_CHUNK_POINTS*sizeof(float));
-	    if (vis->real.real_val[sb].channel.channel_val == NULL) {
-	      perror("vis->real.real_val[sb].channel.channel_val");
-	      exit(-1);
-	    }
-	    vis->imag.imag_val[sb].channel.channel_len = N_SWARM_CHUNK_POINTS;
-	    vis->imag.imag_val[sb].channel.channel_val = (float *)malloc(N_SWARM_CHUNK_POINTS*sizeof(float));
-	    if (vis->imag.imag_val[sb].channel.channel_val == NULL) {
-	      perror("vis->imag.imag_val[sb].channel.channel_val");
-	      exit(-1);
-	    }
-	    /* Copy over the actual data */
-	    for (i = 0; i < N_SWARM_CHUNK_POINTS; i++) {
-	      if (sb == 0) {
-		vis->real.real_val[sb].channel.channel_val[i] =
-		  scan->data[vis->antennaNumber[1]][vis->antennaNumber[2]][ch]->lSBReal[i];
-		vis->imag.imag_val[sb].channel.channel_val[i] =
-		  scan->data[vis->antennaNumber[1]][vis->antennaNumber[2]][ch]->lSBImag[i];
-	      } else {
-		vis->real.real_val[sb].channel.channel_val[i] =
-		  scan->data[vis->antennaNumber[1]][vis->antennaNumber[2]][ch]->uSBReal[i];
-		vis->imag.imag_val[sb].channel.channel_val[i] =
-		  scan->data[vis->antennaNumber[1]][vis->antennaNumber[2]][ch]->uSBImag[i];
-	      }
-	    }
-	  }
+	  vis->imag.imag_val = &sWARMImag[set][0];
+	  /* Sideband 0 is the LSB, sideband 1 the USB */
+	  sWARMReal[set][0].channel.channel_len = N_SWARM_CHUNK_POINTS;
+	  sWARMReal[set][0].channel.channel_val = data->lSBReal;
+	  sWARMImag[set][0].channel.channel_len = N_SWARM_CHUNK_POINTS;
+	  sWARMImag[set][0].channel.channel_val = data->lSBImag;
+	  sWARMReal[set][1].channel.channel_len = N_SWARM_CHUNK_POINTS;
+	  sWARMReal[set][1].channel.channel_val = data->uSBReal;
+	  sWARMImag[set][1].channel.channel_len = N_SWARM_CHUNK_POINTS;
+	  sWARMImag[set][1].channel.channel_val = data->uSBImag;
 	  set++;
 	}
       }
-  /* printBundleInfo(sWARMBundle); */
-  printf("Calling processBundle(sWARMBundle)\n");
-  processBundle(sWARMBundle);
-  printf("Returned from processBundle(sWARMBundle)\n");
+  /* printBundleInfo(&sWARMBundle); */
+  dprintf("Calling processBundle(sWARMBundle)\n");
+  rCode = processBundle(&sWARMBundle, scan);
+  dprintf("Returned from processBundle(sWARMBundle)\n");
+  return(rCode);
+} /* End of sWARM2Bundle */
 
-  /* Now clean up all the malloc'd storage, except what never changes.  */
-  set = 0;
-  for (a1 = 1; a1 < 8; a1++)
-    for (a2 = a1+1; a2 <= 8; a2++)
-      if (scan->data[a1][a2][0]) {
-	for (ch = 0; ch < 2; ch++) {
-	  vis = &sWARMBundle->set.set_val[set];
-	  for (sb = 0; sb < 2; sb++) {
-	    free(vis->real.real_val[sb].channel.channel_val);
-	    free(vis->imag.imag_val[sb].channel.channel_val);
+/*
+  S W A R M  S C A N  Q U E U E
+
+  sWARMScanQueue takes a scan out of the ring, complete or not, and
+  queues it for the SWARM_HANDOFF thread.   Every chunk which never
+  arrived is zeroed, which is how an empty spectrum is recognized when
+  it is packed (packData returns -1), and is noted in the scan's missing
+  mask, so that the WRITER thread leaves it out of the pseudo-continuum
+  and flags its spectra.   The missing chunks are also listed on stderr.
+  The caller must hold sWARMMutex.
+*/
+void sWARMScanQueue(int slot)
+{
+  int ant1, ant2, chunk, nMissing;
+  unsigned long long missing;
+  sWARMScan *scan;
+  sWARMChunk *data;
+
+  scan = sWARMRing[slot];
+  __atomic_store_n(&sWARMRing[slot], NULL, __ATOMIC_RELEASE);
+  missing = scan->expected & ~scan->received;
+  scan->missing = missing;
+  if (missing != 0) {
+    nMissing = 0;
+    for (ant1 = 1; ant1 < 8; ant1++)
+      for (ant2 = ant1+1; ant2 <= 8; ant2++)
+	for (chunk = 0; chunk < 2; chunk++)
+	  if (missing & SWARM_CHUNK_BIT(ant1, ant2, chunk)) {
+	    data = scan->data[ant1][ant2][chunk];
+	    memset(data, 0, sizeof(sWARMChunk));
+	    if (nMissing == 0)
+	      fprintf(stderr, "SWARM scan at UT %f is incomplete - %d-%d:%d",
+		      scan->uT, ant1, ant2, chunk);
+	    else
+	      fprintf(stderr, ", %d-%d:%d", ant1, ant2, chunk);
+	    nMissing++;
 	  }
-	  free(vis->real.real_val);
-	  free(vis->imag.imag_val);
-	  set++;
-	}
-      }
-  free(sWARMBundle->set.set_val);
-}
+    fprintf(stderr, " flagged as missing\n");
+    statsCount(COUNT_SWARM_PARTIAL_SCANS, 1);
+  }
+  sWARMLastUT = scan->uT;
+  scan->next = NULL;
+  if (sWARMHandoffTail == NULL)
+    sWARMHandoffHead = scan;
+  else
+    sWARMHandoffTail->next = scan;
+  sWARMHandoffTail = scan;
+  sem_post(&sWARMHandoffSem);
+} /* End of sWARMScanQueue */
 
 /*
-  C A T C H _ S W A R M _ D A T A _ 1
+  S W A R M  R I N G  A D V A N C E
+
+  processBundle gives SWARM data to the oldest scan waiting for it, so
+  SWARM scans must be passed on in time order.   sWARMRingAdvance queues
+  the oldest scan in the ring for as long as it is complete, or no later
+  than through (use a negative time to only pass on complete scans).
+  A scan which completes while an older one is still missing data
+  waits in the ring until the older one has gone.
+  The caller must hold sWARMMutex.
+*/
+void sWARMRingAdvance(double through)
+{
+  int slot, oldest;
 
-  The following routine receives the data packages from the SWARM
-  correlator.
+  while (TRUE) {
+    oldest = -1;
+    for (slot = 0; slot < SWARM_IN_FLIGHT; slot++)
+      if ((sWARMRing[slot] != NULL) &&
+	  ((oldest < 0) || (sWARMRing[slot]->uT < sWARMRing[oldest]->uT)))
+	oldest = slot;
+    if ((oldest < 0) ||
+	((sWARMRing[oldest]->outstanding > 0) && (sWARMRing[oldest]->uT > through)))
+      break;
+    sWARMScanQueue(oldest);
+  }
+} /* End of sWARMRingAdvance */
 
- */
-dStatusStructure *catch_swarm_data_1(dSWARMUVBlock *data, CLIENT *cl)
+/*
+  S W A R M  S C A N  F I N D
+
+  Returns the scan in the ring which is collecting data taken at uT,
+  starting a new one, integrated for duration seconds, if there is none.   If the ring is full, the
+  oldest scans are passed on, incomplete, to make room.
+  The caller must hold sWARMMutex.
+*/
+sWARMScan *sWARMScanFind(double uT, double duration, double now)
 {
-  int i, ant1, ant2, chunk, nChannels;
-  int missingA1 = 0, missingA2 = 0, missingCh = 0;
-  int dataStillMissing = FALSE;
-  static int nANPattern[8];
-  static int gotSomeNANs = FALSE;
-  double uT, duration;
-  static int firstCall = TRUE;
-  static int shouldInit = TRUE;
-  static sWARMScan *scan;
+  int slot, empty;
+  double oldestUT, deadline;
+  sWARMScan *scan;
+
+  empty = -1;
+  oldestUT = 1.0e30;
+  for (slot = 0; slot < SWARM_IN_FLIGHT; slot++)
+    if (sWARMRing[slot] == NULL)
+      empty = slot;
+    else if (fabs(sWARMRing[slot]->uT - uT) <= MIDPOINT_SLOP)
+      return(sWARMRing[slot]);
+    else if (sWARMRing[slot]->uT < oldestUT)
+      oldestUT = sWARMRing[slot]->uT;
+  if (empty < 0) {
+    fprintf(stderr, "SWARM data for UT %f arrived with %d SWARM scans unfinished\n",
+	    uT, SWARM_IN_FLIGHT);
+    sWARMRingAdvance(oldestUT);
+    for (slot = 0; slot < SWARM_IN_FLIGHT; slot++)
+      if (sWARMRing[slot] == NULL)
+	empty = slot;
+  }
+  scan = sWARMScanClaim();
+  scan->uT = uT;
+  scan->duration = duration;
+  if (swarmScanDeadline > 0.0) {
+    deadline = now + swarmScanDeadline;
+    __atomic_store(&(scan->deadline), &deadline, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&sWARMRing[empty], scan, __ATOMIC_RELEASE);
+  return(scan);
+} /* End of sWARMScanFind */
 
-  startThreads();
-  if (firstCall) {
-    result3 = (dStatusStructure *)malloc(sizeof(*result3));
-    if (result3 == NULL) {
-      perror("malloc of result3");
-      exit(-1);
+/*
+  S W A R M  H A N D O F F
+
+  Thread which passes completed SWARM scans on to processBundle, so that
+  the threads receiving SWARM data never wait for that.   sWARMMutex is
+  only held while a scan is taken off the handoff queue, and serverMutex
+  only while processBundle has it, when this thread is acting as the
+  SERVER thread.
+*/
+void *sWARMHandoff(void *arg)
+{
+  int rCode;
+  sWARMScan *scan;
+
+  printf("Thread SWARM_HANDOFF starting\n");
+  while (TRUE) {
+    sem_wait(&sWARMHandoffSem);
+    pthread_mutex_lock(&sWARMMutex);
+    scan = sWARMHandoffHead;
+    sWARMHandoffHead = scan->next;
+    if (sWARMHandoffHead == NULL)
+      sWARMHandoffTail = NULL;
+    pthread_mutex_unlock(&sWARMMutex);
+    pthread_mutex_lock(&serverMutex);
+    rCode = sWARM2Bundle(scan);
+    pthread_mutex_unlock(&serverMutex);
+    if (rCode != OK) {
+      pthread_mutex_lock(&sWARMMutex);
+      sWARMScanRelease(scan);
+      pthread_mutex_unlock(&sWARMMutex);
     }
-    firstCall = FALSE;
   }
+} /* End of sWARMHandoff */
+
+/*
+  S W A R M  R E P A I R  N A N S
+
+  A SWARM correlator board that is misbehaving sends NaNs for some of the
+  eight 8-channel groups in every 64-channel block of a spectrum, always in
+  the same groups.   sWARMRepairNANs finds that pattern from the first
+  block of the spectrum it is handed (so each baseline is judged on its own
+  data), and replaces every bad channel by the mean of the good channels in
+  its block.   nComponents is 1 for an autocorrelation (uSB is then NULL)
+  and 2 for interleaved real/imaginary cross correlations; both sidebands
+  are averaged in the same pass over the block.   The number of channels
+  repaired in each sideband is returned.
+*/
+#define SWARM_NAN_BLOCK   (64)  /* Channels in one NaN pattern repeat    */
+#define SWARM_NAN_GROUP    (8)  /* Channels which go bad together        */
+#define SWARM_NAN_GROUPS   (SWARM_NAN_BLOCK/SWARM_NAN_GROUP)
+
+int sWARMRepairNANs(int nComponents, float *lSB, float *uSB)
+{
+  int i, g, k, nBad, nGood, groupFloats, blockFloats;
+  int good[SWARM_NAN_GROUPS];
+  float *lBlock, *uBlock;
+  char patternString[SWARM_NAN_GROUPS+1];
+
+  groupFloats = SWARM_NAN_GROUP*nComponents;
+  blockFloats = SWARM_NAN_BLOCK*nComponents;
+  nBad = 0;
+  for (g = 0; g < SWARM_NAN_GROUPS; g++) {
+    good[g] = !(isnan(lSB[g*groupFloats]) || ((uSB != NULL) && isnan(uSB[g*groupFloats])));
+    if (!good[g])
+      nBad++;
+    patternString[g] = good[g]? 'D': 'N';
+  }
+  if (nBad == 0)
+    return(0);
+  patternString[SWARM_NAN_GROUPS] = (char)0;
+  dprintf("NAN pattern is %s\n", patternString);
+  nGood = SWARM_NAN_GROUPS - nBad;
+  if (nGood == 0) {
+    dprintf("Every SWARM channel is a NaN - nothing to average\n");
+    return(0);
+  }
+  for (i = 0; i < N_SWARM_CHUNK_POINTS/SWARM_NAN_BLOCK; i++) {
+    lBlock = &lSB[i*blockFloats];
+    uBlock = (uSB != NULL)? &uSB[i*blockFloats]: NULL;
+#ifdef PACK_DATA_VECTORIZED
+    {
+      __m128 lAcc, uAcc, lMean, uMean, count;
+
+      /* Four floats at a time: (re, im, re, im) for crosses */
+      lAcc = uAcc = _mm_setzero_ps();
+      for (g = 0; g < SWARM_NAN_GROUPS; g++)
+	if (good[g])
+	  for (k = g*groupFloats; k < (g+1)*groupFloats; k += 4) {
+	    lAcc = _mm_add_ps(lAcc, _mm_loadu_ps(&lBlock[k]));
+	    if (uBlock != NULL)
+	      uAcc = _mm_add_ps(uAcc, _mm_loadu_ps(&uBlock[k]));
+	  }
+      /* Fold lanes 2,3 onto 0,1, and for autocorrelations lane 1 onto 0 */
+      lAcc = _mm_add_ps(lAcc, _mm_movehl_ps(lAcc, lAcc));
+      uAcc = _mm_add_ps(uAcc, _mm_movehl_ps(uAcc, uAcc));
+      if (nComponents == 1) {
+	lAcc = _mm_add_ps(lAcc, _mm_shuffle_ps(lAcc, lAcc, _MM_SHUFFLE(1, 1, 1, 1)));
+	lAcc = _mm_shuffle_ps(lAcc, lAcc, _MM_SHUFFLE(0, 0, 0, 0));
+      } else {
+	lAcc = _mm_shuffle_ps(lAcc, lAcc, _MM_SHUFFLE(1, 0, 1, 0));
+	uAcc = _mm_shuffle_ps(uAcc, uAcc, _MM_SHUFFLE(1, 0, 1, 0));
+      }
+      count = _mm_set1_ps((float)(nGood*SWARM_NAN_GROUP));
+      lMean = _mm_div_ps(lAcc, count);
+      uMean = _mm_div_ps(uAcc, count);
+      for (g = 0; g < SWARM_NAN_GROUPS; g++)
+	if (!good[g])
+	  for (k = g*groupFloats; k < (g+1)*groupFloats; k += 4) {
+	    _mm_storeu_ps(&lBlock[k], lMean);
+	    if (uBlock != NULL)
+	      _mm_storeu_ps(&uBlock[k], uMean);
+	  }
+    }
+#else
+    {
+      int c;
+      float lMean[2], uMean[2];
+
+      lMean[0] = lMean[1] = uMean[0] = uMean[1] = 0.0;
+      for (g = 0; g < SWARM_NAN_GROUPS; g++)
+	if (good[g])
+	  for (k = g*groupFloats; k < (g+1)*groupFloats; k++) {
+	    lMean[k % nComponents] += lBlock[k];
+	    if (uBlock != NULL)
+	      uMean[k % nComponents] += uBlock[k];
+	  }
+      for (c = 0; c < nComponents; c++) {
+	lMean[c] /= (float)(nGood*SWARM_NAN_GROUP);
+	uMean[c] /= (float)(nGood*SWARM_NAN_GROUP);
+      }
+      for (g = 0; g < SWARM_NAN_GROUPS; g++)
+	if (!good[g])
+	  for (k = g*groupFloats; k < (g+1)*groupFloats; k++) {
+	    lBlock[k] = lMean[k % nComponents];
+	    if (uBlock != NULL)
+	      uBlock[k] = uMean[k % nComponents];
+	  }
+    }
+#endif
+  }
+  return(nBad*SWARM_NAN_GROUP*(N_SWARM_CHUNK_POINTS/SWARM_NAN_BLOCK));
+} /* End of sWARMRepairNANs */
+
+/*
+  S W A R M  S T O R E  B L O C K
+
+  sWARMStoreBlock stores one baseline and chunk of SWARM data, however it
+  arrived, in the sWARMScan in the ring which is collecting data for its
+  time, and queues the scan for processBundle once it is complete.
+  Autocorrelations go onto the autocorrelation list instead.   The caller
+  must hold sWARMMutex.
+*/
+int sWARMStoreBlock(dSWARMUVBlock *data)
+{
+  int i, ant1, ant2, chunk, nChannels;
+  unsigned long long bit;
+  double uT, duration, startTime;
+  sWARMScan *scan;
+
+  startTime = statsNow();
+  statsCount(COUNT_SWARM_BLOCKS, 1);
+  captureRecord(DC_CAPTURE_SWARM, data);
   if (!antennaInArrayInitialized) {
     getAntennaList(&antennaInArray[0]);
     antennaInArrayInitialized = TRUE;
   }
-  if (shouldInit) {
-    scan = (sWARMScan *)malloc(sizeof(sWARMScan));
-    if (scan == NULL) {
-      perror("Malloc failed for SWARM scan\n");
-      exit(ERROR);
-    }
-    for (ant1 = 1; ant1 < 8; ant1++)
-      for (ant2 = ant1+1; ant2 <= 8; ant2++)
-	for (chunk = 0; chunk < 2; chunk++) {
-	  if (antennaInArray[ant1] && antennaInArray[ant2]) {
-	    scan->data[ant1][ant2][chunk] = (sWARMChunk *)malloc(sizeof(sWARMChunk));
-	    if (scan->data[ant1][ant2][chunk] == NULL) {
-	      perror("Malloc failed for SWARM chunk\n");
-	      exit(ERROR);
-	    }
-	    scan->data[ant1][ant2][chunk]->filled = FALSE;
-	  } else
-	    scan->data[ant1][ant2][chunk] = NULL;
-	}
-    scan->uT = -1.0;
-    shouldInit = FALSE;
-  }
   ant1       = data->ant1;
   ant2       = data->ant2;
   if (ant1 > ant2) {
@@ -4999,121 +6913,47 @@ dStatusStructure *catch_swarm_data_1(dSWARMUVBlock *data, CLIENT *cl)
   nChannels  = data->nChannels;
   uT         = data->uT;
   duration   = data->duration;
-  printf("I got %d points from %d-%d:%d taken at UT %f over %f seconds\n", nChannels, ant1, ant2, chunk, uT, duration);
+  dprintf("I got %d points from %d-%d:%d taken at UT %f over %f seconds\n", nChannels, ant1, ant2, chunk, uT, duration);
   if (antennaInArray[ant1] && antennaInArray[ant2]) {
     if (ant1 == ant2) {
       /* It's an autocorrelation */
-      sWARMAutoRec *newRec;
+      sWARMAutoTable *autoTable;
       
-      printf("Got an autocorrelation from antenna %d\n", ant1);
-      {
-	int i, j;
-	char sWARMNANPatternString[9];
-	
-	/* Derive the NAN pattern */
-	gotSomeNANs = FALSE;
-	for (i = 0; i < 8; i++)
-	  if (isnan(data->lSB[i*8])) {
-	    nANPattern[i] = FALSE;
-	    gotSomeNANs = TRUE;
-	  } else
-	    nANPattern[i] = TRUE;
-	for (i = 0; i < 8; i++)
-	  if (nANPattern[i])
-	    sWARMNANPatternString[i] = 'D';
-	  else
-	    sWARMNANPatternString[i] = 'N';
-	sWARMNANPatternString[8] = (char)0;
-	printf("NAN pattern is %s\n", sWARMNANPatternString);
-	if (gotSomeNANs) {
-	  /* Now replace the NANs with the average of the good channels */
-	  for (i = 0; i < 256; i++) {
-	    int nGoodData = 0;
-	    float goodDataSum = 0.0;
-	    
-	    for (j = 0; j < 64; j++)
-	      if (nANPattern[j/8]) {
-		goodDataSum += data->lSB[i*64 + j];
-		nGoodData++;
-	      }
-	    goodDataSum /= (float)nGoodData;
-	    for (j = 0; j < 64; j++)
-	      if (!nANPattern[j/8])
-		data->lSB[i*64 + j] = goodDataSum;
-	  }
-	}
-      }
-      newRec = (sWARMAutoRec *)malloc(sizeof(sWARMAutoRec));
-      if (newRec == NULL) {
-	perror("new SWARM autocorrelation record");
-	result3->rt_code = ERROR;
-	return(result3);
-      }
-      newRec->next = NULL;
-      newRec->autoData.antenna = ant1;
-      for (i = 0; i < N_SWARM_CHUNK_POINTS; i++)
-	newRec->autoData.amp[chunk][i] = data->lSB[i];
+      dprintf("Got an autocorrelation from antenna %d\n", ant1);
+      statsCount(COUNT_NAN_REPLACEMENTS, sWARMRepairNANs(1, data->lSB, NULL));
       pthread_mutex_lock(&autoMutex);
-      if (sWARMAutoRoot == NULL) {
-	sWARMAutoRoot = newRec;
-	newRec->last = NULL;
-      } else {
-	sWARMAutoRec *endRec;
-
-	endRec = sWARMAutoRoot;
-	while (endRec->next != NULL)
-	  endRec = endRec->next;
-	endRec->next = newRec;
-	newRec->last = endRec;
-      }
+      autoTable = &sWARMAutoTables[sWARMAutoFill];
+      if (autoTable->present[ant1] & (1 << chunk))
+	dprintf("Antenna %d chunk %d autocorrelation replaces one not yet written\n", ant1, chunk);
+      memcpy(autoTable->autoData[ant1].amp[chunk], data->lSB, N_SWARM_CHUNK_POINTS*sizeof(float));
+      autoTable->present[ant1] |= (1 << chunk);
       pthread_mutex_unlock(&autoMutex);
     } else {
       dprintf("OK, I need this baseline's data\n");
-      if (gotSomeNANs) {
-	int i, j;
-
-	/* Replace any NANs with the average of the nearby good values */
-	/* printf("___ Doing NAN replacement %d %d %d %d %d %d %d %d\n", */
-	/*        nANPattern[0],nANPattern[1],nANPattern[2],nANPattern[3],nANPattern[4],nANPattern[5],nANPattern[6],nANPattern[7] ); */
-	
-	for (i = 0; i < 256; i++) {
-	  int nGoodData = 0;
-	  float goodLSBReal, goodLSBImag, goodUSBReal, goodUSBImag;
-
-	  goodLSBReal = goodLSBImag = goodUSBReal = goodUSBImag = 0.0;
-	  for (j = 0; j < 64; j++)
-	    if (nANPattern[j/8]) {
-	      goodUSBReal += data->uSB[(i*64 + j)*2];
-	      goodUSBImag += data->uSB[(i*64 + j)*2 + 1];
-	      goodLSBReal += data->lSB[(i*64 + j)*2];
-	      goodLSBImag += data->lSB[(i*64 + j)*2 + 1];
-	      nGoodData++;
-	    }
-	  goodUSBReal /= (float)nGoodData;
-	  goodUSBImag /= (float)nGoodData;
-	  goodLSBReal /= (float)nGoodData;
-	  goodLSBImag /= (float)nGoodData;
-	  for (j = 0; j < 64; j++)
-	    if (!nANPattern[j/8]) {
-	      /* printf("\t___ ch %d, %d  %f %f %f %f\n", (i*64 + j)*2, (i*64 + j)*2 + 1, */
-	      /* 	     goodUSBReal, goodUSBImag, goodLSBReal, goodLSBImag); */
-	      data->uSB[(i*64 + j)*2]     = goodUSBReal;
-	      data->uSB[(i*64 + j)*2 + 1] = goodUSBImag;
-	      data->lSB[(i*64 + j)*2]     = goodLSBReal;
-	      data->lSB[(i*64 + j)*2 + 1] = goodLSBImag;
-	    }
+      statsCount(COUNT_NAN_REPLACEMENTS, sWARMRepairNANs(2, data->lSB, data->uSB));
+      if ((sWARMLastUT >= 0.0) && (uT <= sWARMLastUT + MIDPOINT_SLOP)) {
+	if (sWARMLastUT - uT <= SWARM_LATE_WINDOW) {
+	  fprintf(stderr, "Late SWARM data for %d-%d:%d, from a scan already passed on, discarded\n",
+		  ant1, ant2, chunk);
+	  statsCount(COUNT_SWARM_LATE_CHUNKS, 1);
+	  statsRecord(STAGE_SWARM_RECEIPT, statsNow()-startTime);
+	  return(OK);
 	}
+	/* UT has started again, so the scans in the ring can't be finished */
+	fprintf(stderr, "SWARM UT went back from %f to %f - starting again\n", sWARMLastUT, uT);
+	sWARMRingAdvance(1.0e30);
+	sWARMLastUT = -1.0;
       }
-      if (scan->uT == -1.0) {
-	scan->uT = uT;
-      } else {
-	if (fabs(scan->uT - uT) > 1.0)
-	  fprintf(stderr, "SWARM scan times differ by more than 1 second\n");
-      }
-      if (scan->data[ant1][ant2][chunk]->filled) {
-	fprintf(stderr, "Duplicate SWARM scan received - will abort\n");
-	result3->rt_code = ERROR;
-	return(result3);
+      scan = sWARMScanFind(uT, duration, startTime);
+      if (fabs(scan->duration - duration) > SWARM_DURATION_SLOP)
+	fprintf(stderr, "SWARM data for %d-%d:%d at UT %f integrated for %f seconds, not %f like the rest of its scan\n",
+		ant1, ant2, chunk, uT, duration, scan->duration);
+      bit = SWARM_CHUNK_BIT(ant1, ant2, chunk);
+      if (scan->received & bit) {
+	fprintf(stderr, "Duplicate SWARM data for %d-%d:%d received - ignored\n", ant1, ant2, chunk);
+	statsCount(COUNT_SWARM_DUPLICATES, 1);
+	statsRecord(STAGE_SWARM_RECEIPT, statsNow()-startTime);
+	return(OK);
       }
       for (i = 0; i < N_SWARM_CHUNK_POINTS; i++) {
 	scan->data[ant1][ant2][chunk]->lSBReal[i] = data->lSB[2*i];
@@ -5121,33 +6961,78 @@ dStatusStructure *catch_swarm_data_1(dSWARMUVBlock *data, CLIENT *cl)
 	scan->data[ant1][ant2][chunk]->uSBReal[i] = data->uSB[2*i];
 	scan->data[ant1][ant2][chunk]->uSBImag[i] = data->uSB[2*i + 1];
       }
-      scan->data[ant1][ant2][chunk]->filled = TRUE;
+      scan->received |= bit;
+      /* Now check to see if we have a complete SWARM scan yet */
+      if (__atomic_sub_fetch(&(scan->outstanding), 1, __ATOMIC_ACQ_REL) == 0) {
+	dprintf("I've got a complete SWARM scan to process\n");
+	sWARMRingAdvance(-1.0);
+      } else
+	dprintf("We're still missing %d chunks of SWARM data for this scan\n", scan->outstanding);
     }
   } else
-    printf("Discarding unneeded %d-%d baseline data\n", ant1, ant2);
-  /* Now check to see if we have a complete SWARM scan yet */
-  for (ant1 = 1; ant1 < 8; ant1++)
-    for (ant2 = ant1+1; ant2 <= 8; ant2++)
-      for (chunk = 0; chunk < 2; chunk++)
-	if (scan->data[ant1][ant2][chunk])
-	  if (!scan->data[ant1][ant2][chunk]->filled) {
-	    if (!dataStillMissing) {
-	      missingA1 = ant1;
-	      missingA2 = ant2;
-	      missingCh = chunk;
-	      dataStillMissing = TRUE;
-	    }
-	  }
-  if (dataStillMissing) {
-    dprintf("We're still missing some SWARM data for this scan (%d-%d: %d)\n",
-	   missingA1, missingA2, missingCh);
-  } else {
-    printf("w00t - I've got a complete SWARM scan to process\n");
-    sWARM2Bundle(scan);
-    destroySWARMScan(scan);
-    shouldInit = TRUE;
+    dprintf("Discarding unneeded %d-%d baseline data\n", ant1, ant2);
+  statsRecord(STAGE_SWARM_RECEIPT, statsNow()-startTime);
+  return(OK);
+} /* End of sWARMStoreBlock */
+
+/*
+  S W A R M  S C A N  D E A D L I N E  C H E C K
+
+  Called about once a second by the COPIER thread.   If a SWARM scan
+  being collected has passed its deadline (a ROACH2 has probably stopped
+  sending), it is passed on with its missing chunks flagged, along with
+  any older ones.   The deadlines are looked at without sWARMMutex, so
+  the threads receiving SWARM data are only disturbed when there is
+  something to do.
+*/
+void sWARMScanDeadlineCheck(void)
+{
+  int slot;
+  sWARMScan *scan;
+  double deadline;
+
+  for (slot = 0; slot < SWARM_IN_FLIGHT; slot++) {
+    scan = __atomic_load_n(&sWARMRing[slot], __ATOMIC_ACQUIRE);
+    if (scan == NULL)
+      continue;
+    __atomic_load(&(scan->deadline), &deadline, __ATOMIC_ACQUIRE);
+    if ((deadline <= 0.0) || (statsNow() < deadline) ||
+	(__atomic_load_n(&(scan->outstanding), __ATOMIC_ACQUIRE) == 0))
+      continue;
+    pthread_mutex_lock(&sWARMMutex);
+    if ((sWARMRing[slot] == scan) && (scan->outstanding > 0) && (scan->deadline > 0.0) &&
+	(statsNow() >= scan->deadline)) {
+      fprintf(stderr, "Gave up waiting for the rest of the SWARM scan at UT %f\n", scan->uT);
+      sWARMRingAdvance(scan->uT);
+    }
+    pthread_mutex_unlock(&sWARMMutex);
+  }
+} /* End of sWARMScanDeadlineCheck */
+
+/*
+  C A T C H _ S W A R M _ D A T A _ 1
+
+  The following routine receives the data packages from the SWARM
+  correlator, one baseline and chunk per call.   See also sWARMStream,
+  which accepts them in batches.
+
+ */
+dStatusStructure *catch_swarm_data_1(dSWARMUVBlock *data, CLIENT *cl)
+{
+  static int firstCall = TRUE;
+
+  startThreads();
+  if (firstCall) {
+    result3 = (dStatusStructure *)malloc(sizeof(*result3));
+    if (result3 == NULL) {
+      perror("malloc of result3");
+      exit(-1);
+    }
+    firstCall = FALSE;
   }
-  result3->rt_code = OK;
+  pthread_mutex_lock(&sWARMMutex);
+  result3->rt_code = sWARMStoreBlock(data);
+  pthread_mutex_unlock(&sWARMMutex);
   return(result3);
 } /* End of catch_swarm_data_1 */
 
@@ -5165,3 +7050,512 @@ dStatusStructure *catch_swarm_data_1_svc(dSWARMUVBlock *data, struct svc_req *du
   return result3;
 } /* End of catch_swarm_data_1_svc */
 
+/*
+  S T R E A M  R E A D
+
+  Reads exactly nBytes from a socket.   Returns OK, or ERROR if the
+  connection was closed or broken first, or the socket's receive
+  timeout expired.
+*/
+int streamRead(int fd, void *buffer, size_t nBytes)
+{
+  ssize_t nRead;
+  char *next = (char *)buffer;
+
+  while (nBytes > 0) {
+    nRead = recv(fd, next, nBytes, MSG_WAITALL);
+    if (nRead < 0) {
+      if (errno == EINTR)
+	continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+	fprintf(stderr, "streamRead: frame stalled for %d seconds\n", SWARM_STREAM_TIMEOUT);
+	return(ERROR);
+      }
+      perror("streamRead: recv");
+      return(ERROR);
+    } else if (nRead == 0)
+      return(ERROR);
+    next += nRead;
+    nBytes -= nRead;
+  }
+  return(OK);
+} /* End of streamRead */
+
+/*
+  S W A R M  S T R E A M  F R A M E
+
+  Reads one frame of batched SWARM data (see swarmStream.h) and stores
+  each record with sWARMStoreBlock.   Each record's spectra are read
+  straight into the block which sWARMStoreBlock takes apart, and
+  sWARMMutex is only held while a record is being stored, so RPC
+  calls are not held up by the network.   Returns the number of
+  records stored, or ERROR if the connection should be dropped.
+*/
+int sWARMStreamFrame(int fd, dSWARMUVBlock *block)
+{
+  int record, nStored = 0;
+  size_t nFloats;
+  swarmStreamHeader header;
+  swarmStreamRecord description;
+
+  if (streamRead(fd, &header, sizeof(header)) != OK)
+    return(ERROR);
+  if ((header.magic != SWARM_STREAM_MAGIC) || (header.version != SWARM_STREAM_VERSION) ||
+      (header.nRecords < 0) || (header.nRecords > SWARM_STREAM_MAX_RECORDS)) {
+    fprintf(stderr, "sWARMStreamFrame: bad frame header (0x%08x, %d, %d records)\n",
+	    header.magic, header.version, header.nRecords);
+    return(ERROR);
+  }
+  for (record = 0; record < header.nRecords; record++) {
+    if (streamRead(fd, &description, sizeof(description)) != OK)
+      return(ERROR);
+    if ((description.nChannels != N_SWARM_CHUNK_POINTS) ||
+	(description.ant1 < 1) || (description.ant1 > 8) ||
+	(description.ant2 < 1) || (description.ant2 > 8)) {
+      fprintf(stderr, "sWARMStreamFrame: bad record %d (%d-%d, %d channels)\n",
+	      record, description.ant1, description.ant2, description.nChannels);
+      return(ERROR);
+    }
+    nFloats = (description.ant1 == description.ant2)? description.nChannels: 2*description.nChannels;
+    if (streamRead(fd, block->lSB, nFloats*sizeof(float)) != OK)
+      return(ERROR);
+    if ((description.ant1 != description.ant2) &&
+	(streamRead(fd, block->uSB, nFloats*sizeof(float)) != OK))
+      return(ERROR);
+    block->nChannels = description.nChannels;
+    block->uT        = header.uT;
+    block->duration  = header.duration;
+    block->ant1      = description.ant1;
+    block->pol1      = description.pol1;
+    block->ant2      = description.ant2;
+    block->pol2      = description.pol2;
+    block->chunk     = description.chunk;
+    pthread_mutex_lock(&sWARMMutex);
+    if (sWARMStoreBlock(block) == OK)
+      nStored++;
+    pthread_mutex_unlock(&sWARMMutex);
+  }
+  return(nStored);
+} /* End of sWARMStreamFrame */
+
+/*
+  S W A R M  S T R E A M
+
+  This function executes as a separate thread.   It accepts TCP
+  connections on swarmStreamPort, one at a time, over which SWARM data
+  arrive in framed batches (see swarmStream.h), and hands each batch's
+  records to sWARMStoreBlock, just as catch_swarm_data_1 does with the
+  one record each RPC call carries.   Each frame is acknowledged with
+  the number of records stored.   So that a sender which has died or
+  hung can't keep others out, a connection is dropped if a frame stalls
+  for SWARM_STREAM_TIMEOUT seconds, or none arrives for SWARM_STREAM_IDLE.
+*/
+void *sWARMStream(void *arg)
+{
+  int listenFd, fd, rCode, on = 1;
+  struct sockaddr_in address;
+  struct timeval timeout;
+  struct pollfd waiting;
+  dSWARMUVBlock *block;
+
+  printf("Thread SWARM_STREAM starting on port %d\n", swarmStreamPort);
+  block = (dSWARMUVBlock *)malloc(sizeof(dSWARMUVBlock));
+  if (block == NULL) {
+    perror("sWARMStream: malloc of block");
+    exit(ERROR);
+  }
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    perror("sWARMStream: socket");
+    return(NULL);
+  }
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(swarmStreamPort);
+  if ((bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+      (listen(listenFd, 4) < 0)) {
+    perror("sWARMStream: bind/listen - batched SWARM data will not be accepted");
+    close(listenFd);
+    return(NULL);
+  }
+  while (TRUE) {
+    fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EINTR)
+	perror("sWARMStream: accept");
+      continue;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    timeout.tv_sec = SWARM_STREAM_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    dprintf("sWARMStream: connection accepted\n");
+    do {
+      waiting.fd = fd;
+      waiting.events = POLLIN;
+      rCode = poll(&waiting, 1, SWARM_STREAM_IDLE*1000);
+      if ((rCode < 0) && (errno == EINTR)) {
+	rCode = OK;
+	continue;
+      } else if (rCode <= 0) {
+	if (rCode == 0)
+	  fprintf(stderr, "sWARMStream: no frame for %d seconds - connection dropped\n", SWARM_STREAM_IDLE);
+	else
+	  perror("sWARMStream: poll");
+	break;
+      }
+      rCode = sWARMStreamFrame(fd, block);
+      if (send(fd, &rCode, sizeof(rCode), MSG_NOSIGNAL) != sizeof(rCode))
+	rCode = ERROR;
+    } while (rCode != ERROR);
+    dprintf("sWARMStream: connection closed\n");
+    close(fd);
+  }
+} /* End of sWARMStream */
+
+
+/*
+  X D R  H E A D E R  S N A P S H O T
+
+  Encodes or decodes the part of a headerSnapshot which is kept in a
+  capture file.
+*/
+bool_t xdrHeaderSnapshot(XDR *xdrs, headerSnapshot *snap)
+{
+  return(xdr_double(xdrs, &(snap->uT)) &&
+	 xdr_double(xdrs, &(snap->intTime)) &&
+	 xdr_int(xdrs, &(snap->spoilScan)) &&
+	 xdr_opaque(xdrs, snap->sourceName, DC_CAPTURE_SOURCE_NAME) &&
+	 xdr_double(xdrs, &(snap->sWARMCenterFrequency)) &&
+	 xdr_double(xdrs, &(snap->bDAIFSep)) &&
+	 xdr_info(xdrs, &(snap->header)) &&
+	 xdr_short(xdrs, &(snap->dSMStuff.polarMode)) &&
+	 xdr_short(xdrs, &(snap->dSMStuff.pointingMode)) &&
+	 xdr_opaque(xdrs, snap->dSMStuff.polarStates, sizeof(snap->dSMStuff.polarStates)));
+} /* End of xdrHeaderSnapshot */
+
+/*
+  C A P T U R E  R E C O R D
+
+  captureRecord writes one record to the capture file, if one was asked
+  for in CONFIG_FILE (see dataCatcherCapture.h).   The file is opened
+  when the first record arrives.   If a write fails, capturing stops.
+*/
+void captureRecord(int type, void *record)
+{
+  int ok;
+  double offset;
+
+  if (replaying || (captureFileName[0] == (char)0))
+    return;
+  pthread_mutex_lock(&captureMutex);
+  if ((captureFile == NULL) && !captureFailed) {
+    captureFile = fopen(captureFileName, "w");
+    if (captureFile == NULL) {
+      perror("captureRecord: fopen");
+      fprintf(stderr, "captureRecord: nothing will be captured in %s\n", captureFileName);
+      captureFailed = TRUE;
+    } else {
+      unsigned int magic = DC_CAPTURE_MAGIC;
+      int version = DC_CAPTURE_VERSION;
+
+      xdrstdio_create(&captureXDR, captureFile, XDR_ENCODE);
+      captureStart = statsNow();
+      xdr_u_int(&captureXDR, &magic);
+      xdr_int(&captureXDR, &version);
+      printf("Capturing received data in %s\n", captureFileName);
+    }
+  }
+  if (captureFile != NULL) {
+    offset = statsNow() - captureStart;
+    ok = xdr_int(&captureXDR, &type) && xdr_double(&captureXDR, &offset);
+    switch (type) {
+    case DC_CAPTURE_BUNDLE:
+      ok = ok && xdr_dCrateUVBlock(&captureXDR, (dCrateUVBlock *)record);
+      break;
+    case DC_CAPTURE_SWARM:
+      ok = ok && xdr_dSWARMUVBlock(&captureXDR, (dSWARMUVBlock *)record);
+      break;
+    default:
+      ok = ok && xdrHeaderSnapshot(&captureXDR, (headerSnapshot *)record);
+    }
+    if (ok)
+      ok = (fflush(captureFile) == 0);
+    if (!ok) {
+      perror("captureRecord: write");
+      fprintf(stderr, "captureRecord: capture to %s stopped\n", captureFileName);
+      xdr_destroy(&captureXDR);
+      fclose(captureFile);
+      captureFile = NULL;
+      captureFailed = TRUE;
+    }
+  }
+  pthread_mutex_unlock(&captureMutex);
+} /* End of captureRecord */
+
+/*
+  R E P L A Y  H E A D E R  F I N D
+
+  Used in place of statusServer and DSM when replaying a capture file.
+  Copies the captured header snapshot nearest in time to uT into snap.
+  Returns FALSE if there is none within MIDPOINT_SLOP.
+*/
+int replayHeaderFind(headerSnapshot *snap, double uT)
+{
+  int i, found = -1;
+  double nearest = MIDPOINT_SLOP;
+
+  for (i = 0; i < nReplaySnapshots; i++)
+    if (fabs(replaySnapshots[i].uT - uT) <= nearest) {
+      found = i;
+      nearest = fabs(replaySnapshots[i].uT - uT);
+    }
+  if (found < 0)
+    return(FALSE);
+  *snap = replaySnapshots[found];
+  return(TRUE);
+} /* End of replayHeaderFind */
+
+/*
+  R E P L A Y  D R A I N
+
+  Waits until the WRITER and MIR_IO threads have had nothing more to do
+  for swarmScanDeadline + REPLAY_IDLE seconds, and returns the time they
+  last did something.
+*/
+double replayDrain(void)
+{
+  unsigned long long done, lastDone = 0;
+  double lastActivity, now;
+
+  lastActivity = now = statsNow();
+  while ((now - lastActivity) < (swarmScanDeadline + REPLAY_IDLE)) {
+    usleep(100000);
+    now = statsNow();
+    done = __atomic_load_n(&(stats->counter[COUNT_SCANS_WRITTEN]), __ATOMIC_RELAXED) +
+      __atomic_load_n(&(stats->counter[COUNT_SCANS_ABANDONED]), __ATOMIC_RELAXED) +
+      __atomic_load_n(&(stats->stage[STAGE_FILE_WRITE].count), __ATOMIC_RELAXED);
+    if (done != lastDone) {
+      lastDone = done;
+      lastActivity = now;
+    }
+  }
+  return(lastActivity);
+} /* End of replayDrain */
+
+/*
+  R E P L A Y  C A P T U R E
+
+  Feeds a capture file back through catch_visibilities_1 and
+  catch_swarm_data_1, at the rate the records were captured, or as fast
+  as possible.   The file is read twice - first to collect the header
+  snapshots, which the HEADER thread then uses in place of statusServer
+  and DSM, and then to replay the data.   Once nothing more has been
+  written for swarmScanDeadline + REPLAY_IDLE seconds, the throughput and
+  per stage timing statistics are printed.
+*/
+int replayCapture(char *fileName, int asFastAsPossible)
+{
+  int pass, type, ok, stage, nBundles = 0, nSWARM = 0;
+  unsigned int magic;
+  int version;
+  double offset, wait, startTime = 0.0, elapsed, mBytes;
+  FILE *file;
+  XDR xdrs;
+  dCrateUVBlock bundle;
+  dSWARMUVBlock *sWARMData;
+  headerSnapshot snap;
+  static char *stageNames[N_STAGES] = {"bundle receipt", "bundle copy", "scan completion",
+				       "header", "pseudo-continuum", "pack data", "scan write",
+				       "file write", "SWARM receipt", "sch direct write"};
+
+  file = fopen(fileName, "r");
+  if (file == NULL) {
+    perror("replayCapture: fopen");
+    return(ERROR);
+  }
+  sWARMData = (dSWARMUVBlock *)malloc(sizeof(dSWARMUVBlock));
+  if (sWARMData == NULL) {
+    perror("replayCapture: malloc of sWARMData");
+    exit(ERROR);
+  }
+  replaying = TRUE;
+  for (pass = 0; pass < 2; pass++) {
+    rewind(file);
+    xdrstdio_create(&xdrs, file, XDR_DECODE);
+    if (!xdr_u_int(&xdrs, &magic) || !xdr_int(&xdrs, &version) ||
+	(magic != DC_CAPTURE_MAGIC) || (version != DC_CAPTURE_VERSION)) {
+      fprintf(stderr, "replayCapture: %s is not a version %d capture file\n",
+	      fileName, DC_CAPTURE_VERSION);
+      xdr_destroy(&xdrs);
+      fclose(file);
+      return(ERROR);
+    }
+    startTime = statsNow();
+    ok = TRUE;
+    while (ok && xdr_int(&xdrs, &type) && xdr_double(&xdrs, &offset)) {
+      if ((pass == 1) && !asFastAsPossible) {
+	wait = startTime + offset - statsNow();
+	if (wait > 0.0)
+	  usleep((useconds_t)(wait*1.0e6));
+      }
+      switch (type) {
+      case DC_CAPTURE_BUNDLE:
+	memset(&bundle, 0, sizeof(bundle));
+	ok = xdr_dCrateUVBlock(&xdrs, &bundle);
+	if (ok && (pass == 1)) {
+	  catch_visibilities_1(&bundle, NULL);
+	  nBundles++;
+	}
+	xdr_free((xdrproc_t)xdr_dCrateUVBlock, (char *)&bundle);
+	break;
+      case DC_CAPTURE_SWARM:
+	memset(sWARMData, 0, sizeof(dSWARMUVBlock));
+	ok = xdr_dSWARMUVBlock(&xdrs, sWARMData);
+	if (ok && (pass == 1)) {
+	  catch_swarm_data_1(sWARMData, NULL);
+	  nSWARM++;
+	}
+	xdr_free((xdrproc_t)xdr_dSWARMUVBlock, (char *)sWARMData);
+	break;
+      case DC_CAPTURE_HEADER:
+	memset(&snap, 0, sizeof(snap));
+	ok = xdrHeaderSnapshot(&xdrs, &snap);
+	if (ok && (pass == 0)) {
+	  replaySnapshots = (headerSnapshot *)realloc(replaySnapshots,
+						      (nReplaySnapshots+1)*sizeof(headerSnapshot));
+	  if (replaySnapshots == NULL) {
+	    perror("replayCapture: realloc of replaySnapshots");
+	    exit(ERROR);
+	  }
+	  replaySnapshots[nReplaySnapshots++] = snap;
+	} else
+	  xdr_free((xdrproc_t)xdr_info, (char *)&(snap.header));
+	break;
+      default:
+	fprintf(stderr, "replayCapture: unknown record type %d in %s\n", type, fileName);
+	ok = FALSE;
+      }
+    }
+    if (!ok || !feof(file))
+      fprintf(stderr, "replayCapture: %s is truncated or damaged - replaying what was read\n",
+	      fileName);
+    xdr_destroy(&xdrs);
+    if (pass == 0)
+      printf("replayCapture: %d header snapshots read from %s\n", nReplaySnapshots, fileName);
+  }
+  fclose(file);
+  free(sWARMData);
+
+  elapsed = replayDrain() - startTime;
+  if (elapsed <= 0.0)
+    elapsed = 1.0e-6;
+  mBytes = ((double)stats->counter[COUNT_BYTES_WRITTEN])/1.0e6;
+  printf("replayCapture: %d bundles and %d SWARM records replayed %s in %.3f seconds\n",
+	 nBundles, nSWARM, asFastAsPossible? "as fast as possible": "in real time", elapsed);
+  printf("  %llu scans written, %llu abandoned, %.3f scans/s\n",
+	 stats->counter[COUNT_SCANS_WRITTEN], stats->counter[COUNT_SCANS_ABANDONED],
+	 ((double)stats->counter[COUNT_SCANS_WRITTEN])/elapsed);
+  printf("  %.3f MB written, %.3f MB/s\n", mBytes, mBytes/elapsed);
+  for (stage = 0; stage < N_STAGES; stage++)
+    if (stats->stage[stage].count > 0)
+      printf("  %-17s %8llu times, mean %10.3f ms, max %10.3f ms\n", stageNames[stage],
+	     stats->stage[stage].count,
+	     1.0e-6*((double)stats->stage[stage].sumNanoseconds)/((double)stats->stage[stage].count),
+	     1.0e-6*((double)stats->stage[stage].maxNanoseconds));
+  return(OK);
+} /* End of replayCapture */
+
+/*
+  R E P L A Y  O V E R L A P  C H E C K
+
+  Feeds two SWARM scans, 30 seconds apart, through catch_swarm_data_1,
+  holding the first one's last chunk back until the second is complete.
+  Both are then passed to processBundle at once, so the second arrives
+  while the first is still waiting for its header or the WRITER.   Each
+  must be written as a scan of its own, with no bundle thrown away as
+  redundant.   The header snapshots are made up, so statusServer and DSM
+  are not needed.   Returns OK if both scans were written.
+*/
+int replayOverlapCheck(void)
+{
+  int i, s, ant1, ant2, chunk, nAntennas, inArray[11];
+  double uT[2];
+  dSWARMUVBlock *sWARMData, *held;
+  headerSnapshot snap;
+
+  nAntennas = 0;
+  getAntennaList(&inArray[0]);
+  for (ant1 = 1; ant1 <= 8; ant1++)
+    if (inArray[ant1])
+      nAntennas++;
+  if (nAntennas < 2) {
+    fprintf(stderr, "replayOverlapCheck: needs at least 2 SWARM antennas in the array, not %d\n",
+	    nAntennas);
+    return(ERROR);
+  }
+  sWARMData = (dSWARMUVBlock *)malloc(sizeof(dSWARMUVBlock));
+  held = (dSWARMUVBlock *)malloc(sizeof(dSWARMUVBlock));
+  if ((sWARMData == NULL) || (held == NULL)) {
+    perror("replayOverlapCheck: malloc of sWARMData");
+    exit(ERROR);
+  }
+  replaying = TRUE;
+  uT[0] = fmod((double)time(NULL), 86400.0);
+  uT[1] = uT[0] + 30.0;
+  replaySnapshots = (headerSnapshot *)malloc(2*sizeof(headerSnapshot));
+  if (replaySnapshots == NULL) {
+    perror("replayOverlapCheck: malloc of replaySnapshots");
+    exit(ERROR);
+  }
+  for (s = 0; s < 2; s++) {
+    memset(&snap, 0, sizeof(snap));
+    snap.uT = uT[s];
+    snap.intTime = 30.0;
+    strcpy(snap.sourceName, "overlapCheck");
+    snap.sWARMCenterFrequency = 2.3e11;
+    replaySnapshots[nReplaySnapshots++] = snap;
+  }
+  held->nChannels = 0;
+  for (s = 0; s < 2; s++)
+    for (ant1 = 1; ant1 < 8; ant1++)
+      for (ant2 = ant1+1; ant2 <= 8; ant2++)
+	for (chunk = 0; chunk < 2; chunk++)
+	  if (inArray[ant1] && inArray[ant2]) {
+	    sWARMData->nChannels = N_SWARM_CHUNK_POINTS;
+	    sWARMData->uT = uT[s];
+	    sWARMData->duration = 30.0;
+	    sWARMData->ant1 = ant1;
+	    sWARMData->ant2 = ant2;
+	    sWARMData->pol1 = sWARMData->pol2 = 0;
+	    sWARMData->chunk = chunk;
+	    for (i = 0; i < 2*N_SWARM_CHUNK_POINTS; i++) {
+	      sWARMData->lSB[i] = (i & 1)? 0.0: (float)(ant1*10 + ant2);
+	      sWARMData->uSB[i] = (i & 1)? 0.0: (float)(ant2*10 + ant1);
+	    }
+	    /* The first scan's last chunk is sent after all of the second scan */
+	    if (s == 0) {
+	      if (held->nChannels > 0)
+		catch_swarm_data_1(held, NULL);
+	      memcpy(held, sWARMData, sizeof(dSWARMUVBlock));
+	    } else
+	      catch_swarm_data_1(sWARMData, NULL);
+	  }
+  catch_swarm_data_1(held, NULL);
+  free(sWARMData);
+  free(held);
+
+  replayDrain();
+  printf("replayOverlapCheck: %llu scans written, %llu abandoned, %llu redundant bundles\n",
+	 stats->counter[COUNT_SCANS_WRITTEN], stats->counter[COUNT_SCANS_ABANDONED],
+	 stats->counter[COUNT_REDUNDANT_BUNDLES]);
+  if ((stats->counter[COUNT_SCANS_WRITTEN] != 2) || (stats->counter[COUNT_REDUNDANT_BUNDLES] != 0)) {
+    printf("replayOverlapCheck: FAILED - two overlapping SWARM scans should give two scans\n");
+    return(ERROR);
+  }
+  printf("replayOverlapCheck: passed\n");
+  return(OK);
+} /* End of replayOverlapCheck */
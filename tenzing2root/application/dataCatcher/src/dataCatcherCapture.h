@@ -0,0 +1,63 @@
+/*
+  dataCatcherCapture.h
+
+  Definitions for dataCatcher capture files.
+
+  If the captureFile keyword is given in dataCatcher.conf, dataCatcher
+  records everything it is sent, and the header information it fetches,
+  in that file.   The file can later be fed back through the same code
+  by dataCatcherReplay, without the crates, SWARM, statusServer or DSM,
+  to measure how fast dataCatcher processes a known data set.
+
+  The file is written with XDR, so it can be replayed on any machine.
+  It starts with
+
+      unsigned int magic;          DC_CAPTURE_MAGIC
+      int          version;        DC_CAPTURE_VERSION
+
+  followed by any number of records, each of which starts with
+
+      int    type;                 DC_CAPTURE_* below
+      double offset;               Seconds since the file was opened
+
+  and continues with a dCrateUVBlock, a dSWARMUVBlock (both encoded
+  with the rpcgen routines, as they are when sent to dataCatcher) or a
+  header snapshot:
+
+      double uT, intTime;          Scan time the fetch was made for
+      int    spoilScan;
+      opaque sourceName[DC_CAPTURE_SOURCE_NAME];
+      double sWARMCenterFrequency;
+      double bDAIFSep;
+      info   header;               As returned by statusServer
+      short  polarMode, pointingMode;
+      opaque polarStates[12];
+
+  dataCatcherReplay reads all the header snapshots first.   When the
+  HEADER thread asks for header information, the snapshot whose uT is
+  nearest the scan's is used in place of statusServer and DSM.   The
+  bundles and SWARM records are then passed to catch_visibilities_1 and
+  catch_swarm_data_1 at the rate they were captured, or as fast as
+  possible.   When the WRITER has finished with them, the performance
+  statistics (see dataCatcherStats.h) are printed.
+
+  dataCatcherReplay -o needs no capture file.   It runs
+  replayOverlapCheck, which sends two SWARM scans whose processing
+  overlaps, and checks that both are written.
+*/
+#ifndef DATA_CATCHER_CAPTURE
+#define DATA_CATCHER_CAPTURE
+
+#define DC_CAPTURE_MAGIC       (0x44434350) /* "DCCP" */
+#define DC_CAPTURE_VERSION     (1)
+#define DC_CAPTURE_SOURCE_NAME (35)
+
+/* Record types */
+#define DC_CAPTURE_BUNDLE (1) /* dCrateUVBlock, from catch_visibilities_1 */
+#define DC_CAPTURE_SWARM  (2) /* dSWARMUVBlock, from sWARMStoreBlock      */
+#define DC_CAPTURE_HEADER (3) /* Header snapshot, from headerFetch        */
+
+int replayCapture(char *fileName, int asFastAsPossible);
+int replayOverlapCheck(void);
+
+#endif
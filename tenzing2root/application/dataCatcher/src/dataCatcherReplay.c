@@ -0,0 +1,48 @@
+/*
+  dataCatcherReplay.c
+
+  Runs dataCatcher on the contents of a capture file (see
+  dataCatcherCapture.h) instead of on data from the crates and SWARM,
+  and reports how quickly it was processed.   It is linked with
+  dataCatcher.c in place of the RPC server, and writes its MIR files
+  wherever dataCatcher would, so it should not be run on a machine
+  where dataCatcher is taking real data.
+
+  Usage: dataCatcherReplay [-f] captureFile
+         dataCatcherReplay -o
+
+  With -f the records are replayed as fast as possible, otherwise at the
+  rate they were captured.   With -o no file is read - two overlapping
+  SWARM scans are made up and sent instead, and the exit status says
+  whether both were written.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "dataCatcherCapture.h"
+
+#define TRUE   (1)
+#define FALSE  (0)
+#define OK     (0)
+#define ERROR (-1)
+
+int main(int argc, char **argv)
+{
+  int asFastAsPossible = FALSE;
+  char *fileName = NULL;
+
+  if ((argc == 2) && !strcmp(argv[1], "-o"))
+    return(replayOverlapCheck());
+  if ((argc == 3) && !strcmp(argv[1], "-f")) {
+    asFastAsPossible = TRUE;
+    fileName = argv[2];
+  } else if ((argc == 2) && (argv[1][0] != '-'))
+    fileName = argv[1];
+  if (fileName == NULL) {
+    fprintf(stderr, "Usage: %s [-f] captureFile\n       %s -o\n", argv[0], argv[0]);
+    return(ERROR);
+  }
+  if (replayCapture(fileName, asFastAsPossible) != OK)
+    return(ERROR);
+  return(OK);
+} /* End of main */
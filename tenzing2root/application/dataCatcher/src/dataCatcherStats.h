@@ -0,0 +1,78 @@
+/*
+  dataCatcherStats.h
+
+  Layout of the shared memory segment in which dataCatcher publishes
+  its performance statistics.   Any program on the same machine can map
+  DC_STATS_SHM_NAME read-only and look at it while dataCatcher runs;
+  swarm/swarm_catcher_stats.py is one such program, and must be kept in
+  step with any change to this file (bump DC_STATS_VERSION).
+
+  For each processing stage there is a count, the total and maximum
+  time spent, and a histogram of times.   Histogram bin 0 counts times
+  under 1 microsecond, and bin n (n > 0) counts times from 2**(n-1) up to
+  2**n microseconds.   The last bin also gets everything longer.
+  Most stages are timed in only one thread, but STAGE_SCAN_COMPLETION is
+  recorded by scanCompleteCheck in whichever of the SERVER and HEADER
+  threads completes the scan, and STAGE_SWARM_RECEIPT by both the RPC
+  server and the SWARM stream thread.   So every update is a relaxed
+  atomic add (the maximum is kept with a compare-and-swap loop), and no
+  timing is lost when two threads record the same stage at once.   No
+  locks are involved, so a reader may see a stage's fields from slightly
+  different moments - a count which already includes a timing whose sum
+  has not been added yet, for example.
+*/
+#ifndef DATA_CATCHER_STATS
+#define DATA_CATCHER_STATS
+
+#define DC_STATS_SHM_NAME  "/dataCatcherStats"
+#define DC_STATS_MAGIC     (0x44435354) /* "DCST" */
+#define DC_STATS_VERSION   (4)
+#define DC_HISTOGRAM_BINS  (32)
+
+/* Stages, and the thread each one is timed in */
+#define STAGE_BUNDLE_RECEIPT   (0) /* processBundle (SERVER)                        */
+#define STAGE_BUNDLE_COPY      (1) /* bundleCopy of a received bundle (SERVER)      */
+#define STAGE_SCAN_COMPLETION  (2) /* First bundle to completion (SERVER, HEADER)   */
+#define STAGE_HEADER           (3) /* statusServer fetch (HEADER)                   */
+#define STAGE_PSEUDO_CONTINUUM (4) /* pCAmp/pCPhase/pCCoh calculation (WRITER)      */
+#define STAGE_PACK_DATA        (5) /* packData and bl/sp records for a scan (WRITER) */
+#define STAGE_SCAN_WRITE       (6) /* All WRITER processing of a scan               */
+#define STAGE_FILE_WRITE       (7) /* Writing a scan's MIR files (MIR_IO)           */
+#define STAGE_SWARM_RECEIPT    (8) /* sWARMStoreBlock (SERVER, SWARM stream)        */
+#define STAGE_SCH_DIRECT_WRITE (9) /* One O_DIRECT write of sch_read (MIR_IO)       */
+#define N_STAGES               (10)
+
+/* Counters */
+#define COUNT_BUNDLES_RECEIVED   (0)
+#define COUNT_REDUNDANT_BUNDLES  (1)
+#define COUNT_UNEXPECTED_BUNDLES (2)
+#define COUNT_SCANS_WRITTEN      (3)
+#define COUNT_SCANS_ABANDONED    (4)
+#define COUNT_BYTES_WRITTEN      (5) /* To the MIR data files */
+#define COUNT_SWARM_BLOCKS       (6) /* dSWARMUVBlocks received */
+#define COUNT_NAN_REPLACEMENTS   (7) /* SWARM channels whose NaNs were replaced */
+#define COUNT_HEADER_PREFETCH_HITS (8) /* Scans given a prefetched header */
+#define COUNT_HEADER_FETCHES     (9) /* Scans whose header had to be fetched on arrival */
+#define COUNT_SWARM_PARTIAL_SCANS (10) /* SWARM scans passed on with chunks missing */
+#define COUNT_SWARM_DUPLICATES   (11) /* SWARM chunks received twice for one scan */
+#define COUNT_SWARM_LATE_CHUNKS  (12) /* SWARM chunks for a scan already passed on */
+#define N_COUNTERS               (13)
+
+typedef struct dcStageStats {
+  unsigned long long count;
+  unsigned long long sumNanoseconds;
+  unsigned long long maxNanoseconds;
+  unsigned long long histogram[DC_HISTOGRAM_BINS];
+} dcStageStats;
+
+typedef struct dcStats {
+  unsigned int       magic;       /* DC_STATS_MAGIC once the segment is set up */
+  unsigned int       version;     /* DC_STATS_VERSION                          */
+  int                pid;         /* Of the dataCatcher which owns the segment */
+  int                spare;
+  double             startTime;   /* Unix time dataCatcher started             */
+  unsigned long long counter[N_COUNTERS];
+  dcStageStats       stage[N_STAGES];
+} dcStats;
+
+#endif
@@ -0,0 +1,298 @@
+/*
+  packData.c
+
+  The versions of packData, which puts spectra into sch_read records.
+  See packData.h.
+*/
+
+#include <math.h>
+#include "packData.h"
+
+/*
+
+  P A C K  D A T A  E X P O N E N T
+
+  Given the range of values in a spectrum, return the power of two
+  by which the spectrum must be divided to fit it into short integers.
+  Every version of packData must use this, so that they all produce
+  identical scale factors.
+*/
+short packDataExponent(float dataMin, float dataMax)
+{
+  short scaleExp;
+  float delta;
+
+  if (fabs(dataMin) > dataMax)
+    dataMax = fabs(dataMin);
+  delta = dataMax/32767.0;
+  scaleExp = log(delta)/log(2.0);
+  if (scaleExp > 0)
+    scaleExp++;
+  return(scaleExp);
+} /* End of packDataExponent */
+
+/*
+
+  P A C K  D A T A  S C A L A R
+
+  packDataScalar puts one spectrum (or continuum channel) into the one
+  dimensional array of short integers that holds the scaled
+  data (as complex numbers).   This is the original version of packData,
+  which is used when the processor has no vector unit we know how to use.
+*/
+int packDataScalar(int nChan, float intTime, float *real, float *imag, short *slot)
+{
+  short scaleExp;
+  short	visRealS; /* real part of complex visibility scaled to short	   */
+  short	visImagS; /* imaginary part of complex visibility scaled to short */
+  int i, status;
+  float scale;
+  float dataMax = -1.0e38;
+  float dataMin = 1.0e38;
+
+  (void)intTime; /* Unused, but every version has packData's arguments */
+  status = -1;
+  /* Find range of values in this set */
+  for (i = 0; i < nChan; i++) {
+    if (real[i] < dataMin)
+      dataMin = real[i];
+    if (real[i] > dataMax)
+      dataMax = real[i];
+    if (imag[i] < dataMin)
+      dataMin = imag[i];
+    if (imag[i] > dataMax)
+      dataMax = imag[i];
+  }
+  if ((dataMax != 0.0) || (dataMin != 0.0))
+    status = 0;
+  scaleExp = packDataExponent(dataMin, dataMax);
+  scale = pow(2.0, (float)scaleExp);
+
+  slot[0] = scaleExp;
+  for (i = 0; i < nChan; i++) {
+    visRealS = real[i]/scale;
+    visImagS = imag[i]/scale;
+    slot[1 + 2*i] = visRealS;
+    slot[2 + 2*i] = visImagS;
+  }
+  return(status);
+} /* End of packDataScalar */
+
+#ifdef PACK_DATA_VECTORIZED
+/*
+
+  P A C K  D A T A  S S E 2
+
+  packDataSSE2 produces exactly the same output as packDataScalar,
+  four channels at a time.   The things which keep it bit-identical:
+
+  The range is found with min_ps(x, acc) and max_ps(x, acc), which
+  return acc when x is a NaN - just as the scalar comparisons skip NaNs.
+
+  Dividing by 2**scaleExp and multiplying by 2**-scaleExp give the same
+  result whenever 2**-scaleExp is a normal float, so the reciprocal is
+  only used when scaleExp is in [-126, 126].
+
+  The scalar code converts to int, and keeps the low 16 bits of that int.
+  cvttps does the int conversion (NaNs and overflows become 0x80000000,
+  as they do in the scalar code), and shifting left then arithmetically
+  right by 16 keeps the low 16 bits, so that packs never saturates.
+*/
+__attribute__((target("sse2")))
+int packDataSSE2(int nChan, float intTime, float *real, float *imag, short *slot)
+{
+  short scaleExp;
+  int i, status;
+  float scale, inverse, dataMin, dataMax;
+  float lanes[4];
+  __m128 vMin, vMax, vScale, vR, vI;
+  __m128i iR, iI, sR, sI;
+
+  status = -1;
+  vMin = _mm_set1_ps(1.0e38);
+  vMax = _mm_set1_ps(-1.0e38);
+  for (i = 0; i+4 <= nChan; i += 4) {
+    vR = _mm_loadu_ps(&real[i]);
+    vI = _mm_loadu_ps(&imag[i]);
+    vMin = _mm_min_ps(vR, vMin);
+    vMax = _mm_max_ps(vR, vMax);
+    vMin = _mm_min_ps(vI, vMin);
+    vMax = _mm_max_ps(vI, vMax);
+  }
+  _mm_storeu_ps(lanes, vMin);
+  dataMin = lanes[0];
+  for (i = 1; i < 4; i++)
+    if (lanes[i] < dataMin)
+      dataMin = lanes[i];
+  _mm_storeu_ps(lanes, vMax);
+  dataMax = lanes[0];
+  for (i = 1; i < 4; i++)
+    if (lanes[i] > dataMax)
+      dataMax = lanes[i];
+  for (i = nChan & ~3; i < nChan; i++) {
+    if (real[i] < dataMin)
+      dataMin = real[i];
+    if (real[i] > dataMax)
+      dataMax = real[i];
+    if (imag[i] < dataMin)
+      dataMin = imag[i];
+    if (imag[i] > dataMax)
+      dataMax = imag[i];
+  }
+  if ((dataMax != 0.0) || (dataMin != 0.0))
+    status = 0;
+  scaleExp = packDataExponent(dataMin, dataMax);
+  scale = pow(2.0, (float)scaleExp);
+  slot[0] = scaleExp;
+  if ((scaleExp < -126) || (scaleExp > 126))
+    return(packDataScalar(nChan, intTime, real, imag, slot));
+
+  inverse = pow(2.0, (float)(-scaleExp));
+  vScale = _mm_set1_ps(inverse);
+  for (i = 0; i+8 <= nChan; i += 8) {
+    iR = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&real[i]), vScale));
+    sR = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&real[i+4]), vScale));
+    iI = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&imag[i]), vScale));
+    sI = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(&imag[i+4]), vScale));
+    iR = _mm_srai_epi32(_mm_slli_epi32(iR, 16), 16);
+    sR = _mm_srai_epi32(_mm_slli_epi32(sR, 16), 16);
+    iI = _mm_srai_epi32(_mm_slli_epi32(iI, 16), 16);
+    sI = _mm_srai_epi32(_mm_slli_epi32(sI, 16), 16);
+    iR = _mm_packs_epi32(iR, sR); /* 8 real shorts      */
+    iI = _mm_packs_epi32(iI, sI); /* 8 imaginary shorts */
+    _mm_storeu_si128((__m128i *)&slot[1 + 2*i], _mm_unpacklo_epi16(iR, iI));
+    _mm_storeu_si128((__m128i *)&slot[9 + 2*i], _mm_unpackhi_epi16(iR, iI));
+  }
+  for (; i < nChan; i++) {
+    slot[1 + 2*i] = real[i]/scale;
+    slot[2 + 2*i] = imag[i]/scale;
+  }
+  return(status);
+} /* End of packDataSSE2 */
+
+/*
+
+  P A C K  D A T A  A V X 2
+
+  packDataAVX2 is packDataSSE2 with eight channels per register.
+  packs and unpack work within each 128 bit half of a register, so
+  packing real[0..7] with real[8..15] and then interleaving with the
+  imaginary parts leaves channels 0..7 in the low result and 8..15 in
+  the high one, already in order.
+*/
+__attribute__((target("avx2")))
+int packDataAVX2(int nChan, float intTime, float *real, float *imag, short *slot)
+{
+  short scaleExp;
+  int i, status;
+  float scale, inverse, dataMin, dataMax;
+  float lanes[8];
+  __m256 vMin, vMax, vScale, vR, vI;
+  __m256i iR, iI, sR, sI;
+
+  status = -1;
+  vMin = _mm256_set1_ps(1.0e38);
+  vMax = _mm256_set1_ps(-1.0e38);
+  for (i = 0; i+8 <= nChan; i += 8) {
+    vR = _mm256_loadu_ps(&real[i]);
+    vI = _mm256_loadu_ps(&imag[i]);
+    vMin = _mm256_min_ps(vR, vMin);
+    vMax = _mm256_max_ps(vR, vMax);
+    vMin = _mm256_min_ps(vI, vMin);
+    vMax = _mm256_max_ps(vI, vMax);
+  }
+  _mm256_storeu_ps(lanes, vMin);
+  dataMin = lanes[0];
+  for (i = 1; i < 8; i++)
+    if (lanes[i] < dataMin)
+      dataMin = lanes[i];
+  _mm256_storeu_ps(lanes, vMax);
+  dataMax = lanes[0];
+  for (i = 1; i < 8; i++)
+    if (lanes[i] > dataMax)
+      dataMax = lanes[i];
+  for (i = nChan & ~7; i < nChan; i++) {
+    if (real[i] < dataMin)
+      dataMin = real[i];
+    if (real[i] > dataMax)
+      dataMax = real[i];
+    if (imag[i] < dataMin)
+      dataMin = imag[i];
+    if (imag[i] > dataMax)
+      dataMax = imag[i];
+  }
+  if ((dataMax != 0.0) || (dataMin != 0.0))
+    status = 0;
+  scaleExp = packDataExponent(dataMin, dataMax);
+  scale = pow(2.0, (float)scaleExp);
+  slot[0] = scaleExp;
+  if ((scaleExp < -126) || (scaleExp > 126))
+    return(packDataScalar(nChan, intTime, real, imag, slot));
+
+  inverse = pow(2.0, (float)(-scaleExp));
+  vScale = _mm256_set1_ps(inverse);
+  for (i = 0; i+16 <= nChan; i += 16) {
+    iR = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&real[i]), vScale));
+    sR = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&real[i+8]), vScale));
+    iI = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&imag[i]), vScale));
+    sI = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_loadu_ps(&imag[i+8]), vScale));
+    iR = _mm256_srai_epi32(_mm256_slli_epi32(iR, 16), 16);
+    sR = _mm256_srai_epi32(_mm256_slli_epi32(sR, 16), 16);
+    iI = _mm256_srai_epi32(_mm256_slli_epi32(iI, 16), 16);
+    sI = _mm256_srai_epi32(_mm256_slli_epi32(sI, 16), 16);
+    iR = _mm256_packs_epi32(iR, sR);
+    iI = _mm256_packs_epi32(iI, sI);
+    _mm256_storeu_si256((__m256i *)&slot[1 + 2*i], _mm256_unpacklo_epi16(iR, iI));
+    _mm256_storeu_si256((__m256i *)&slot[17 + 2*i], _mm256_unpackhi_epi16(iR, iI));
+  }
+  for (; i < nChan; i++) {
+    slot[1 + 2*i] = real[i]/scale;
+    slot[2 + 2*i] = imag[i]/scale;
+  }
+  return(status);
+} /* End of packDataAVX2 */
+#endif /* PACK_DATA_VECTORIZED */
+
+/*
+
+  P A C K  D A T A
+
+  packData puts one spectrum (or continuum channel) into the one
+  dimensional array of short integers that holds the scaled
+  data (as complex numbers).   The first call picks the fastest
+  version the processor supports; they all produce identical output.
+*/
+int packData(int nChan, float intTime, float *real, float *imag, short *slot)
+{
+  static int (*packer)(int nChan, float intTime, float *real, float *imag, short *slot) = NULL;
+
+  if (packer == NULL) {
+    packer = packDataScalar;
+#ifdef PACK_DATA_VECTORIZED
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      packer = packDataAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+      packer = packDataSSE2;
+#endif
+  }
+  return((*packer)(nChan, intTime, real, imag, slot));
+} /* End of packData */
+
+/*
+
+  P A C K  D A T A  V E R S I O N
+
+  Returns the name of the version of packData this processor will use.
+*/
+char *packDataVersion(void)
+{
+#ifdef PACK_DATA_VECTORIZED
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return("AVX2");
+  else if (__builtin_cpu_supports("sse2"))
+    return("SSE2");
+#endif
+  return("scalar");
+} /* End of packDataVersion */
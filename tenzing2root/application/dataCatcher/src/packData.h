@@ -0,0 +1,33 @@
+/*
+  packData.h
+
+  packData scales a spectrum (or continuum channel) into the short
+  integers of an sch_read record: a short holding the scale exponent,
+  followed by the scaled real and imaginary parts, interleaved.
+
+  On x86-64 there are SSE2 and AVX2 versions, and packData picks the
+  fastest one the processor supports on its first call.   Every version
+  produces output identical to packDataScalar, the original code.
+  packDataBench times them against each other (make bench).
+
+  PACK_DATA_VECTORIZED is defined when the vector versions are built,
+  and is also used by dataCatcher for its other SSE2 loops.
+*/
+#ifndef PACK_DATA
+#define PACK_DATA
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PACK_DATA_VECTORIZED     /* Use SSE2 or AVX2 versions of packData */
+#include <immintrin.h>
+#endif
+
+short packDataExponent(float dataMin, float dataMax);
+int packDataScalar(int nChan, float intTime, float *real, float *imag, short *slot);
+#ifdef PACK_DATA_VECTORIZED
+int packDataSSE2(int nChan, float intTime, float *real, float *imag, short *slot);
+int packDataAVX2(int nChan, float intTime, float *real, float *imag, short *slot);
+#endif
+int packData(int nChan, float intTime, float *real, float *imag, short *slot);
+char *packDataVersion(void);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+  packDataBench.c
+
+  Times each version of packData (see packData.h) on spectra of the
+  size SWARM produces, and checks that they all give output identical
+  to packDataScalar.
+
+  Usage: packDataBench [nChannels [nCalls]]      (defaults 16384, 2000)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "packData.h"
+
+#define TRUE   (1)
+#define FALSE  (0)
+#define OK     (0)
+#define ERROR (-1)
+
+#define N_SPECTRA (16) /* Different spectra, used in turn */
+
+typedef int (*packer)(int nChan, float intTime, float *real, float *imag, short *slot);
+
+double benchNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9);
+}
+
+/*
+  Time nCalls calls of version, and compare what it produced for each
+  spectrum with reference.   Returns OK if they were all identical.
+*/
+int benchOne(char *name, packer version, int nChan, int nCalls,
+	     float **real, float **imag, short **reference, short *slot)
+{
+  int call, spectrum, nBad = 0;
+  double start, elapsed;
+
+  for (spectrum = 0; spectrum < N_SPECTRA; spectrum++) {
+    (*version)(nChan, 1.0, real[spectrum], imag[spectrum], slot);
+    if (memcmp(slot, reference[spectrum], (2*nChan+1)*sizeof(short)))
+      nBad++;
+  }
+  start = benchNow();
+  for (call = 0; call < nCalls; call++)
+    (*version)(nChan, 1.0, real[call % N_SPECTRA], imag[call % N_SPECTRA], slot);
+  elapsed = benchNow() - start;
+  printf("%-8s %10.2f us/call %s\n", name, 1.0e6*elapsed/(double)nCalls,
+	 (nBad == 0)? "identical to scalar": "DIFFERS FROM SCALAR");
+  return((nBad == 0)? OK: ERROR);
+}
+
+int main(int argc, char **argv)
+{
+  int i, spectrum, nChan = 16384, nCalls = 2000, rCode = OK;
+  float *real[N_SPECTRA], *imag[N_SPECTRA];
+  short *reference[N_SPECTRA], *slot;
+
+  if (argc > 1)
+    nChan = atoi(argv[1]);
+  if (argc > 2)
+    nCalls = atoi(argv[2]);
+  if ((nChan < 1) || (nCalls < 1)) {
+    fprintf(stderr, "Usage: %s [nChannels [nCalls]]\n", argv[0]);
+    return(ERROR);
+  }
+  srand(1);
+  for (spectrum = 0; spectrum < N_SPECTRA; spectrum++) {
+    real[spectrum] = (float *)malloc(nChan*sizeof(float));
+    imag[spectrum] = (float *)malloc(nChan*sizeof(float));
+    reference[spectrum] = (short *)malloc((2*nChan+1)*sizeof(short));
+    if ((real[spectrum] == NULL) || (imag[spectrum] == NULL) || (reference[spectrum] == NULL)) {
+      perror("packDataBench: malloc");
+      return(ERROR);
+    }
+    /* Spectra spanning a wide range of scales, as the correlator produces */
+    for (i = 0; i < nChan; i++) {
+      real[spectrum][i] = (((float)rand()/RAND_MAX) - 0.5)*(float)(1 << spectrum)*1.0e3;
+      imag[spectrum][i] = (((float)rand()/RAND_MAX) - 0.5)*(float)(1 << spectrum)*1.0e3;
+    }
+    packDataScalar(nChan, 1.0, real[spectrum], imag[spectrum], reference[spectrum]);
+  }
+  slot = (short *)malloc((2*nChan+1)*sizeof(short));
+  if (slot == NULL) {
+    perror("packDataBench: malloc");
+    return(ERROR);
+  }
+  printf("packData on %d channels, %d calls (packData uses %s)\n", nChan, nCalls, packDataVersion());
+  benchOne("scalar", packDataScalar, nChan, nCalls, real, imag, reference, slot);
+#ifdef PACK_DATA_VECTORIZED
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2"))
+    rCode |= benchOne("SSE2", packDataSSE2, nChan, nCalls, real, imag, reference, slot);
+  if (__builtin_cpu_supports("avx2"))
+    rCode |= benchOne("AVX2", packDataAVX2, nChan, nCalls, real, imag, reference, slot);
+#endif
+  rCode |= benchOne("packData", packData, nChan, nCalls, real, imag, reference, slot);
+  return((rCode == OK)? OK: ERROR);
+}
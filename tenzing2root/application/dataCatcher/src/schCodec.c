@@ -0,0 +1,155 @@
+/*
+  schCodec.c
+
+  The delta and bit packing codec used for the compressed form of the
+  MIR sch_read file.   See schCodec.h for a description of the format.
+  These functions are used by dataCatcher to write the compressed file,
+  and by the schReader library to read it.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "schCodec.h"
+
+#define OK     (0)
+#define ERROR (-1)
+
+/*
+  Zigzag encoding maps 0, -1, 1, -2, 2... to 0, 1, 2, 3, 4...
+  A difference of two shorts needs 17 bits.
+*/
+#define ZIGZAG(v)   ((((unsigned int)(v)) << 1) ^ (unsigned int)((v) >> 31))
+#define UNZIGZAG(u) ((int)((u) >> 1) ^ -(int)((u) & 1))
+
+/*
+
+  B I T S  N E E D E D
+
+  Return the number of bits needed to hold every value in a block.
+*/
+static int bitsNeeded(unsigned int *value, int n)
+{
+  int i, bits;
+  unsigned int all = 0;
+
+  for (i = 0; i < n; i++)
+    all |= value[i];
+  bits = 0;
+  while (all != 0) {
+    bits++;
+    all >>= 1;
+  }
+  return(bits);
+} /* End of bitsNeeded */
+
+/*
+
+  S C H  E N C O D E  B O U N D
+
+  The largest number of bytes schEncode can produce for nShorts shorts.
+*/
+int schEncodeBound(int nShorts)
+{
+  int nBlocks;
+
+  nBlocks = (nShorts + SCH_CODEC_BLOCK - 1) / SCH_CODEC_BLOCK;
+  return(nBlocks * (1 + (SCH_CODEC_BLOCK*17 + 7)/8));
+} /* End of schEncodeBound */
+
+/*
+
+  S C H  E N C O D E
+
+  Compress nShorts shorts from in into out, which must have room
+  for schEncodeBound(nShorts) bytes.   Returns the number of bytes used.
+*/
+int schEncode(short *in, int nShorts, unsigned char *out)
+{
+  int start, i, n, rawBits, deltaBits, bits, nOut, nAcc;
+  unsigned int raw[SCH_CODEC_BLOCK], delta[SCH_CODEC_BLOCK], *value;
+  unsigned long long acc;
+
+  nOut = 0;
+  for (start = 0; start < nShorts; start += SCH_CODEC_BLOCK) {
+    n = nShorts - start;
+    if (n > SCH_CODEC_BLOCK)
+      n = SCH_CODEC_BLOCK;
+    for (i = 0; i < n; i++) {
+      int previous;
+
+      raw[i] = ZIGZAG((int)in[start+i]);
+      previous = (start+i >= 2)? in[start+i-2]: 0;
+      delta[i] = ZIGZAG((int)in[start+i] - previous);
+    }
+    rawBits = bitsNeeded(raw, n);
+    deltaBits = bitsNeeded(delta, n);
+    if (deltaBits < rawBits) {
+      bits = deltaBits;
+      value = delta;
+      out[nOut++] = SCH_CODEC_DELTA | bits;
+    } else {
+      bits = rawBits;
+      value = raw;
+      out[nOut++] = bits;
+    }
+    acc = 0;
+    nAcc = 0;
+    for (i = 0; i < n; i++) {
+      acc |= ((unsigned long long)value[i]) << nAcc;
+      nAcc += bits;
+      while (nAcc >= 8) {
+	out[nOut++] = acc & 0xff;
+	acc >>= 8;
+	nAcc -= 8;
+      }
+    }
+    if (nAcc > 0)
+      out[nOut++] = acc & 0xff;
+  }
+  return(nOut);
+} /* End of schEncode */
+
+/*
+
+  S C H  D E C O D E
+
+  Expand nBytes of schEncode output from in into nShorts shorts in out.
+  Returns ERROR if the compressed data is too short or damaged.
+*/
+int schDecode(unsigned char *in, int nBytes, short *out, int nShorts)
+{
+  int start, i, n, bits, isDelta, nIn, nAcc;
+  unsigned int mask;
+  unsigned long long acc;
+
+  nIn = 0;
+  for (start = 0; start < nShorts; start += SCH_CODEC_BLOCK) {
+    n = nShorts - start;
+    if (n > SCH_CODEC_BLOCK)
+      n = SCH_CODEC_BLOCK;
+    if (nIn >= nBytes)
+      return(ERROR);
+    isDelta = in[nIn] & SCH_CODEC_DELTA;
+    bits = in[nIn++] & SCH_CODEC_WIDTH;
+    if ((bits > 17) || (nIn + (n*bits + 7)/8 > nBytes))
+      return(ERROR);
+    mask = (1 << bits) - 1;
+    acc = 0;
+    nAcc = 0;
+    for (i = 0; i < n; i++) {
+      int value;
+
+      while (nAcc < bits) {
+	acc |= ((unsigned long long)in[nIn++]) << nAcc;
+	nAcc += 8;
+      }
+      value = UNZIGZAG((unsigned int)(acc & mask));
+      acc >>= bits;
+      nAcc -= bits;
+      if (isDelta)
+	value += (start+i >= 2)? out[start+i-2]: 0;
+      out[start+i] = value;
+    }
+  }
+  return(OK);
+} /* End of schDecode */
@@ -0,0 +1,71 @@
+/*
+  schCodec.h
+
+  Definitions for the compressed form of the MIR sch_read file.
+
+  When dataCatcher is told to compress the spectra, it writes the file
+  sch_compressed in place of sch_read, along with an index file,
+  sch_index.   Each record in sch_compressed holds the same packed data
+  as the corresponding sch_read record, compressed with schEncode:
+
+      int inhid;                   integration id #
+      int nbyt;                    bytes of packed data, uncompressed
+      int zbyt;                    bytes of compressed data which follow
+      unsigned char zdata[zbyt];
+
+  sch_index holds one schIndexDef per record, in inhid order, so that
+  a record can be found without reading the ones before it.
+
+  The codec is tailored to the packed data layout produced by packData:
+  for each spectrum a short holding the scale exponent, followed by the
+  scaled real and imaginary parts as interleaved shorts.   The shorts are
+  taken in blocks of SCH_CODEC_BLOCK.   Each block is stored either as is,
+  or as differences from the value two places earlier (the previous
+  channel's real or imaginary part), whichever needs fewer bits.   The
+  values are zigzag encoded, so that small negative numbers become small
+  positive ones, and then packed using only as many bits as the largest
+  value in the block needs.   Each block starts with one byte holding
+  the bit width, with SCH_CODEC_DELTA set if differences were stored.
+*/
+#ifndef SCH_CODEC
+#define SCH_CODEC
+
+#include <stdio.h>
+
+#define SCH_CODEC_BLOCK (128)  /* Shorts per block                          */
+#define SCH_CODEC_DELTA (0x80) /* Block header flag - differences stored    */
+#define SCH_CODEC_WIDTH (0x1f) /* Block header mask for the bit width       */
+#define SCH_COMPRESSED_FILE "sch_compressed"
+#define SCH_INDEX_FILE      "sch_index"
+#define SCH_INDEX_ZERO_FILLED (0x1) /* Record has missing SWARM spectra stored as zeros */
+
+typedef struct schIndexDef {
+  int       inhid;  /* integration id #                                   */
+  int       nbyt;   /* bytes of packed data, uncompressed                 */
+  int       zbyt;   /* bytes of compressed data                           */
+  int       flags;  /* SCH_INDEX_* bits                                   */
+  long long offset; /* byte offset of the record's inhid in sch_compressed */
+} schIndexDef;
+
+/*   C O D E C   */
+
+int schEncodeBound(int nShorts);
+int schEncode(short *in, int nShorts, unsigned char *out);
+int schDecode(unsigned char *in, int nBytes, short *out, int nShorts);
+
+/*   R E A D E R   L I B R A R Y   (schReader.c)   */
+
+typedef struct schReader {
+  char          directory[200];
+  FILE          *data;     /* sch_compressed                */
+  int           nRecords;
+  schIndexDef   *index;    /* Contents of sch_index         */
+  unsigned char *zBuffer;  /* Compressed data being decoded */
+  int           zSize;
+} schReader;
+
+schReader *schReaderOpen(char *directory);
+short *schReaderGet(schReader *reader, int inhid, int *nbyt);
+void schReaderClose(schReader *reader);
+
+#endif
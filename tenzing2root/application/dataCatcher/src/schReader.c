@@ -0,0 +1,206 @@
+/*
+  schReader.c
+
+  A small library for reading the compressed MIR spectra written by
+  dataCatcher (the sch_compressed and sch_index files - see schCodec.h).
+  Records are found through the index and decompressed only when asked
+  for, so a program can pull out individual integrations from a long
+  track without expanding the whole file.   The index is reread if a
+  record isn't found, so the files can be read while dataCatcher is
+  still writing them.
+
+  Typical use:
+      schReader *reader;
+      short *packdata;
+      int nbyt;
+
+      reader = schReaderOpen("/data/science/mir_data/251017_00:00:00/");
+      packdata = schReaderGet(reader, inhid, &nbyt);
+      ...
+      free(packdata);
+      schReaderClose(reader);
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schCodec.h"
+
+#define OK     (0)
+#define ERROR (-1)
+
+/*
+
+  L O A D  I N D E X
+
+  (Re)read the whole sch_index file.
+*/
+static int loadIndex(schReader *reader)
+{
+  int nRecords;
+  long size;
+  char fileName[250];
+  FILE *indexFile;
+
+  sprintf(fileName, "%s/%s", reader->directory, SCH_INDEX_FILE);
+  indexFile = fopen(fileName, "r");
+  if (indexFile == NULL) {
+    perror("schReader: opening sch_index");
+    return(ERROR);
+  }
+  fseek(indexFile, 0, SEEK_END);
+  size = ftell(indexFile);
+  rewind(indexFile);
+  nRecords = size / sizeof(schIndexDef);
+  free(reader->index);
+  reader->index = (schIndexDef *)malloc(nRecords*sizeof(schIndexDef) + 1);
+  if (reader->index == NULL) {
+    perror("schReader: malloc of index");
+    fclose(indexFile);
+    reader->nRecords = 0;
+    return(ERROR);
+  }
+  reader->nRecords = fread(reader->index, sizeof(schIndexDef), nRecords, indexFile);
+  fclose(indexFile);
+  return(OK);
+} /* End of loadIndex */
+
+/*
+
+  F I N D  R E C O R D
+
+  Binary search of the index (inhid increases through the file).
+*/
+static schIndexDef *findRecord(schReader *reader, int inhid)
+{
+  int low, high, middle;
+
+  low = 0;
+  high = reader->nRecords - 1;
+  while (low <= high) {
+    middle = (low + high) / 2;
+    if (reader->index[middle].inhid == inhid)
+      return(&reader->index[middle]);
+    else if (reader->index[middle].inhid < inhid)
+      low = middle + 1;
+    else
+      high = middle - 1;
+  }
+  return(NULL);
+} /* End of findRecord */
+
+/*
+
+  S C H  R E A D E R  O P E N
+
+  Open the compressed spectra in a MIR data directory.
+  Returns NULL if they can't be opened.
+*/
+schReader *schReaderOpen(char *directory)
+{
+  char fileName[250];
+  schReader *reader;
+
+  reader = (schReader *)malloc(sizeof(schReader));
+  if (reader == NULL) {
+    perror("schReaderOpen: malloc");
+    return(NULL);
+  }
+  strncpy(reader->directory, directory, sizeof(reader->directory)-1);
+  reader->directory[sizeof(reader->directory)-1] = (char)0;
+  reader->index = NULL;
+  reader->zBuffer = NULL;
+  reader->zSize = 0;
+  sprintf(fileName, "%s/%s", reader->directory, SCH_COMPRESSED_FILE);
+  reader->data = fopen(fileName, "r");
+  if (reader->data == NULL) {
+    perror("schReaderOpen: opening sch_compressed");
+    free(reader);
+    return(NULL);
+  }
+  if (loadIndex(reader) != OK) {
+    fclose(reader->data);
+    free(reader);
+    return(NULL);
+  }
+  return(reader);
+} /* End of schReaderOpen */
+
+/*
+
+  S C H  R E A D E R  G E T
+
+  Return the packed data for integration inhid, exactly as it would have
+  been written to sch_read, in a malloc'd array the caller must free.
+  The size of the array, in bytes, is returned in nbyt.
+  Returns NULL if the record can't be found or read.
+*/
+short *schReaderGet(schReader *reader, int inhid, int *nbyt)
+{
+  int header[3];
+  short *packdata;
+  schIndexDef *entry;
+
+  entry = findRecord(reader, inhid);
+  if (entry == NULL) {
+    /* dataCatcher may have written it since we last looked */
+    if (loadIndex(reader) != OK)
+      return(NULL);
+    entry = findRecord(reader, inhid);
+    if (entry == NULL) {
+      fprintf(stderr, "schReaderGet: inhid %d is not in %s\n", inhid, reader->directory);
+      return(NULL);
+    }
+  }
+  if (fseek(reader->data, entry->offset, SEEK_SET) != OK) {
+    perror("schReaderGet: fseek");
+    return(NULL);
+  }
+  if (fread(header, sizeof(header), 1, reader->data) != 1) {
+    perror("schReaderGet: reading record header");
+    return(NULL);
+  }
+  if ((header[0] != entry->inhid) || (header[1] != entry->nbyt) || (header[2] != entry->zbyt)) {
+    fprintf(stderr, "schReaderGet: record for inhid %d does not match the index\n", inhid);
+    return(NULL);
+  }
+  if (entry->zbyt > reader->zSize) {
+    free(reader->zBuffer);
+    reader->zBuffer = (unsigned char *)malloc(entry->zbyt);
+    if (reader->zBuffer == NULL) {
+      perror("schReaderGet: malloc of zBuffer");
+      reader->zSize = 0;
+      return(NULL);
+    }
+    reader->zSize = entry->zbyt;
+  }
+  if (fread(reader->zBuffer, entry->zbyt, 1, reader->data) != 1) {
+    perror("schReaderGet: reading compressed data");
+    return(NULL);
+  }
+  packdata = (short *)malloc(entry->nbyt + 1);
+  if (packdata == NULL) {
+    perror("schReaderGet: malloc of packdata");
+    return(NULL);
+  }
+  if (schDecode(reader->zBuffer, entry->zbyt, packdata, entry->nbyt/sizeof(short)) != OK) {
+    fprintf(stderr, "schReaderGet: compressed data for inhid %d is damaged\n", inhid);
+    free(packdata);
+    return(NULL);
+  }
+  *nbyt = entry->nbyt;
+  return(packdata);
+} /* End of schReaderGet */
+
+/*
+
+  S C H  R E A D E R  C L O S E
+
+*/
+void schReaderClose(schReader *reader)
+{
+  fclose(reader->data);
+  free(reader->index);
+  free(reader->zBuffer);
+  free(reader);
+} /* End of schReaderClose */
@@ -0,0 +1,49 @@
+/*
+  swarmStream.h
+
+  Framing for the TCP stream on which SWARM visibilities can be sent to
+  dataCatcher in batches, rather than with one catch_swarm_data_1 RPC
+  call per baseline and chunk.   Used by dataCatcher (the SWARM_STREAM
+  thread) and by sendIntegrationBatch in sendIntegration.c.
+
+  Each frame is a swarmStreamHeader, followed by nRecords records.   Each
+  record is a swarmStreamRecord followed by its spectra:
+     autocorrelation (ant1 == ant2): nChannels floats
+     cross correlation:              2*nChannels floats of LSB (real, imag pairs)
+                                     then 2*nChannels floats of USB
+  Everything is in the sender's native byte order - the magic number
+  will not match if the two ends differ.   After each frame dataCatcher
+  replies with one int, the number of records it stored, or ERROR if the
+  frame was bad (in which case it also closes the connection).
+  dataCatcher also closes a connection on which a frame stalls for
+  SWARM_STREAM_TIMEOUT seconds, or no frame arrives for SWARM_STREAM_IDLE
+  seconds, so a sender should check for that before reusing one.
+*/
+#ifndef SWARM_STREAM
+#define SWARM_STREAM
+
+#define SWARM_STREAM_PORT    (5116)       /* Default, see swarmStreamPort in dataCatcher.conf */
+#define SWARM_STREAM_PORT_VARIABLE "SWARM_STREAM_PORT" /* Senders' override, 0 for none */
+#define SWARM_STREAM_MAGIC   (0x53574d42) /* "SWMB" */
+#define SWARM_STREAM_VERSION (1)
+#define SWARM_STREAM_MAX_RECORDS (1024)   /* Per frame */
+#define SWARM_STREAM_TIMEOUT (10)         /* Seconds dataCatcher waits on a stalled frame */
+#define SWARM_STREAM_IDLE    (600)        /* Seconds between frames before it drops a sender */
+
+typedef struct swarmStreamHeader {
+  unsigned int magic;
+  unsigned int version;
+  int          nRecords;
+  int          spare;
+  double       uT;
+  double       duration;
+} swarmStreamHeader;
+
+typedef struct swarmStreamRecord {
+  int ant1, pol1;
+  int ant2, pol2;
+  int chunk;
+  int nChannels;
+} swarmStreamRecord;
+
+#endif
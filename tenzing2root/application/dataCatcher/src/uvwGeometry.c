@@ -0,0 +1,144 @@
+/*
+  uvwGeometry.c
+
+  Projected baseline coordinates from antenna positions.   See
+  uvwGeometry.h for a description of what is cached between calls.
+  These functions are used by dataCatcher's writer thread, and may be
+  linked, along with novas.o and novascon.o, into offline tools which
+  need to recompute U, V and W for a list of integration times.
+*/
+
+#include <stddef.h>
+#include <math.h>
+#include "uvwGeometry.h"
+
+#define TRUE  (1)
+#define FALSE (0)
+#define TWO_PI (2.0 * M_PI)
+
+/* Prototypes for functions in novas.c */
+void sidereal_time (double jd_high, double jd_low, double ee,
+                    double *gst);
+void earthtilt (double tjd,
+                double *mobl, double *tobl, double *eq, double *dpsi,
+                double *deps);
+
+/*
+
+  U V W  G E O M E T R Y  I N I T
+
+  Set up a uvwGeometry structure for a site, with empty caches.
+*/
+void uvwGeometryInit(uvwGeometry *geometry, double longitude, double latitude)
+{
+  geometry->longitude = longitude;
+  geometry->sLat = sin(latitude);
+  geometry->cLat = cos(latitude);
+  geometry->julianDay = -1;
+  geometry->haveSource = FALSE;
+} /* End of uvwGeometryInit */
+
+/*
+
+  U V W  L S T
+
+  Return the LST, in radians, from the julian day number and the
+  number of seconds past 00:00:00.   earthtilt is only called when
+  the day changes.
+*/
+double uvwLST(uvwGeometry *geometry, long julianDay, double secs)
+{
+  double tjd_upper, tjd_lower;
+  double d1, gst, lst_radian;
+
+  tjd_lower = secs/24.0/3600.0;
+  tjd_upper = julianDay - 0.5;
+  if (geometry->julianDay != julianDay) {
+    double mobl, tobl, dpsi, deps;
+
+    earthtilt(tjd_upper, &mobl, &tobl, &geometry->equinoxes, &dpsi, &deps);
+    geometry->julianDay = julianDay;
+  }
+  sidereal_time(tjd_upper, tjd_lower, geometry->equinoxes, &gst);
+  d1 = gst * TWO_PI / 24.0 + geometry->longitude;
+  lst_radian = fmod(d1, TWO_PI);
+  if (lst_radian < 0.0)
+    lst_radian += TWO_PI;
+  return(lst_radian);
+} /* End of uvwLST */
+
+/*
+
+  U V W  A N T E N N A S
+
+  Calculate U, V and W for each of nAnt antennas, at each of nTimes
+  times (seconds past 00:00:00 on julianDay), for a source at ra, dec.
+  x, y and z hold the antenna positions.   The results are stored in
+  u, v and w, which must each hold nTimes*nAnt values, with time
+  varying slowest.   hourAngle, if not NULL, receives the hour angle
+  (radians, -pi to pi) for each time.   The coordinates of a baseline
+  are the difference of the values for its two antennas.
+*/
+void uvwAntennas(uvwGeometry *geometry, long julianDay, double ra, double dec,
+		 int nTimes, const double *secs, int nAnt,
+		 const double *x, const double *y, const double *z,
+		 double *hourAngle, double *u, double *v, double *w)
+{
+  int t, ant;
+  double sDec, cDec;
+
+  if (!geometry->haveSource || (geometry->dec != dec)) {
+    geometry->dec = dec;
+    geometry->sDec = sin(dec);
+    geometry->cDec = cos(dec);
+    geometry->haveSource = TRUE;
+  }
+  sDec = geometry->sDec;
+  cDec = geometry->cDec;
+  for (t = 0; t < nTimes; t++) {
+    double hA, sHA, cHA;
+    double uX, uY, vX, vY, vZ, wX, wY, wZ;
+    double *tU, *tV, *tW;
+
+    hA = uvwLST(geometry, julianDay, secs[t]) - ra;
+    while (hA < -M_PI)
+      hA += TWO_PI;
+    while (hA > M_PI)
+      hA -= TWO_PI;
+    if (hourAngle != NULL)
+      hourAngle[t] = hA;
+    sHA = sin(hA);
+    cHA = cos(hA);
+    uX =       sHA; uY =       cHA;
+    vX = -cHA*sDec; vY =  sHA*sDec; vZ = cDec;
+    wX =  cHA*cDec; wY = -sHA*cDec; wZ = sDec;
+    tU = &u[t*nAnt];
+    tV = &v[t*nAnt];
+    tW = &w[t*nAnt];
+    for (ant = 0; ant < nAnt; ant++) {
+      tU[ant] = uX*x[ant] + uY*y[ant];
+      tV[ant] = vX*x[ant] + vY*y[ant] + vZ*z[ant];
+      tW[ant] = wX*x[ant] + wY*y[ant] + wZ*z[ant];
+    }
+  }
+} /* End of uvwAntennas */
+
+/*
+
+  U V W  P A D  E N U
+
+  Rotate the antenna positions into the local east, north, up frame,
+  for use by mir.
+*/
+void uvwPadENU(uvwGeometry *geometry, int nAnt,
+	       const double *x, const double *y, const double *z,
+	       double *east, double *north, double *up)
+{
+  int ant;
+
+  for (ant = 0; ant < nAnt; ant++) {
+    east[ant]  =  y[ant];
+    north[ant] = -geometry->sLat*x[ant] + geometry->cLat*z[ant];
+    up[ant]    =  geometry->cLat*x[ant] + geometry->sLat*z[ant];
+  }
+} /* End of uvwPadENU */
@@ -0,0 +1,47 @@
+/*
+  uvwGeometry.h
+
+  Definitions for the projected baseline (U, V, W) calculation.
+
+  The expensive part of the calculation is the nutation series evaluated
+  by earthtilt to get the equation of the equinoxes.   dataCatcher only
+  ever evaluates it at 0h UT of the Julian day, so the result is cached
+  in a uvwGeometry structure and only recomputed when the day changes.
+  The trig terms for the site latitude and source declination are cached
+  in the same way, so that a scan, or a run of scans on one source, only
+  pays for a sidereal time and one sin/cos pair of the hour angle per
+  timestamp.
+
+  U, V and W are linear in the antenna position, so they are calculated
+  once per antenna, and the value for baseline ant1-ant2 is obtained as
+  the difference of the two antenna values.   uvwAntennas accepts a list
+  of timestamps, so that a caller regridding data offline can get the
+  coordinates for many integrations in one call.
+
+  A uvwGeometry structure must be set up with uvwGeometryInit before use,
+  and may only be used by one thread at a time.
+*/
+#ifndef UVW_GEOMETRY
+#define UVW_GEOMETRY
+
+typedef struct uvwGeometry {
+  double longitude;   /* Site east longitude (radians)                   */
+  double sLat, cLat;  /* Sine and cosine of the site latitude            */
+  long   julianDay;   /* Day for which equinoxes is valid, -1 if none    */
+  double equinoxes;   /* Equation of the equinoxes (hours)               */
+  int    haveSource;  /* TRUE once sDec and cDec have been set           */
+  double dec;         /* Declination for which sDec and cDec are valid   */
+  double sDec, cDec;
+} uvwGeometry;
+
+void uvwGeometryInit(uvwGeometry *geometry, double longitude, double latitude);
+double uvwLST(uvwGeometry *geometry, long julianDay, double secs);
+void uvwAntennas(uvwGeometry *geometry, long julianDay, double ra, double dec,
+		 int nTimes, const double *secs, int nAnt,
+		 const double *x, const double *y, const double *z,
+		 double *hourAngle, double *u, double *v, double *w);
+void uvwPadENU(uvwGeometry *geometry, int nAnt,
+	       const double *x, const double *y, const double *z,
+	       double *east, double *north, double *up);
+
+#endif
@@ -13,6 +13,10 @@ static void log_msg(int type, char *msg)
   static PyObject *logger = NULL;
   static PyObject *name = NULL;
   static PyObject *message = NULL;
+  PyGILState_STATE gilState;
+
+  // the sender thread in sendIntegration.c logs too, so take the GIL
+  gilState = PyGILState_Ensure();
 
   // import logging module on demand
   if (logging == NULL){
@@ -52,6 +56,7 @@ static void log_msg(int type, char *msg)
     }
   Py_DECREF(message);
   Py_DECREF(name);
+  PyGILState_Release(gilState);
 }
 
 int __wrap_printf(const char *format, ...)
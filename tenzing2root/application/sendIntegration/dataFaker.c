@@ -1,8 +1,42 @@
+/*
+  dataFaker.c
+
+    With no arguments, dataFaker sends one fake SWARM integration through
+sendIntegration, and exits.
+    With any of the options below it runs as a load generator, sending a
+fake integration every period seconds for duration seconds:
+
+    -a nAntennas   antennas 1..nAntennas           (default N_ANTENNAS)
+    -c nChunks     chunks per baseline             (default N_CHUNKS)
+    -n nChannels   channels per chunk              (default P_N_SWARM_CHANNELS)
+    -t period      seconds between integrations    (default 1.0)
+    -d duration    seconds to run for              (default 60.0)
+    -m mode        rpc   - sendIntegration, through its sender queue (default)
+                   batch - sendIntegrationBatch, straight to dataCatcher
+                   null  - copy the records as sendIntegration would, but
+                           send nothing, to see how fast dataFaker itself is
+
+    The spectra are computed before the run starts, LOAD_VARIANTS versions
+of each, with a fast vectorizable random number generator, so that the
+rate is limited by the sending and not by dataFaker.   If an integration
+falls more than one period behind schedule it is dropped.   At the end the
+achieved and target rates, the number of dropped integrations and failed
+calls, and the latency from each integration's scheduled time until its
+last record had been accepted are reported.   In rpc mode dataFaker then
+waits for sendIntegration's queue to empty, and reports the sender's own
+counters, including the latency until corrSaver acknowledged each record.
+    In both modes uT is sent in seconds since 0h UT, which is what the SWARM
+correlator sends and dataCatcher expects (dataFaker.py does the same).
+ */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
 #include <time.h>
 #include "chunkPlot.h"
+#include "swarmStream.h"
+#include "sendIntegration.h"
 
 #define N_ANTENNAS (8)
 #define N_SIDEBANDS (2)
@@ -11,6 +45,13 @@
 #define ERROR (-1)
 #define OK    ( 0)
 
+#define LOAD_VARIANTS (2)  /* Precomputed spectra per record, used in turn */
+#define FAKE_LANES    (8)  /* Independent generators in a fakeRNG         */
+#define MODE_RPC      (0)
+#define MODE_BATCH    (1)
+#define MODE_NULL     (2)
+#define SEND_FLUSH_TIMEOUT (30.0) /* Seconds to wait for sendIntegration's queue */
+
 float rand_gauss (void) {
   float v1,v2,s;
 
@@ -27,22 +68,303 @@ float rand_gauss (void) {
     return (v1*sqrt(-2.0 * log(s) / s));
 }
 
-int sendIntegration(int nPoints, double uT, float duration, int chunk,
-		    int ant1, int pol1, int ant2, int pol2,
-		    float *lsbCross, float *usbCross, int forceTransfer);
+/*
+  A xorshift generator with FAKE_LANES independent states, stepped
+  together so that the compiler can vectorize the loops.
+*/
+typedef struct fakeRNG {
+  unsigned int state[FAKE_LANES];
+} fakeRNG;
+
+void fakeRNGInit(fakeRNG *rng, unsigned int seed)
+{
+  int lane;
+
+  for (lane = 0; lane < FAKE_LANES; lane++) {
+    rng->state[lane] = seed*2654435761u + (lane+1)*0x9e3779b9u;
+    if (rng->state[lane] == 0)
+      rng->state[lane] = 1;
+  }
+}
+
+/*
+  Fills out with n roughly gaussian numbers of zero mean and unit
+  variance - each is the sum of four uniform deviates, scaled.
+*/
+void fakeGauss(fakeRNG *rng, float *out, int n)
+{
+  int i, k, lane;
+  unsigned int x[FAKE_LANES];
+  float sum[FAKE_LANES];
+
+  for (lane = 0; lane < FAKE_LANES; lane++)
+    x[lane] = rng->state[lane];
+  for (i = 0; i < n; i += FAKE_LANES) {
+    for (lane = 0; lane < FAKE_LANES; lane++)
+      sum[lane] = 0.0;
+    for (k = 0; k < 4; k++)
+      for (lane = 0; lane < FAKE_LANES; lane++) {
+	x[lane] ^= x[lane] << 13;
+	x[lane] ^= x[lane] >> 17;
+	x[lane] ^= x[lane] << 5;
+	sum[lane] += (float)(x[lane] >> 8) * (1.0f/16777216.0f);
+      }
+    for (lane = 0; (lane < FAKE_LANES) && (i+lane < n); lane++)
+      out[i+lane] = (sum[lane] - 2.0f) * 1.7320508f;
+  }
+  for (lane = 0; lane < FAKE_LANES; lane++)
+    rng->state[lane] = x[lane];
+}
+
+/*
+  The time now in seconds since 0h UT - the uT SWARM integrations carry.
+*/
+double uTNow(void)
+{
+  time_t wallClock;
+  struct tm *gm;
+
+  wallClock = time(NULL);
+  gm = gmtime(&wallClock);
+  return((double)(gm->tm_hour*3600 + gm->tm_min*60 + gm->tm_sec));
+}
+
+double monotonicNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return(((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9);
+}
+
+int compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return((x > y) - (x < y));
+}
+
+/*
+  Computes LOAD_VARIANTS versions of the spectra for every record - the
+  same shapes as the single integration mode, plus noise.
+*/
+int fakeSpectra(int nRecords, swarmStreamRecord *records, int nChannels,
+		float **lsb[LOAD_VARIANTS], float **usb[LOAD_VARIANTS])
+{
+  int record, variant, chan;
+  float *noise, amp, phase, a1, a2;
+  fakeRNG rng;
+
+  fakeRNGInit(&rng, (unsigned int)time(NULL));
+  if ((noise = (float *)malloc(4*nChannels*sizeof(float))) == NULL) {
+    perror("fakeSpectra: malloc of noise");
+    return(ERROR);
+  }
+  for (variant = 0; variant < LOAD_VARIANTS; variant++)
+    for (record = 0; record < nRecords; record++) {
+      int ant1 = records[record].ant1, ant2 = records[record].ant2;
+
+      lsb[variant][record] = (float *)malloc(2*nChannels*sizeof(float));
+      usb[variant][record] = (float *)malloc(2*nChannels*sizeof(float));
+      if ((lsb[variant][record] == NULL) || (usb[variant][record] == NULL)) {
+	perror("fakeSpectra: malloc of spectra");
+	free(noise);
+	return(ERROR);
+      }
+      fakeGauss(&rng, noise, 4*nChannels);
+      for (chan = 0; chan < nChannels; chan++) {
+	if (ant1 == ant2) {
+	  lsb[variant][record][2*chan] = 1000.0 + noise[chan] +
+	    sin(2.0*M_PI*(float)(ant1*chan)/((float)(nChannels-1)));
+	  lsb[variant][record][2*chan+1] = 0.0;
+	  usb[variant][record][2*chan] = usb[variant][record][2*chan+1] = 0.0;
+	} else {
+	  a1 = (float)ant1;
+	  a2 = ((float)ant2)*((float)chan)/((float)(nChannels-1));
+	  phase = M_PI*sin(2.0*M_PI*((float)(records[record].chunk+1))*((float)(chan*ant1*ant2))/((float)(nChannels-1)));
+	  amp = 10.0*a1*a2;
+	  lsb[variant][record][2*chan]   = amp*cos(phase) + noise[4*chan];
+	  lsb[variant][record][2*chan+1] = amp*sin(phase) + noise[4*chan+1];
+	  amp *= a2;
+	  usb[variant][record][2*chan]   = amp*cos(phase) + noise[4*chan+2];
+	  usb[variant][record][2*chan+1] = amp*sin(phase) + noise[4*chan+3];
+	}
+      }
+    }
+  free(noise);
+  return(OK);
+}
+
+/*
+  Runs dataFaker as a load generator - see the description at the top.
+*/
+int loadTest(int nAntennas, int nChunks, int nChannels, double period, double duration, int mode)
+{
+  int i, ant1, ant2, chunk, record, nRecords, nIntegrations, integration, variant;
+  int nSent = 0, nDropped = 0, nFailed = 0, nRecordsSent = 0;
+  double start, scheduled, wait, uT0, elapsed, *latency, latencySum = 0.0;
+  double recordBytes = 0.0;
+  swarmStreamRecord *records;
+  float **lsb[LOAD_VARIANTS], **usb[LOAD_VARIANTS];
+  static pSWARMUVBlock standIn;
+
+  nRecords = nChunks*(nAntennas*(nAntennas+1))/2;
+  nIntegrations = (int)(duration/period);
+  records = (swarmStreamRecord *)malloc(nRecords*sizeof(swarmStreamRecord));
+  latency = (double *)malloc((nIntegrations+1)*sizeof(double));
+  if ((records == NULL) || (latency == NULL)) {
+    perror("loadTest: malloc");
+    return(ERROR);
+  }
+  for (variant = 0; variant < LOAD_VARIANTS; variant++) {
+    lsb[variant] = (float **)malloc(nRecords*sizeof(float *));
+    usb[variant] = (float **)malloc(nRecords*sizeof(float *));
+    if ((lsb[variant] == NULL) || (usb[variant] == NULL)) {
+      perror("loadTest: malloc of spectrum lists");
+      return(ERROR);
+    }
+  }
+  record = 0;
+  for (chunk = 0; chunk < nChunks; chunk++)
+    for (ant1 = 1; ant1 <= nAntennas; ant1++)
+      for (ant2 = ant1; ant2 <= nAntennas; ant2++) {
+	records[record].ant1 = ant1;
+	records[record].ant2 = ant2;
+	records[record].pol1 = records[record].pol2 = 0;
+	records[record].chunk = chunk;
+	records[record].nChannels = nChannels;
+	recordBytes += ((ant1 == ant2)? 1: 4)*nChannels*sizeof(float);
+	record++;
+      }
+  printf("Computing %d versions of %d records of %d channels\n", LOAD_VARIANTS, nRecords, nChannels);
+  if (fakeSpectra(nRecords, records, nChannels, lsb, usb) != OK)
+    return(ERROR);
+  printf("Sending %d integrations of %d records, every %.3f seconds\n",
+	 nIntegrations, nRecords, period);
+  uT0 = uTNow();
+  start = monotonicNow();
+  for (integration = 0; integration < nIntegrations; integration++) {
+    double uT;
+
+    scheduled = start + integration*period;
+    wait = scheduled - monotonicNow();
+    if (wait > 0.0)
+      usleep((useconds_t)(wait*1.0e6));
+    else if (-wait > period) {
+      nDropped++;
+      continue;
+    }
+    uT = uT0 + integration*period;
+    variant = integration % LOAD_VARIANTS;
+    switch (mode) {
+    case MODE_BATCH:
+      if (sendIntegrationBatch(nRecords, uT, (float)period, records,
+			       lsb[variant], usb[variant], TRUE) != OK)
+	nFailed++;
+      break;
+    default:
+      for (record = 0; record < nRecords; record++) {
+	if (mode == MODE_NULL) {
+	  standIn.nChannels = nChannels;
+	  standIn.uT = uT;
+	  standIn.ant1 = records[record].ant1;
+	  standIn.ant2 = records[record].ant2;
+	  standIn.chunk = records[record].chunk;
+	  if (records[record].ant1 == records[record].ant2)
+	    for (i = 0; i < nChannels; i++)
+	      standIn.lSB[i] = lsb[variant][record][2*i];
+	  else {
+	    memcpy(standIn.lSB, lsb[variant][record], 2*nChannels*sizeof(float));
+	    memcpy(standIn.uSB, usb[variant][record], 2*nChannels*sizeof(float));
+	  }
+	} else if (sendIntegration(nChannels, uT, (float)period, records[record].chunk,
+				   records[record].ant1, 0, records[record].ant2, 0,
+				   lsb[variant][record], usb[variant][record], TRUE) != OK)
+	  nFailed++;
+      }
+    }
+    latency[nSent] = monotonicNow() - scheduled;
+    latencySum += latency[nSent];
+    nSent++;
+    nRecordsSent += nRecords;
+  }
+  /* The run lasts at least until the end of the last integration's period */
+  elapsed = monotonicNow() - start;
+  if (elapsed < nIntegrations*period)
+    elapsed = nIntegrations*period;
+  printf("%d integrations sent, %d dropped, %d failed calls, in %.3f seconds\n",
+	 nSent, nDropped, nFailed, elapsed);
+  printf("Target:   %10.2f integrations/s %10.1f records/s %10.3f MB/s\n",
+	 1.0/period, nRecords/period, recordBytes/period/1.0e6);
+  printf("Achieved: %10.2f integrations/s %10.1f records/s %10.3f MB/s\n",
+	 nSent/elapsed, nRecordsSent/elapsed, nSent*recordBytes/elapsed/1.0e6);
+  if (nSent > 0) {
+    qsort(latency, nSent, sizeof(double), compareDoubles);
+    printf("Latency:  mean %.3f ms, median %.3f ms, 99%% %.3f ms, max %.3f ms\n",
+	   1.0e3*latencySum/nSent, 1.0e3*latency[nSent/2],
+	   1.0e3*latency[(int)(0.99*(nSent-1))], 1.0e3*latency[nSent-1]);
+  }
+  if (mode == MODE_RPC) {
+    sendIntegrationStats stats;
 
-int main()
+    if (sendIntegrationFlush(SEND_FLUSH_TIMEOUT) != OK)
+      fprintf(stderr, "Records were still queued after %.1f seconds\n", SEND_FLUSH_TIMEOUT);
+    sendIntegrationGetStats(&stats);
+    printf("Sender:   %llu queued, %llu sent, %llu dropped (queue full), %llu failed, %llu connections\n",
+	   stats.queued, stats.sent, stats.dropped, stats.failed, stats.reconnects);
+    printf("Sender:   queue depth max %d, acknowledged after mean %.3f ms, max %.3f ms\n",
+	   stats.maxQueueDepth, (stats.sent > 0)? 1.0e3*stats.latencySum/(double)stats.sent: 0.0,
+	   1.0e3*stats.latencyMax);
+    if (stats.sent != stats.queued)
+      nFailed++;
+  }
+  return(((nDropped == 0) && (nFailed == 0))? OK: ERROR);
+}
+
+int main(int argc, char **argv)
 {
   int ant1, ant2, sb, chunk, chan;
   float upper[2*P_N_SWARM_CHANNELS], lower[2*P_N_SWARM_CHANNELS], auto1[P_N_SWARM_CHANNELS], auto2[P_N_SWARM_CHANNELS], amp, phase;
   double uT, dRand;
-  time_t timeNow;
-  struct tm *gm;
 
-  timeNow = time(NULL);
-  gm = gmtime(&timeNow);
-  srand((unsigned int)timeNow);
-  uT = (float)gm->tm_hour + ((float)gm->tm_min)/60.0 + ((float)gm->tm_sec)/3600.0;
+  if (argc > 1) {
+    int option, nAntennas = N_ANTENNAS, nChunks = N_CHUNKS, nChannels = P_N_SWARM_CHANNELS;
+    int mode = MODE_RPC;
+    double period = 1.0, duration = 60.0;
+
+    while ((option = getopt(argc, argv, "a:c:n:t:d:m:")) != -1)
+      switch (option) {
+      case 'a': nAntennas = atoi(optarg); break;
+      case 'c': nChunks = atoi(optarg); break;
+      case 'n': nChannels = atoi(optarg); break;
+      case 't': period = atof(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 'm':
+	if (!strcmp(optarg, "rpc"))
+	  mode = MODE_RPC;
+	else if (!strcmp(optarg, "batch"))
+	  mode = MODE_BATCH;
+	else if (!strcmp(optarg, "null"))
+	  mode = MODE_NULL;
+	else
+	  nAntennas = 0;
+	break;
+      default:
+	nAntennas = 0;
+      }
+    if ((nAntennas < 1) || (nAntennas > N_ANTENNAS) || (nChunks < 1) || (nChunks > N_CHUNKS) ||
+	(nChannels < 2) || (nChannels > P_N_SWARM_CHANNELS) || (period <= 0.0) ||
+	(duration < period) || (optind != argc)) {
+      fprintf(stderr, "Usage: %s [-a nAntennas (1-%d)] [-c nChunks (1-%d)] [-n nChannels (2-%d)]\n"
+	      "       [-t period] [-d duration] [-m rpc|batch|null]\n"
+	      "uT is sent in seconds since 0h UT, as the SWARM correlator sends it.\n",
+	      argv[0], N_ANTENNAS, N_CHUNKS, P_N_SWARM_CHANNELS);
+      return(ERROR);
+    }
+    return(loadTest(nAntennas, nChunks, nChannels, period, duration, mode));
+  }
+  srand((unsigned int)time(NULL));
+  uT = uTNow();
   for (ant1 = 1; ant1 <= N_ANTENNAS; ant1++) {
     for (chan = 0; chan < P_N_SWARM_CHANNELS; chan++) {
       lower[2*chan] = rand_gauss() + sin(2.0*M_PI*(float)(ant1*chan)/((float)(P_N_SWARM_CHANNELS-1)));
@@ -83,5 +405,8 @@ int main()
       }
     }
   }
+  /* sendIntegration only queues the records - wait until they've gone */
+  if (sendIntegrationFlush(SEND_FLUSH_TIMEOUT) != OK)
+    return ERROR;
   return OK;
 }
@@ -1,12 +1,10 @@
 #include <Python.h>
+#include <pythread.h>
+#include "sendIntegration.h"
 
-/* Format string for PyArg_ParseTuple */
+/* Format strings for PyArg_ParseTuple */
 #define SI_ARG_FORMAT "dfiiiiiOOi"
-
-/* Function prototype for sendIntegration */
-int sendIntegration(int nPoints, double uT, float duration, int chunk,
-		    int ant1, int pol1, int ant2, int pol2,
-		    float *lsbCross, float *usbCross, int forceTransfer);
+#define SIB_ARG_FORMAT "dfOi"
 
 /* Function prototype for sendSync */
 int sendSync(void);
@@ -16,11 +14,174 @@ send_sync(PyObject *self, PyObject *args)
 {
   int sts; // return value
 
+  Py_BEGIN_ALLOW_THREADS
   sts = sendSync();
+  Py_END_ALLOW_THREADS
+
+  return Py_BuildValue("i", sts);
+}
+
+static PyObject *
+send_flush(PyObject *self, PyObject *args)
+{
+  double timeout = 10.0;
+  int sts; // return value
+
+  if (!PyArg_ParseTuple(args, "|d", &timeout))
+    return NULL;
+
+  /* The sender thread may need the GIL to log while we wait */
+  Py_BEGIN_ALLOW_THREADS
+  sts = sendIntegrationFlush(timeout);
+  Py_END_ALLOW_THREADS
 
   return Py_BuildValue("i", sts);
 }
 
+static PyObject *
+send_stats(PyObject *self, PyObject *args)
+{
+  sendIntegrationStats stats;
+
+  sendIntegrationGetStats(&stats);
+
+  return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:i,s:i,s:d,s:d}",
+		       "queued", stats.queued,
+		       "sent", stats.sent,
+		       "dropped", stats.dropped,
+		       "failed", stats.failed,
+		       "reconnects", stats.reconnects,
+		       "queue_depth", stats.queueDepth,
+		       "max_queue_depth", stats.maxQueueDepth,
+		       "latency_mean", (stats.sent > 0)? stats.latencySum/(double)stats.sent: 0.0,
+		       "latency_max", stats.latencyMax);
+}
+
+/* A spectrum passed from Python, either borrowed from a buffer or copied */
+typedef struct spectrum {
+  Py_buffer view;   // the exported buffer, if view.obj != NULL
+  float *data;      // the floats themselves
+  Py_ssize_t len;   // number of floats
+  int copied;       // TRUE if data was malloced here
+} spectrum;
+
+/*
+  Get the floats in obj.   A C-contiguous buffer of 4 byte floats
+  (a numpy float32 array, or array.array('f')) is used where it is,
+  without copying it.   A strided one (a slice of a float32 array, say)
+  is gathered into a malloced array, with no conversion.   Anything else
+  must be a sequence of Python floats, which is converted into a
+  malloced array.   Returns 0, or -1 with a Python exception set.
+*/
+static int
+spectrum_get(PyObject *obj, spectrum *spec, const char *name)
+{
+  Py_ssize_t i;
+  PyObject *item;
+
+  spec->view.obj = NULL;
+  spec->data = NULL;
+  spec->copied = 0;
+
+  if (PyObject_CheckBuffer(obj)) {
+    if (PyObject_GetBuffer(obj, &spec->view, PyBUF_STRIDES | PyBUF_FORMAT) == 0) {
+      if ((spec->view.itemsize == sizeof(float)) && (spec->view.format != NULL) &&
+	  (!strcmp(spec->view.format, "f") || !strcmp(spec->view.format, "<f") ||
+	   !strcmp(spec->view.format, "=f"))) {
+	spec->len = spec->view.len / sizeof(float);
+	if (PyBuffer_IsContiguous(&spec->view, 'C')) {
+	  spec->data = (float *) spec->view.buf;
+	  return 0;
+	}
+	spec->data = (float *) malloc(sizeof(float) * (spec->len > 0 ? spec->len : 1));
+	if (spec->data == NULL) {
+	  PyErr_SetString(PyExc_MemoryError, "Problem malloc array data!");
+	  return -1;
+	}
+	spec->copied = 1;
+	return PyBuffer_ToContiguous(spec->data, &spec->view, spec->view.len, 'C');
+      }
+      PyBuffer_Release(&spec->view);
+      spec->view.obj = NULL;
+    } else
+      PyErr_Clear(); // no strided buffer - try it as a sequence
+  }
+
+  /* Make sure obj is a sequence */
+  if (!PySequence_Check(obj)) {
+    PyErr_Format(PyExc_TypeError, "%s argument must be a float32 buffer or a sequence!", name);
+    return -1;
+  }
+
+  /* Malloc the array, and populate it */
+  spec->len = PySequence_Size(obj);
+  spec->data = (float *) malloc(sizeof(float) * (spec->len > 0 ? spec->len : 1));
+  if (spec->data == NULL) {
+    PyErr_SetString(PyExc_MemoryError, "Problem malloc array data!");
+    return -1;
+  }
+  spec->copied = 1;
+  for (i=0; i<spec->len; i++) {
+
+    /* Get the item from the array */
+    item = PySequence_GetItem(obj, i);
+    if ((item == NULL) || !PyFloat_Check(item)) {
+      PyErr_SetString(PyExc_TypeError, "Array items must be floats!");
+      Py_XDECREF(item); // clean-up
+      return -1;
+    }
+
+    /* Convert to a C float */
+    spec->data[i] = (float) PyFloat_AsDouble(item);
+    Py_DECREF(item); // final clean-up
+    if (PyErr_Occurred()) {
+      PyErr_SetString(PyExc_TypeError, "Error occurred converting to C float!");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Free whatever spectrum_get took, whether or not it succeeded */
+static void
+spectrum_release(spectrum *spec)
+{
+  if (spec->view.obj != NULL)
+    PyBuffer_Release(&spec->view);
+  spec->view.obj = NULL;
+  if (spec->copied)
+    free(spec->data);
+  spec->copied = 0;
+}
+
+/*
+  Get both spectra for one baseline, and make sure they're the same,
+  even, length.   Returns the number of channels, or -1 with a Python
+  exception set.
+*/
+static int
+spectra_get(PyObject *lsbCrossObj, PyObject *usbCrossObj, spectrum *lsb, spectrum *usb)
+{
+  usb->view.obj = NULL;
+  usb->copied = 0;
+  if ((spectrum_get(lsbCrossObj, lsb, "lsbCross") < 0) ||
+      (spectrum_get(usbCrossObj, usb, "usbCross") < 0))
+    return -1;
+
+  /* Make sure they're the same length */
+  if (lsb->len != usb->len) {
+    PyErr_SetString(PyExc_TypeError, "lsbCross and usbCross must be the same length!");
+    return -1;
+  }
+
+  /* Make sure lengths are divisible by 2 */
+  if (lsb->len % 2 != 0) {
+    PyErr_SetString(PyExc_TypeError, "lsbCross/usbCross length must be divisible by 2!");
+    return -1;
+  }
+  return (int) (lsb->len/2);
+}
+
 static PyObject *
 send_integration(PyObject *self, PyObject *args)
 {
@@ -31,14 +192,12 @@ send_integration(PyObject *self, PyObject *args)
   int chunk;
   int ant1, pol1;
   int ant2, pol2;
-  float *lsbCross, *usbCross;
   int forceTransfer;
   int sts; // return value
 
-  /* Variables for parsing the arrays */
-  int i, lsbCrossLen, usbCrossLen;
+  /* Variables for getting the spectra */
   PyObject *lsbCrossObj, *usbCrossObj;
-  PyObject *lsbCrossItem, *usbCrossItem;
+  spectrum lsbCross, usbCross;
 
   /* Parse the arguments from Python */
   if (!PyArg_ParseTuple(args, SI_ARG_FORMAT, 
@@ -47,108 +206,136 @@ send_integration(PyObject *self, PyObject *args)
 			&lsbCrossObj, &usbCrossObj, &forceTransfer))
     return NULL;
 
-  /* Make sure lsbCrossObj is a sequence */
-  if (!PySequence_Check(lsbCrossObj)) {
-    PyErr_SetString(PyExc_TypeError, "lsbCross argument must be a sequence!");
+  /* Get the spectra, converting them only if they aren't float32 buffers */
+  if ((nPoints = spectra_get(lsbCrossObj, usbCrossObj, &lsbCross, &usbCross)) < 0) {
+    spectrum_release(&lsbCross);
+    spectrum_release(&usbCross);
     return NULL;
   }
 
-  /* Make sure usbCrossObj is a sequence */
-  if (!PySequence_Check(usbCrossObj)) {
-    PyErr_SetString(PyExc_TypeError, "usbCross argument must be a sequence!");
-    return NULL;
-  }
+  /* Let the other Python threads run while the data are sent */
+  Py_BEGIN_ALLOW_THREADS
+  sts = sendIntegration(nPoints, uT, duration, chunk,
+			ant1, pol1, ant2, pol2,
+			lsbCross.data, usbCross.data, forceTransfer);
+  Py_END_ALLOW_THREADS
 
-  /* Get lengths of lsb and usb sequences 
-   and make sure they're the same length */
-  lsbCrossLen = PySequence_Size(lsbCrossObj);
-  usbCrossLen = PySequence_Size(usbCrossObj);
-  if (lsbCrossLen != usbCrossLen) {
-    PyErr_SetString(PyExc_TypeError, "lsbCross and usbCross must be the same length!");
+  spectrum_release(&lsbCross);
+  spectrum_release(&usbCross);
+
+  return Py_BuildValue("i", sts);
+}
+
+static PyObject *
+send_integrations(PyObject *self, PyObject *args)
+{
+  /* Parameters for sendIntegrationBatch */
+  int nRecords;
+  double uT;
+  float duration;
+  swarmStreamRecord *records = NULL;
+  float **lsbCross = NULL, **usbCross = NULL;
+  int forceTransfer;
+  int sts; // return value
+
+  /* Variables for parsing the list of baselines */
+  int i, nGot = 0;
+  PyObject *baselinesObj, *baselineObj;
+  PyObject *lsbCrossObj, *usbCrossObj;
+  spectrum *spectra = NULL;
+  PyObject *result = NULL;
+
+  /* sendIntegrationBatch keeps its connection in statics */
+  static PyThread_type_lock batchLock = NULL;
+
+  /* Parse the arguments from Python */
+  if (!PyArg_ParseTuple(args, SIB_ARG_FORMAT, &uT, &duration, &baselinesObj, &forceTransfer))
     return NULL;
-  } 
 
-  /* Make sure sequence lengths are divisible by 2 */
-  if (lsbCrossLen % 2 != 0) {
-    PyErr_SetString(PyExc_TypeError, "lsbCross/usbCross length must be divisible by 2!");
+  /* Make sure baselinesObj is a sequence */
+  if (!PySequence_Check(baselinesObj)) {
+    PyErr_SetString(PyExc_TypeError, "baselines argument must be a sequence!");
     return NULL;
   }
-   
-  /* Finally set nPoints */
-  nPoints = lsbCrossLen/2;
+  nRecords = (int) PySequence_Size(baselinesObj);
+  if (nRecords <= 0)
+    return Py_BuildValue("i", 0);
 
   /* Malloc the arrays we need to send */
-  lsbCross = (float *) malloc(sizeof(float) * nPoints * 2);
-  usbCross = (float *) malloc(sizeof(float) * nPoints * 2);
-  if ((lsbCross == NULL) || (usbCross == NULL)) {
-    PyErr_SetString(PyExc_TypeError, "Problem malloc array data!");
-    return NULL;
+  records = (swarmStreamRecord *) malloc(sizeof(swarmStreamRecord) * nRecords);
+  lsbCross = (float **) malloc(sizeof(float *) * nRecords);
+  usbCross = (float **) malloc(sizeof(float *) * nRecords);
+  spectra = (spectrum *) malloc(sizeof(spectrum) * 2 * nRecords);
+  if ((records == NULL) || (lsbCross == NULL) || (usbCross == NULL) || (spectra == NULL)) {
+    PyErr_SetString(PyExc_MemoryError, "Problem malloc array data!");
+    goto done;
   }
 
-  /* Now populate the lsbCross data */
-  for (i=0; i<nPoints*2; i++) {
-
-    /* Get the item from the array */
-    lsbCrossItem = PySequence_GetItem(lsbCrossObj, i);
-    if (!PyFloat_Check(lsbCrossItem)) {
-      PyErr_SetString(PyExc_TypeError, "Array items must be floats!");
-      Py_DECREF(lsbCrossItem); // clean-up
-      return NULL;
+  /* Each baseline is (chunk, ant1, pol1, ant2, pol2, lsbCross, usbCross) */
+  for (nGot=0; nGot<nRecords; nGot++) {
+    baselineObj = PySequence_GetItem(baselinesObj, nGot);
+    if (baselineObj == NULL)
+      goto done;
+    if (!PyArg_ParseTuple(baselineObj, "iiiiiOO",
+			  &records[nGot].chunk,
+			  &records[nGot].ant1, &records[nGot].pol1,
+			  &records[nGot].ant2, &records[nGot].pol2,
+			  &lsbCrossObj, &usbCrossObj)) {
+      Py_DECREF(baselineObj);
+      goto done;
     }
-
-    /* Convert to a C float */
-    lsbCross[i] = (float) PyFloat_AsDouble(lsbCrossItem);
-    if (PyErr_Occurred()) {
-      PyErr_SetString(PyExc_TypeError, "Error occurred converting to C float!");
-      Py_DECREF(lsbCrossItem); // clean-up
-      return NULL;
+    records[nGot].nChannels = spectra_get(lsbCrossObj, usbCrossObj,
+					  &spectra[2*nGot], &spectra[2*nGot+1]);
+    Py_DECREF(baselineObj); // the spectra hold their own references
+    if (records[nGot].nChannels < 0) {
+      nGot++; // so they're released below
+      goto done;
     }
-
-    Py_DECREF(lsbCrossItem); // final clean-up
-
+    lsbCross[nGot] = spectra[2*nGot].data;
+    usbCross[nGot] = spectra[2*nGot+1].data;
   }
- 
-  /* Now populate the usbCross data */
-  for (i=0; i<nPoints*2; i++) {
 
-    /* Get the item from the array */
-    usbCrossItem = PySequence_GetItem(usbCrossObj, i);
-    if (!PyFloat_Check(usbCrossItem)) {
-      PyErr_SetString(PyExc_TypeError, "Array items must be floats!");
-      Py_DECREF(usbCrossItem); // clean-up
-      return NULL;
-    }
+  if (batchLock == NULL)
+    batchLock = PyThread_allocate_lock();
 
-    /* Convert to a C float */
-    usbCross[i] = (float) PyFloat_AsDouble(usbCrossItem);
-    if (PyErr_Occurred()) {
-      PyErr_SetString(PyExc_TypeError, "Error occurred converting to C float!");
-      Py_DECREF(usbCrossItem); // clean-up
-      return NULL;
-    }
+  /* Let the other Python threads run while the data are sent */
+  Py_BEGIN_ALLOW_THREADS
+  PyThread_acquire_lock(batchLock, WAIT_LOCK);
+  sts = sendIntegrationBatch(nRecords, uT, duration, records, lsbCross, usbCross, forceTransfer);
+  PyThread_release_lock(batchLock);
+  Py_END_ALLOW_THREADS
 
-    Py_DECREF(usbCrossItem); // final clean-up
+  result = Py_BuildValue("i", sts);
 
+ done:
+  for (i=0; i<nGot; i++) {
+    spectrum_release(&spectra[2*i]);
+    spectrum_release(&spectra[2*i+1]);
   }
-
-  sts = sendIntegration(nPoints, uT, duration, chunk,
-			ant1, pol1, ant2, pol2,
-			lsbCross, usbCross, forceTransfer);
-
-  /* Free the malloced memory */
+  free(spectra);
+  free(records);
   free(lsbCross);
   free(usbCross);
-
-  return Py_BuildValue("i", sts);
+  return result;
 }
 
 
 static PyMethodDef SendIntMethods[] = {
 
   {"send_integration", send_integration, METH_VARARGS,
-   "Send an integration."},
+   "Send an integration to corrSaver.  The spectra may be float32 arrays,\n"
+   "which need no conversion copy (strided ones are gathered first), or\n"
+   "sequences of floats."},
+  {"send_integrations", send_integrations, METH_VARARGS,
+   "send_integrations(uT, duration, baselines, forceTransfer)\n"
+   "Send many baselines of one integration straight to dataCatcher.  Each\n"
+   "baseline is (chunk, ant1, pol1, ant2, pol2, lsbCross, usbCross)."},
   {"send_sync", send_sync, METH_NOARGS,
    "Send a sync-only to dataCatcher."},
+  {"send_flush", send_flush, METH_VARARGS,
+   "Wait (up to timeout seconds) for queued integrations to be sent."},
+  {"send_stats", send_stats, METH_NOARGS,
+   "Get the integration sender's counters as a dict."},
   {NULL, NULL, 0, NULL}
 };
 
@@ -156,5 +343,7 @@ static PyMethodDef SendIntMethods[] = {
 PyMODINIT_FUNC
 initpysendint(void)
 {
+  /* sendIntegration's sender thread logs through Python */
+  PyEval_InitThreads();
   (void) Py_InitModule("pysendint", SendIntMethods);
 }
@@ -10,12 +10,40 @@ calls.   By default this function will not transmit data for baselines
 which include an antenna which is not in the array.   The forceTransfer
 parameter allows the caller to force the data to be transmitted whether or not
 the antennas are in the project.
+    sendIntegration only copies the record into a queue of SEND_QUEUE_SIZE
+records and returns.   A sender thread, started (and the queue allocated) on
+the first call, sends the queued records to corrSaver over one persistent
+connection.   Up to
+SEND_WINDOW records are sent as batched RPC calls, which don't wait for a
+reply, and the last record of each window is sent as an ordinary call, whose
+reply acknowledges the whole window.   If the connection fails, the records
+in the window are counted as failed (they may have been stored, so they are
+not resent), and the thread reconnects, backing off from SEND_MIN_BACKOFF to
+SEND_MAX_BACKOFF seconds between attempts.   If the queue is full, the record
+is dropped and sendIntegration returns ERROR, so that the caller is never
+held up by the network.   sendIntegrationGetStats returns the sender's
+counters, and sendIntegrationFlush waits for the queue to empty.
+    sendIntegrationBatch sends many baselines of one integration straight to
+dataCatcher in one go, over the TCP stream described in swarmStream.h.
 
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 #include <rpc/rpc.h>
 #include "chunkPlot.h"
+#include "dataCatcher.h"
+#include "swarmStream.h"
+#include "sendIntegration.h"
 
 #define N_ANTENNAS (8)
 #define N_SIDEBANDS (2)
@@ -24,6 +52,14 @@ the antennas are in the project.
 #define ERROR (-1)
 #define OK    ( 0)
 
+#define DATA_CATCHER_HOST "hcn"
+#define CORR_SAVER_HOST   "obscon"
+
+#define SEND_QUEUE_SIZE   (144)  /* Two integrations of 8 antennas, 2 chunks    */
+#define SEND_WINDOW       (8)    /* Records sent per acknowledged RPC call      */
+#define SEND_MIN_BACKOFF  (0.1)  /* Seconds between reconnection attempts ...   */
+#define SEND_MAX_BACKOFF  (10.0) /* ... doubling each time, up to this          */
+
 int getAntennaList(int *list);
 
 int printResults(statusStructure *results)
@@ -38,50 +74,482 @@ int printResults(statusStructure *results)
   return(OK);
 }
 
-pSWARMUVBlock sWARMData;
+/*
+  The queue between sendIntegration and the sender thread.   Slots
+  sendHead .. sendHead+sendCount-1 (modulo SEND_QUEUE_SIZE) are taken.
+  sendIntegration takes a slot, copies its record in without holding
+  sendMutex, and then marks it ready - the sender thread only sends
+  ready records, from sendHead on.   It keeps the records it is sending
+  in the queue until they've been acknowledged, so sendIntegration can't
+  overwrite them.   The queue (about 256 kB a record) is only allocated
+  once sendIntegration is called.
+*/
+pSWARMUVBlock *sendQueue = NULL;
+double sendQueueTime[SEND_QUEUE_SIZE];   /* When each record was queued */
+int sendReady[SEND_QUEUE_SIZE];          /* Record has been copied in   */
+int sendHead = 0, sendCount = 0;
+sendIntegrationStats sendStats;
+pthread_mutex_t sendMutex = PTHREAD_MUTEX_INITIALIZER;    /* Protects all the above  */
+pthread_cond_t sendReadyCond = PTHREAD_COND_INITIALIZER;  /* Signalled when queued   */
+pthread_cond_t sendDoneCond = PTHREAD_COND_INITIALIZER;   /* Signalled when dequeued */
+pthread_once_t senderOnce = PTHREAD_ONCE_INIT;
+pthread_t senderTId;
+int senderRunning = FALSE;
+
+double sendTimeNow(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return(((double)now.tv_sec) + ((double)now.tv_nsec)*1.0e-9);
+}
+
+/*
+  The sender thread - sends queued records to corrSaver, SEND_WINDOW at
+  a time, as described at the top of this file.
+*/
+void *sender(void *arg)
+{
+  int i, n, first, ok;
+  double backoff = SEND_MIN_BACKOFF, now;
+  CLIENT *corrSaverCl = NULL;
+  struct timeval batched = {0, 0};
+
+  while (TRUE) {
+    pthread_mutex_lock(&sendMutex);
+    while ((sendCount == 0) || !sendReady[sendHead])
+      pthread_cond_wait(&sendReadyCond, &sendMutex);
+    first = sendHead;
+    for (n = 1; (n < SEND_WINDOW) && (n < sendCount) && sendReady[(first+n) % SEND_QUEUE_SIZE]; n++);
+    pthread_mutex_unlock(&sendMutex);
+
+    if (corrSaverCl == NULL) {
+      if (!(corrSaverCl = clnt_create(CORR_SAVER_HOST, CHUNKPLOTPROG, CHUNKPLOTVERS, "tcp"))) {
+	fprintf(stderr, clnt_spcreateerror(CORR_SAVER_HOST));
+	usleep((useconds_t)(backoff*1.0e6));
+	backoff *= 2.0;
+	if (backoff > SEND_MAX_BACKOFF)
+	  backoff = SEND_MAX_BACKOFF;
+	continue;
+      }
+      pthread_mutex_lock(&sendMutex);
+      sendStats.reconnects++;
+      pthread_mutex_unlock(&sendMutex);
+    }
+
+    /* Don't split a window across the end of the queue */
+    if (first + n > SEND_QUEUE_SIZE)
+      n = SEND_QUEUE_SIZE - first;
+    ok = TRUE;
+    for (i = first; ok && (i < first+n-1); i++)
+      if (clnt_call(corrSaverCl, PLOT_SWARM_DATA, (xdrproc_t)xdr_pSWARMUVBlock, (caddr_t)&sendQueue[i],
+		    (xdrproc_t)NULL, NULL, batched) != RPC_SUCCESS)
+	ok = FALSE;
+    if (ok && printResults(plot_swarm_data_1(&sendQueue[first+n-1], corrSaverCl)))
+      ok = FALSE;
+    if (ok)
+      backoff = SEND_MIN_BACKOFF;
+    else {
+      fprintf(stderr, "Error returned from corrPlotter call\n");
+      clnt_destroy(corrSaverCl);
+      corrSaverCl = NULL;
+    }
+
+    now = sendTimeNow();
+    pthread_mutex_lock(&sendMutex);
+    if (ok) {
+      sendStats.sent += n;
+      for (i = first; i < first+n; i++) {
+	sendStats.latencySum += now - sendQueueTime[i];
+	if (now - sendQueueTime[i] > sendStats.latencyMax)
+	  sendStats.latencyMax = now - sendQueueTime[i];
+      }
+    } else
+      sendStats.failed += n;
+    for (i = first; i < first+n; i++)
+      sendReady[i] = FALSE;
+    sendHead = (sendHead + n) % SEND_QUEUE_SIZE;
+    sendCount -= n;
+    sendStats.queueDepth = sendCount;
+    pthread_cond_broadcast(&sendDoneCond);
+    pthread_mutex_unlock(&sendMutex);
+  }
+  return(NULL);
+}
+
+void startSender(void)
+{
+  sendQueue = (pSWARMUVBlock *)malloc(SEND_QUEUE_SIZE*sizeof(pSWARMUVBlock));
+  if (sendQueue == NULL)
+    perror("startSender: malloc of sendQueue");
+  else if (pthread_create(&senderTId, NULL, sender, NULL) != 0)
+    perror("startSender: pthread_create");
+  else
+    senderRunning = TRUE;
+}
 
 int sendIntegration(int nPoints, double uT, float duration, int chunk,
 		    int ant1, int pol1, int ant2, int pol2,
 		    float *lsbCross, float *usbCross, int forceTransfer)
 {
-  int i, antennaInArray[11];
-  static CLIENT *corrSaverCl = NULL;
+  int i, slot;
+  static int antennaInArray[11];
+  static int antennaInArrayInitialized = FALSE;
+  pSWARMUVBlock *sWARMData;
 
+  if ((nPoints <= 0) || (nPoints > P_N_SWARM_CHANNELS)) {
+    fprintf(stderr, "sendIntegration called with illegal number of points (%d)\n", nPoints);
+    return(ERROR);
+  }
+  if ((ant1 < 0) || (ant1 > 10) || (ant2 < 0) || (ant2 > 10)) {
+    fprintf(stderr, "sendIntegration called with illegal antenna numbers (%d, %d)\n", ant1, ant2);
+    return(ERROR);
+  }
+  if (!antennaInArrayInitialized) {
+    getAntennaList(&antennaInArray[0]);
+    antennaInArrayInitialized = TRUE;
+  }
   if ((antennaInArray[ant1] && antennaInArray[ant2]) || forceTransfer) {
     if (chunk >= N_CHUNKS) {
       fprintf(stderr, "sendIntegration called with illegal chunk number (%d) - aborting\n", chunk);
       return(ERROR);
     }
-    sWARMData.nChannels = nPoints;
-    sWARMData.uT = uT;
-    sWARMData.duration = duration;
-    sWARMData.ant1 = ant1;
-    sWARMData.pol1 = pol1;
-    sWARMData.ant2 = ant2;
-    sWARMData.pol2 = pol2;
-    sWARMData.chunk = chunk;
+    pthread_once(&senderOnce, startSender);
+    if (!senderRunning)
+      return(ERROR);
+    pthread_mutex_lock(&sendMutex);
+    if (sendCount == SEND_QUEUE_SIZE) {
+      sendStats.dropped++;
+      pthread_mutex_unlock(&sendMutex);
+      return(ERROR);
+    }
+    slot = (sendHead + sendCount) % SEND_QUEUE_SIZE;
+    sendQueueTime[slot] = sendTimeNow();
+    sendCount++;
+    sendStats.queued++;
+    sendStats.queueDepth = sendCount;
+    if (sendCount > sendStats.maxQueueDepth)
+      sendStats.maxQueueDepth = sendCount;
+    pthread_mutex_unlock(&sendMutex);
+
+    sWARMData = &sendQueue[slot];
+    sWARMData->nChannels = nPoints;
+    sWARMData->uT = uT;
+    sWARMData->duration = duration;
+    sWARMData->ant1 = ant1;
+    sWARMData->pol1 = pol1;
+    sWARMData->ant2 = ant2;
+    sWARMData->pol2 = pol2;
+    sWARMData->chunk = chunk;
     if (ant1 == ant2)
       for (i = 0; i < nPoints; i++)
-	sWARMData.lSB[i] = lsbCross[2*i];
+	sWARMData->lSB[i] = lsbCross[2*i];
     else {
-      for (i = 0; i < 2*nPoints; i++) {
-	sWARMData.lSB[i] = lsbCross[i];
-	sWARMData.uSB[i] = usbCross[i];
-      }
+      memcpy(sWARMData->lSB, lsbCross, 2*nPoints*sizeof(float));
+      memcpy(sWARMData->uSB, usbCross, 2*nPoints*sizeof(float));
     }
 
-    /* Send the data to obscon only */
-    if (corrSaverCl == NULL) {
-      if (!(corrSaverCl = clnt_create("obscon", CHUNKPLOTPROG, CHUNKPLOTVERS, "tcp"))) {
-	fprintf(stderr, clnt_spcreateerror("obscon"));
-	return(ERROR);
+    pthread_mutex_lock(&sendMutex);
+    sendReady[slot] = TRUE;
+    pthread_cond_signal(&sendReadyCond);
+    pthread_mutex_unlock(&sendMutex);
+  }
+  return OK;
+}
+
+/*
+  Waits until the sender thread has dealt with every queued record, or
+  timeout seconds have passed.   Returns OK if the queue is empty.
+*/
+int sendIntegrationFlush(double timeout)
+{
+  int rCode;
+  double deadline;
+  struct timespec until;
+
+  deadline = sendTimeNow() + timeout;
+  until.tv_sec = (time_t)deadline;
+  until.tv_nsec = (long)((deadline - (double)until.tv_sec)*1.0e9);
+  pthread_mutex_lock(&sendMutex);
+  while ((sendCount > 0) &&
+	 (pthread_cond_timedwait(&sendDoneCond, &sendMutex, &until) == 0));
+  rCode = (sendCount == 0)? OK: ERROR;
+  pthread_mutex_unlock(&sendMutex);
+  return(rCode);
+}
+
+/*
+  Copies the sender thread's counters into stats.
+*/
+void sendIntegrationGetStats(sendIntegrationStats *stats)
+{
+  pthread_mutex_lock(&sendMutex);
+  *stats = sendStats;
+  pthread_mutex_unlock(&sendMutex);
+}
+
+/*
+  Writes nBytes to the dataCatcher stream, more indicating that more
+  of the frame will follow.
+*/
+int streamWrite(int fd, void *buffer, size_t nBytes, int more)
+{
+  ssize_t nWritten;
+  char *next = (char *)buffer;
+
+  while (nBytes > 0) {
+    nWritten = send(fd, next, nBytes, MSG_NOSIGNAL | (more? MSG_MORE: 0));
+    if (nWritten < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("streamWrite: send");
+      return(ERROR);
+    }
+    next += nWritten;
+    nBytes -= nWritten;
+  }
+  return(OK);
+}
+
+/*
+  Opens the TCP stream to dataCatcher.   Returns the socket, or ERROR.
+  The port is SWARM_STREAM_PORT unless the environment variable named by
+  SWARM_STREAM_PORT_VARIABLE says otherwise, to match a swarmStreamPort
+  line in dataCatcher.conf.   A port of 0 means the stream isn't used.
+*/
+int streamOpen(void)
+{
+  int fd, port, on = 1;
+  char *portString, *end;
+  struct hostent *host;
+  struct sockaddr_in address;
+
+  port = SWARM_STREAM_PORT;
+  if ((portString = getenv(SWARM_STREAM_PORT_VARIABLE)) != NULL) {
+    port = (int)strtol(portString, &end, 10);
+    if ((end == portString) || (*end != (char)0) || (port < 0) || (port > 65535)) {
+      fprintf(stderr, "streamOpen: illegal %s \"%s\" - using %d\n",
+	      SWARM_STREAM_PORT_VARIABLE, portString, SWARM_STREAM_PORT);
+      port = SWARM_STREAM_PORT;
+    }
+  }
+  if (port == 0)
+    return(ERROR);
+  if ((host = gethostbyname(DATA_CATCHER_HOST)) == NULL) {
+    fprintf(stderr, "streamOpen: cannot look up %s\n", DATA_CATCHER_HOST);
+    return(ERROR);
+  }
+  if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    perror("streamOpen: socket");
+    return(ERROR);
+  }
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  memcpy(&address.sin_addr, host->h_addr_list[0], sizeof(address.sin_addr));
+  if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    close(fd);
+    return(ERROR);
+  }
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  return(fd);
+}
+
+/*
+  Returns TRUE if dataCatcher has closed the stream, which it does to a
+  sender that has been idle for SWARM_STREAM_IDLE seconds.   Nothing is
+  sent to us between frames, so anything readable means the end.
+*/
+int streamClosed(int fd)
+{
+  struct pollfd waiting;
+
+  waiting.fd = fd;
+  waiting.events = POLLIN;
+  return(poll(&waiting, 1, 0) != 0);
+}
+
+/*
+  Sends one frame of records, all of which are to be transmitted, and
+  waits for dataCatcher's acknowledgement.   Autocorrelations are sent
+  as nChannels floats, taken from every other lsbCross value as in
+  sendIntegration.   Returns OK, or ERROR if the stream has failed.
+*/
+int streamFrame(int fd, int nRecords, double uT, float duration, swarmStreamRecord *records,
+		float **lsbCross, float **usbCross)
+{
+  int i, record, reply;
+  size_t nFloats;
+  static float *autoBuffer = NULL;
+  static int autoBufferSize = 0;
+  swarmStreamHeader header;
+
+  header.magic = SWARM_STREAM_MAGIC;
+  header.version = SWARM_STREAM_VERSION;
+  header.nRecords = nRecords;
+  header.spare = 0;
+  header.uT = uT;
+  header.duration = duration;
+  if (streamWrite(fd, &header, sizeof(header), TRUE) != OK)
+    return(ERROR);
+  for (record = 0; record < nRecords; record++) {
+    if (streamWrite(fd, &records[record], sizeof(swarmStreamRecord), TRUE) != OK)
+      return(ERROR);
+    if (records[record].ant1 == records[record].ant2) {
+      if (records[record].nChannels > autoBufferSize) {
+	free(autoBuffer);
+	autoBufferSize = records[record].nChannels;
+	if ((autoBuffer = (float *)malloc(autoBufferSize*sizeof(float))) == NULL) {
+	  perror("streamFrame: malloc of autoBuffer");
+	  autoBufferSize = 0;
+	  return(ERROR);
+	}
       }
+      for (i = 0; i < records[record].nChannels; i++)
+	autoBuffer[i] = lsbCross[record][2*i];
+      if (streamWrite(fd, autoBuffer, records[record].nChannels*sizeof(float),
+		      record < nRecords-1) != OK)
+	return(ERROR);
+    } else {
+      nFloats = 2*records[record].nChannels;
+      if ((streamWrite(fd, lsbCross[record], nFloats*sizeof(float), TRUE) != OK) ||
+	  (streamWrite(fd, usbCross[record], nFloats*sizeof(float), record < nRecords-1) != OK))
+	return(ERROR);
     }
-    if (printResults(plot_swarm_data_1(&sWARMData, corrSaverCl))) {
-      fprintf(stderr, "Error returned from corrPlotter call\n");
-      clnt_destroy(corrSaverCl);
-      corrSaverCl = NULL;
+  }
+  if (recv(fd, &reply, sizeof(reply), MSG_WAITALL) != sizeof(reply)) {
+    fprintf(stderr, "streamFrame: no acknowledgement from dataCatcher\n");
+    return(ERROR);
+  }
+  if (reply != nRecords)
+    fprintf(stderr, "streamFrame: dataCatcher stored %d of %d records\n", reply, nRecords);
+  return((reply == ERROR)? ERROR: OK);
+}
+
+/*
+  Sends records one at a time with catch_swarm_data_1, for use when the
+  stream to dataCatcher is not available.
+*/
+int rpcRecords(int nRecords, double uT, float duration, swarmStreamRecord *records,
+	       float **lsbCross, float **usbCross)
+{
+  int i, record, rCode = OK;
+  static CLIENT *dataCatcherCl = NULL;
+  static dSWARMUVBlock block;
+  dStatusStructure *result;
+
+  if (dataCatcherCl == NULL) {
+    if (!(dataCatcherCl = clnt_create(DATA_CATCHER_HOST, DATACATCHERPROG, DATACATCHERVERS, "tcp"))) {
+      fprintf(stderr, clnt_spcreateerror(DATA_CATCHER_HOST));
+      return(ERROR);
     }
   }
-  return OK;
+  for (record = 0; record < nRecords; record++) {
+    block.nChannels = records[record].nChannels;
+    block.uT = uT;
+    block.duration = duration;
+    block.ant1 = records[record].ant1;
+    block.pol1 = records[record].pol1;
+    block.ant2 = records[record].ant2;
+    block.pol2 = records[record].pol2;
+    block.chunk = records[record].chunk;
+    if (block.ant1 == block.ant2)
+      for (i = 0; i < block.nChannels; i++)
+	block.lSB[i] = lsbCross[record][2*i];
+    else {
+      memcpy(block.lSB, lsbCross[record], 2*block.nChannels*sizeof(float));
+      memcpy(block.uSB, usbCross[record], 2*block.nChannels*sizeof(float));
+    }
+    result = catch_swarm_data_1(&block, dataCatcherCl);
+    if (result == NULL) {
+      fprintf(stderr, "catch_swarm_data_1 returned a NULL pointer\n");
+      clnt_destroy(dataCatcherCl);
+      dataCatcherCl = NULL;
+      return(ERROR);
+    } else if (result->rt_code != OK)
+      rCode = ERROR;
+  }
+  return(rCode);
+}
+
+/*
+  sendIntegrationBatch sends nRecords baselines of the integration at uT
+to dataCatcher.   records[i] describes the i'th baseline and chunk, and
+lsbCross[i] and usbCross[i] point to its data, laid out as for sendIntegration.
+The whole batch goes over the TCP stream in as few frames as possible,
+with one round trip per frame.   If the stream cannot be opened (for
+example, dataCatcher has not started its threads yet) the batch is sent
+with one RPC call per record instead, and the stream is tried again on
+the next call.   Baselines with an antenna not in the array are skipped
+unless forceTransfer is set.
+ */
+int sendIntegrationBatch(int nRecords, double uT, float duration, swarmStreamRecord *records,
+			 float **lsbCross, float **usbCross, int forceTransfer)
+{
+  int i, nSend, first, nFrame, rCode = OK;
+  static int antennaInArray[11];
+  static int antennaInArrayInitialized = FALSE;
+  static int streamFd = ERROR;
+  static int keptSize = 0;
+  static swarmStreamRecord *kept = NULL;
+  static float **keptLSB = NULL, **keptUSB = NULL;
+
+  if (!antennaInArrayInitialized) {
+    getAntennaList(&antennaInArray[0]);
+    antennaInArrayInitialized = TRUE;
+  }
+  if (nRecords > keptSize) {
+    free(kept);
+    free(keptLSB);
+    free(keptUSB);
+    kept = (swarmStreamRecord *)malloc(nRecords*sizeof(swarmStreamRecord));
+    keptLSB = (float **)malloc(nRecords*sizeof(float *));
+    keptUSB = (float **)malloc(nRecords*sizeof(float *));
+    if ((kept == NULL) || (keptLSB == NULL) || (keptUSB == NULL)) {
+      perror("sendIntegrationBatch: malloc");
+      keptSize = 0;
+      return(ERROR);
+    }
+    keptSize = nRecords;
+  }
+  nSend = 0;
+  for (i = 0; i < nRecords; i++) {
+    if ((records[i].ant1 < 1) || (records[i].ant1 > N_ANTENNAS) ||
+	(records[i].ant2 < 1) || (records[i].ant2 > N_ANTENNAS) ||
+	(records[i].chunk < 0) || (records[i].chunk >= N_CHUNKS) ||
+	(records[i].nChannels <= 0) || (records[i].nChannels > P_N_SWARM_CHANNELS)) {
+      fprintf(stderr, "sendIntegrationBatch: illegal record %d (%d-%d chunk %d, %d channels) - skipped\n",
+	      i, records[i].ant1, records[i].ant2, records[i].chunk, records[i].nChannels);
+      rCode = ERROR;
+    } else if ((antennaInArray[records[i].ant1] && antennaInArray[records[i].ant2]) || forceTransfer) {
+      kept[nSend] = records[i];
+      keptLSB[nSend] = lsbCross[i];
+      keptUSB[nSend] = usbCross[i];
+      nSend++;
+    }
+  }
+  if ((streamFd != ERROR) && streamClosed(streamFd)) {
+    close(streamFd);
+    streamFd = ERROR;
+  }
+  if (streamFd == ERROR)
+    streamFd = streamOpen();
+  for (first = 0; first < nSend; first += nFrame) {
+    nFrame = nSend - first;
+    if (nFrame > SWARM_STREAM_MAX_RECORDS)
+      nFrame = SWARM_STREAM_MAX_RECORDS;
+    if ((streamFd != ERROR) &&
+	(streamFrame(streamFd, nFrame, uT, duration, &kept[first], &keptLSB[first], &keptUSB[first]) != OK)) {
+      fprintf(stderr, "sendIntegrationBatch: stream to dataCatcher failed - using RPC\n");
+      close(streamFd);
+      streamFd = ERROR;
+      /* Part of the frame may have been stored already, so don't resend it */
+      rCode = ERROR;
+      continue;
+    }
+    if ((streamFd == ERROR) &&
+	(rpcRecords(nFrame, uT, duration, &kept[first], &keptLSB[first], &keptUSB[first]) != OK))
+      rCode = ERROR;
+  }
+  return(rCode);
 }
@@ -0,0 +1,33 @@
+/*
+  sendIntegration.h
+
+  Functions for sending SWARM visibilities to corrSaver and dataCatcher.
+  See sendIntegration.c.
+ */
+#ifndef SEND_INTEGRATION
+#define SEND_INTEGRATION
+
+#include "swarmStream.h"
+
+/* Counters kept by the thread which sends sendIntegration's records to corrSaver */
+typedef struct sendIntegrationStats {
+  unsigned long long queued;     /* Records accepted by sendIntegration             */
+  unsigned long long sent;       /* Records whose window corrSaver acknowledged     */
+  unsigned long long dropped;    /* Records refused because the queue was full      */
+  unsigned long long failed;     /* Records in a window whose RPC call failed       */
+  unsigned long long reconnects; /* Connections made to corrSaver                   */
+  int    queueDepth;             /* Records waiting to be sent, now                 */
+  int    maxQueueDepth;          /* ... and the most there have been                */
+  double latencySum;             /* Seconds from queueing to acknowledgement, summed */
+  double latencyMax;             /* over the sent records, and the largest          */
+} sendIntegrationStats;
+
+int sendIntegration(int nPoints, double uT, float duration, int chunk,
+		    int ant1, int pol1, int ant2, int pol2,
+		    float *lsbCross, float *usbCross, int forceTransfer);
+int sendIntegrationFlush(double timeout);
+void sendIntegrationGetStats(sendIntegrationStats *stats);
+int sendIntegrationBatch(int nRecords, double uT, float duration, swarmStreamRecord *records,
+			 float **lsbCross, float **usbCross, int forceTransfer);
+
+#endif
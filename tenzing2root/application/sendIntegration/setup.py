@@ -10,6 +10,8 @@ setup(
                               '/global/functions/getAntennaList.c',
                               '/global/functions/defaultingEnabled.c',
                               ],
+                             include_dirs=['../dataCatcher/src'],
+                             libraries=['pthread'],
                              extra_compile_args=['-fno-builtin-printf',
                                                  '-fno-builtin-fprintf',
                                                  '-fno-builtin-perror',